@@ -7,6 +7,8 @@
   maintainers,
   stdenv,
   cmake,
+  libxkbcommon,
+  pam,
   wayland,
   wayland-client-protocols,
   xorg,
@@ -17,6 +19,8 @@ let
     extensions = [
       "xdg-shell"
       "ext-session-lock-v1"
+      "viewporter"
+      "single-pixel-buffer-v1"
     ];
   };
 
@@ -28,6 +32,8 @@ stdenv.mkDerivation {
   src = ./wsstest;
   nativeBuildInputs = [ cmake ];
   buildInputs = [
+    libxkbcommon
+    pam
     wayland
     wayland-protocols-lib
     xorg.libxcb
@@ -0,0 +1,105 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "arena.h"
+
+static void
+remove_free(struct arena *arena, size_t i)
+{
+  memmove(
+      &arena->free[i],
+      &arena->free[i + 1],
+      sizeof arena->free[0] * (arena->free_num - i - 1));
+  arena->free_num--;
+}
+
+int
+arena_alloc(struct arena *arena, size_t len, size_t *offset)
+{
+  for (size_t i = 0; i < arena->free_num; i++) {
+    struct arena_range *range = &arena->free[i];
+    if (range->len < len) {
+      continue;
+    }
+
+    *offset = range->offset;
+    range->offset += len;
+    range->len -= len;
+    if (range->len == 0) {
+      remove_free(arena, i);
+    }
+    return 0;
+  }
+
+  /* a free range at the end only needs to grow by the rest */
+  size_t end = arena->len;
+  bool free_end = false;
+  if (arena->free_num > 0) {
+    const struct arena_range *last = &arena->free[arena->free_num - 1];
+    free_end = last->offset + last->len == arena->len;
+    if (free_end) {
+      end = last->offset;
+    }
+  }
+
+  if (end + len > arena->len_max) {
+    fputs("arena_alloc: Pool is full\n", stderr);
+    return -1;
+  }
+
+  if (free_end) {
+    arena->free_num--;
+  }
+  *offset = end;
+  arena->len = end + len;
+  return 0;
+}
+
+void
+arena_free(struct arena *arena, size_t offset, size_t len)
+{
+  size_t i = 0;
+  while (i < arena->free_num && arena->free[i].offset < offset) {
+    i++;
+  }
+
+  struct arena_range *prev = i > 0 ? &arena->free[i - 1] : NULL;
+  struct arena_range *next = i < arena->free_num ? &arena->free[i] : NULL;
+  bool merge_prev = prev != NULL && prev->offset + prev->len == offset;
+  bool merge_next = next != NULL && offset + len == next->offset;
+
+  if (merge_prev && merge_next) {
+    prev->len += len + next->len;
+    remove_free(arena, i);
+    return;
+  }
+  if (merge_prev) {
+    prev->len += len;
+    return;
+  }
+  if (merge_next) {
+    next->offset = offset;
+    next->len += len;
+    return;
+  }
+
+  if (arena->free_num >= arena_free_max) {
+    /* lost until the pool goes, but the caller gave the memory back anyway */
+    fputs("arena_free: Too many free ranges\n", stderr);
+    return;
+  }
+
+  memmove(
+      &arena->free[i + 1],
+      &arena->free[i],
+      sizeof arena->free[0] * (arena->free_num - i));
+  arena->free[i] = (struct arena_range){ .offset = offset, .len = len };
+  arena->free_num++;
+}
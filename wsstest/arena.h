@@ -0,0 +1,46 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef WSSTEST_ARENA_H
+#define WSSTEST_ARENA_H
+
+#include <stddef.h>
+
+/*
+ * ranges of a pool that only grows. allocations take the first free range
+ * that fits, and the pool grows at its end when none does. freed ranges are
+ * merged with free neighbours, to be handed out again. this only does the
+ * bookkeeping, growing the memory behind it is up to the caller.
+ */
+
+enum {
+  arena_free_max = 32,
+};
+
+struct arena_range
+{
+  size_t offset;
+  size_t len;
+};
+
+struct arena
+{
+  /* of the pool, past the end of the last range handed out */
+  size_t len;
+  size_t len_max;
+  /* sorted by offset, never adjacent */
+  size_t free_num;
+  struct arena_range free[arena_free_max];
+};
+
+/* the pool grows to arena->len if needed, -1 if that's past len_max */
+int
+arena_alloc(struct arena *arena, size_t len, size_t *offset);
+
+void
+arena_free(struct arena *arena, size_t offset, size_t len);
+
+#endif /* WSSTEST_ARENA_H */
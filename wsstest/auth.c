@@ -0,0 +1,337 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define _POSIX_C_SOURCE 200809L
+/* explicit_bzero, pipe2 */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <security/pam_appl.h>
+
+#include "auth.h"
+
+/* /etc/pam.d/wsstest, installed from pam/wsstest. the benchmark points these
+ * at a service of its own, in a directory of its own instead of /etc/pam.d */
+static const char pam_service_default[] = "wsstest";
+static const char pam_service_env[] = "WSSTEST_PAM_SERVICE";
+static const char pam_confdir_env[] = "WSSTEST_PAM_CONFDIR";
+
+static struct
+{
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  char *user;
+  char *service;
+  /* NULL for the default of PAM */
+  char *confdir;
+  /* handed from auth_submit to the worker, wiped once it took it */
+  char password[256];
+  size_t password_len;
+  bool pending;
+  /* from auth_submit until the result is written */
+  bool busy;
+  bool stopping;
+  /* the worker writes a byte per attempt to 1, the event loop reads 0 */
+  int result_fds[2];
+  pthread_t thread;
+  bool running;
+} auth = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .wake = PTHREAD_COND_INITIALIZER,
+  .result_fds = { -1, -1 },
+};
+
+static void
+free_responses(struct pam_response *responses, int num)
+{
+  for (int i = 0; i < num; i++) {
+    if (responses[i].resp != NULL) {
+      explicit_bzero(responses[i].resp, strlen(responses[i].resp));
+      free(responses[i].resp);
+    }
+  }
+  free(responses);
+}
+
+/* answers every prompt with the password, PAM frees the answers */
+static int
+converse(
+    int num,
+    const struct pam_message **messages,
+    struct pam_response **responses,
+    void *data)
+{
+  const char *password = data;
+
+  if (num <= 0 || num > PAM_MAX_NUM_MSG) {
+    return PAM_CONV_ERR;
+  }
+
+  *responses = calloc(num, sizeof **responses);
+  if (*responses == NULL) {
+    perror("calloc");
+    return PAM_BUF_ERR;
+  }
+
+  for (int i = 0; i < num; i++) {
+    switch (messages[i]->msg_style) {
+    case PAM_PROMPT_ECHO_OFF:
+    case PAM_PROMPT_ECHO_ON:
+      (*responses)[i].resp = strdup(password);
+      if ((*responses)[i].resp == NULL) {
+        perror("strdup");
+        free_responses(*responses, num);
+        *responses = NULL;
+        return PAM_BUF_ERR;
+      }
+      break;
+
+    case PAM_ERROR_MSG:
+    case PAM_TEXT_INFO:
+      fprintf(stderr, "pam: %s\n", messages[i]->msg);
+      break;
+
+    default:
+      break;
+    } /* switch (messages[i]->msg_style) */
+  }
+
+  return PAM_SUCCESS;
+}
+
+static bool
+authenticate(const char *password)
+{
+  int error = 0;
+
+  /* the conversation only reads it */
+  struct pam_conv conv = {
+    .conv = converse,
+    .appdata_ptr = (void *)password,
+  };
+  pam_handle_t *pam = NULL;
+  if (auth.confdir != NULL) {
+    error = pam_start_confdir(
+        auth.service,
+        auth.user,
+        &conv,
+        auth.confdir,
+        &pam);
+  } else {
+    error = pam_start(auth.service, auth.user, &conv, &pam);
+  }
+  if (error != PAM_SUCCESS) {
+    fprintf(stderr, "pam_start: %s\n", pam_strerror(pam, error));
+    return false;
+  }
+
+  error = pam_authenticate(pam, 0);
+  if (error != PAM_SUCCESS) {
+    fprintf(stderr, "pam_authenticate: %s\n", pam_strerror(pam, error));
+  }
+
+  if (error == PAM_SUCCESS) {
+    error = pam_acct_mgmt(pam, 0);
+    if (error != PAM_SUCCESS) {
+      fprintf(stderr, "pam_acct_mgmt: %s\n", pam_strerror(pam, error));
+    }
+  }
+
+  /* kerberos tickets and the like, not a reason to stay locked */
+  if (error == PAM_SUCCESS) {
+    int setcred_error = pam_setcred(pam, PAM_REFRESH_CRED);
+    if (setcred_error != PAM_SUCCESS) {
+      fprintf(stderr, "pam_setcred: %s\n", pam_strerror(pam, setcred_error));
+    }
+  }
+
+  pam_end(pam, error);
+  return error == PAM_SUCCESS;
+}
+
+static void *
+auth_thread(void *data)
+{
+  (void)data;
+  char password[sizeof auth.password] = { 0 };
+
+  while (true) {
+    pthread_mutex_lock(&auth.lock);
+    while (!auth.pending && !auth.stopping) {
+      pthread_cond_wait(&auth.wake, &auth.lock);
+    }
+    if (auth.stopping) {
+      pthread_mutex_unlock(&auth.lock);
+      break;
+    }
+    memcpy(password, auth.password, sizeof password);
+    explicit_bzero(auth.password, sizeof auth.password);
+    auth.password_len = 0;
+    auth.pending = false;
+    pthread_mutex_unlock(&auth.lock);
+
+    char result = authenticate(password);
+    explicit_bzero(password, sizeof password);
+
+    ssize_t written = write(auth.result_fds[1], &result, sizeof result);
+    if (written < 0) {
+      perror("write");
+    }
+
+    pthread_mutex_lock(&auth.lock);
+    auth.busy = false;
+    pthread_mutex_unlock(&auth.lock);
+  }
+
+  return NULL;
+}
+
+static void
+cleanup_auth(void)
+{
+  for (size_t i = 0; i < 2; i++) {
+    if (auth.result_fds[i] >= 0) {
+      close(auth.result_fds[i]);
+      auth.result_fds[i] = -1;
+    }
+  }
+  free(auth.user);
+  auth.user = NULL;
+  free(auth.service);
+  auth.service = NULL;
+  free(auth.confdir);
+  auth.confdir = NULL;
+}
+
+int
+auth_start(void)
+{
+  int error = 0;
+
+  /* whoever started us is who unlocks */
+  struct passwd *passwd = getpwuid(getuid());
+  if (passwd == NULL) {
+    perror("getpwuid");
+    return -1;
+  }
+  auth.user = strdup(passwd->pw_name);
+  if (auth.user == NULL) {
+    perror("strdup");
+    return -1;
+  }
+
+  const char *service = getenv(pam_service_env);
+  auth.service = strdup(service != NULL ? service : pam_service_default);
+  const char *confdir = getenv(pam_confdir_env);
+  if (confdir != NULL) {
+    auth.confdir = strdup(confdir);
+  }
+  if (auth.service == NULL || (confdir != NULL && auth.confdir == NULL)) {
+    perror("strdup");
+    cleanup_auth();
+    return -1;
+  }
+
+  error = pipe2(auth.result_fds, O_CLOEXEC);
+  if (error != 0) {
+    perror("pipe2");
+    cleanup_auth();
+    return -1;
+  }
+  /* the event loop only reads once poll says so, but don't ever block it */
+  error = fcntl(auth.result_fds[0], F_SETFL, O_NONBLOCK);
+  if (error != 0) {
+    perror("fcntl");
+    cleanup_auth();
+    return -1;
+  }
+
+  error = pthread_create(&auth.thread, NULL, auth_thread, NULL);
+  if (error != 0) {
+    errno = error;
+    perror("pthread_create");
+    cleanup_auth();
+    return -1;
+  }
+  auth.running = true;
+
+  return 0;
+}
+
+int
+auth_fd(void)
+{
+  return auth.result_fds[0];
+}
+
+int
+auth_submit(const char *password, size_t len)
+{
+  if (len >= sizeof auth.password) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&auth.lock);
+  if (auth.busy || !auth.running) {
+    pthread_mutex_unlock(&auth.lock);
+    return -1;
+  }
+  memcpy(auth.password, password, len);
+  auth.password[len] = '\0';
+  auth.password_len = len;
+  auth.pending = true;
+  auth.busy = true;
+  pthread_cond_signal(&auth.wake);
+  pthread_mutex_unlock(&auth.lock);
+
+  return 0;
+}
+
+int
+auth_result(void)
+{
+  char result = 0;
+  ssize_t got = read(auth.result_fds[0], &result, sizeof result);
+  if (got < 0) {
+    if (errno != EAGAIN) {
+      perror("read");
+    }
+    return -1;
+  }
+  if (got == 0) {
+    return -1;
+  }
+
+  return result != 0;
+}
+
+void
+auth_stop(void)
+{
+  if (!auth.running) {
+    return;
+  }
+
+  pthread_mutex_lock(&auth.lock);
+  auth.stopping = true;
+  explicit_bzero(auth.password, sizeof auth.password);
+  auth.pending = false;
+  pthread_cond_signal(&auth.wake);
+  pthread_mutex_unlock(&auth.lock);
+
+  pthread_join(auth.thread, NULL);
+  auth.running = false;
+  cleanup_auth();
+}
@@ -0,0 +1,38 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef WSSTEST_AUTH_H
+#define WSSTEST_AUTH_H
+
+#include <stddef.h>
+
+/*
+ * PAM, on a worker thread. authenticating may take seconds (network logins,
+ * fingerprint readers, faillock delays) and the frames and pings have to go on
+ * meanwhile. the result of each attempt comes back through auth_fd, which the
+ * event loop polls.
+ */
+
+int
+auth_start(void);
+
+/* readable once an attempt has finished */
+int
+auth_fd(void);
+
+/* copies the password, from any thread. -1 while an attempt is running */
+int
+auth_submit(const char *password, size_t len);
+
+/* 1 if the attempt succeeded, 0 if it failed, -1 if none has finished */
+int
+auth_result(void);
+
+/* waits for an attempt that's still running */
+void
+auth_stop(void);
+
+#endif /* WSSTEST_AUTH_H */
@@ -0,0 +1,69 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bench-alloc.h"
+
+/* glibc's own, what it calls malloc and the rest when nothing stands in */
+void *
+__libc_malloc(size_t size);
+void *
+__libc_calloc(size_t nmemb, size_t size);
+void *
+__libc_realloc(void *ptr, size_t size);
+void
+__libc_free(void *ptr);
+
+static struct bench_allocs counted = { 0 };
+
+static void
+count_alloc(size_t size)
+{
+  __atomic_add_fetch(&counted.allocs, 1, __ATOMIC_RELAXED);
+  if (size >= bench_alloc_large) {
+    __atomic_add_fetch(&counted.large, 1, __ATOMIC_RELAXED);
+  }
+}
+
+void
+bench_allocs_read(struct bench_allocs *allocs)
+{
+  allocs->allocs = __atomic_load_n(&counted.allocs, __ATOMIC_RELAXED);
+  allocs->large = __atomic_load_n(&counted.large, __ATOMIC_RELAXED);
+}
+
+void *
+malloc(size_t size)
+{
+  count_alloc(size);
+  return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+  /* glibc's checks the overflow */
+  count_alloc(size != 0 && nmemb > SIZE_MAX / size ? SIZE_MAX : nmemb * size);
+  return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+  count_alloc(size);
+  return __libc_realloc(ptr, size);
+}
+
+/* glibc wants free to stand in too, once malloc does */
+void
+free(void *ptr)
+{
+  __libc_free(ptr);
+}
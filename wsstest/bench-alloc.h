@@ -0,0 +1,36 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef WSSTEST_BENCH_ALLOC_H
+#define WSSTEST_BENCH_ALLOC_H
+
+/*
+ * counts the heap allocations of the whole benchmark process, libraries and
+ * all, by standing in for malloc, calloc and realloc and passing them on to
+ * glibc's. the frame path should only make small ones once warmed up, the
+ * wl_callbacks and requests libwayland allocates, and none the size of a strip
+ * or a frame.
+ */
+
+#include <stdint.h>
+
+/* anything this big is frame data, or a good part of it */
+enum {
+  bench_alloc_large = 1 << 16,
+};
+
+struct bench_allocs
+{
+  uint64_t allocs;
+  /* of allocs, at least bench_alloc_large bytes */
+  uint64_t large;
+};
+
+/* so far, from all threads */
+void
+bench_allocs_read(struct bench_allocs *allocs);
+
+#endif /* WSSTEST_BENCH_ALLOC_H */
@@ -0,0 +1,1011 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define _POSIX_C_SOURCE 200809L
+/* memfd_create */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/input-event-codes.h>
+#include <wayland-server-core.h>
+#include <wayland-server-protocol.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "bench-compositor.h"
+
+#define COUNTOF(array) (sizeof(array) / sizeof(array)[0])
+
+enum {
+  compositor_version = 4,
+  output_version = 2,
+  seat_version = 1,
+  /* one in this many keys clears what the others typed */
+  keys_cleared = 32,
+};
+
+/* what the outputs take turns at, a wall of mismatched monitors */
+static const struct
+{
+  int32_t width;
+  int32_t height;
+  /* in mHz */
+  int32_t refresh;
+} output_modes[] = {
+  { 1920, 1080, 60000 },
+  { 2560, 1440, 60000 },
+  { 3840, 2160, 60000 },
+  { 1280, 1024, 75000 },
+};
+
+struct bench_compositor
+{
+  struct wl_display *display;
+  pthread_t thread;
+  bool running;
+  struct wl_event_source *hotplug_timer;
+  uint32_t hotplug_ms;
+  size_t hotplugs_num;
+  /* the output that's plugged in on top of the others, if it is */
+  struct wl_global *hotplugged;
+  /* removed on its last turn, and destroyed on the next one so the client had
+   * the time to see it go before binding it would be an error */
+  struct wl_global *unplugged;
+  struct wl_event_source *key_timer;
+  uint32_t key_ms;
+  uint32_t keys_num;
+  /* the default one of xkbcommon */
+  int keymap_fd;
+  uint32_t keymap_len;
+  /* of the client, once it asked */
+  struct wl_resource *keyboard;
+  bool paced;
+  struct bench_frames *frames;
+  size_t frames_num;
+  /* made by the client so far */
+  size_t surfaces_num;
+  /* watches for wl_buffers, if they're counted */
+  struct wl_listener resource_created;
+  size_t *buffers;
+};
+
+/* one of the wl_buffers of the client, until it's destroyed */
+struct buffer_watch
+{
+  struct wl_listener destroy;
+  size_t *buffers;
+};
+
+struct surface
+{
+  /* NOTE: the client is trusted not to destroy an attached buffer */
+  struct wl_resource *buffer;
+  struct wl_resource *frame_callbacks[8];
+  size_t frame_callbacks_num;
+  /* the first of frame_callbacks, committed and waiting for the refresh */
+  size_t committed_num;
+  /* fires at the refresh rate of the output it's paced to, if it is */
+  int refresh_fd;
+  struct wl_event_source *refresh;
+  /* when the last frame callbacks were answered, 0 once committed to */
+  uint64_t answered_ns;
+  /* where its numbers go, if anywhere */
+  struct bench_frames *frames;
+  /* bounds of the pending damage, empty if x0 >= x1 */
+  int32_t damage_x0;
+  int32_t damage_y0;
+  int32_t damage_x1;
+  int32_t damage_y1;
+  /* where the damaged pixels are "uploaded" to */
+  uint8_t *texture;
+  size_t texture_len;
+};
+
+static uint32_t
+now_ms(void)
+{
+  struct timespec now = { 0 };
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static uint64_t
+now_ns(void)
+{
+  struct timespec now = { 0 };
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void
+handle_region_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+  (void)client;
+  wl_resource_destroy(resource);
+}
+
+static void
+handle_region_add(
+    struct wl_client *client,
+    struct wl_resource *resource,
+    int32_t x,
+    int32_t y,
+    int32_t width,
+    int32_t height)
+{
+  (void)client;
+  (void)resource;
+  (void)x;
+  (void)y;
+  (void)width;
+  (void)height;
+}
+
+static const struct wl_region_interface region_implementation = {
+  .destroy = handle_region_destroy,
+  .add = handle_region_add,
+  .subtract = handle_region_add,
+};
+
+static void
+reset_damage(struct surface *surface)
+{
+  surface->damage_x0 = INT32_MAX;
+  surface->damage_y0 = INT32_MAX;
+  surface->damage_x1 = 0;
+  surface->damage_y1 = 0;
+}
+
+static void
+free_surface(struct surface *surface)
+{
+  if (surface->refresh != NULL) {
+    wl_event_source_remove(surface->refresh);
+  }
+  if (surface->refresh_fd >= 0) {
+    close(surface->refresh_fd);
+  }
+  free(surface->texture);
+  free(surface);
+}
+
+static void
+destroy_surface(struct wl_resource *resource)
+{
+  free_surface(wl_resource_get_user_data(resource));
+}
+
+/* the first num of them, the rest wait for a commit */
+static void
+answer_frame_callbacks(struct surface *surface, size_t num)
+{
+  if (num == 0) {
+    return;
+  }
+
+  uint32_t time = now_ms();
+  for (size_t i = 0; i < num; i++) {
+    wl_callback_send_done(surface->frame_callbacks[i], time);
+    wl_resource_destroy(surface->frame_callbacks[i]);
+  }
+  surface->frame_callbacks_num -= num;
+  memmove(
+      surface->frame_callbacks,
+      &surface->frame_callbacks[num],
+      sizeof *surface->frame_callbacks * surface->frame_callbacks_num);
+  surface->committed_num = 0;
+  surface->answered_ns = now_ns();
+}
+
+/* a vblank of the output, the frames committed since are shown now */
+static int
+handle_refresh(int fd, uint32_t mask, void *data)
+{
+  struct surface *surface = data;
+  (void)mask;
+
+  uint64_t expirations = 0;
+  if (read(fd, &expirations, sizeof expirations) < 0 && errno != EAGAIN) {
+    perror("read");
+  }
+
+  answer_frame_callbacks(surface, surface->committed_num);
+  return 0;
+}
+
+/* a timer at the refresh rate of output n */
+static int
+pace_surface(struct wl_event_loop *loop, size_t n, struct surface *surface)
+{
+  int32_t refresh = output_modes[n % COUNTOF(output_modes)].refresh;
+  uint64_t period_ns = (uint64_t)1000000000000 / refresh;
+  struct timespec period = {
+    .tv_sec = period_ns / 1000000000,
+    .tv_nsec = period_ns % 1000000000,
+  };
+
+  surface->refresh_fd = timerfd_create(
+      CLOCK_MONOTONIC,
+      TFD_CLOEXEC | TFD_NONBLOCK);
+  if (surface->refresh_fd < 0) {
+    perror("timerfd_create");
+    return -1;
+  }
+  int error = timerfd_settime(
+      surface->refresh_fd,
+      0,
+      &(struct itimerspec){ .it_interval = period, .it_value = period },
+      NULL);
+  if (error != 0) {
+    perror("timerfd_settime");
+    return -1;
+  }
+
+  surface->refresh = wl_event_loop_add_fd(
+      loop,
+      surface->refresh_fd,
+      WL_EVENT_READABLE,
+      handle_refresh,
+      surface);
+  if (surface->refresh == NULL) {
+    perror("wl_event_loop_add_fd");
+    return -1;
+  }
+
+  return 0;
+}
+
+static void
+handle_surface_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+  (void)client;
+  wl_resource_destroy(resource);
+}
+
+static void
+handle_surface_attach(
+    struct wl_client *client,
+    struct wl_resource *resource,
+    struct wl_resource *buffer,
+    int32_t x,
+    int32_t y)
+{
+  struct surface *surface = wl_resource_get_user_data(resource);
+  (void)client;
+  (void)x;
+  (void)y;
+
+  surface->buffer = buffer;
+}
+
+/* surface and buffer coordinates are the same here, no scale or transform */
+static void
+handle_surface_damage(
+    struct wl_client *client,
+    struct wl_resource *resource,
+    int32_t x,
+    int32_t y,
+    int32_t width,
+    int32_t height)
+{
+  struct surface *surface = wl_resource_get_user_data(resource);
+  (void)client;
+
+  int32_t x1 = width > INT32_MAX - x ? INT32_MAX : x + width;
+  int32_t y1 = height > INT32_MAX - y ? INT32_MAX : y + height;
+  if (x < surface->damage_x0) {
+    surface->damage_x0 = x < 0 ? 0 : x;
+  }
+  if (y < surface->damage_y0) {
+    surface->damage_y0 = y < 0 ? 0 : y;
+  }
+  if (x1 > surface->damage_x1) {
+    surface->damage_x1 = x1;
+  }
+  if (y1 > surface->damage_y1) {
+    surface->damage_y1 = y1;
+  }
+}
+
+static void
+handle_surface_frame(
+    struct wl_client *client,
+    struct wl_resource *resource,
+    uint32_t callback)
+{
+  struct surface *surface = wl_resource_get_user_data(resource);
+
+  struct wl_resource *frame_callback =
+      wl_resource_create(client, &wl_callback_interface, 1, callback);
+  if (frame_callback == NULL) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+
+  if (surface->frame_callbacks_num >= COUNTOF(surface->frame_callbacks)) {
+    wl_callback_send_done(frame_callback, now_ms());
+    wl_resource_destroy(frame_callback);
+    return;
+  }
+
+  surface->frame_callbacks[surface->frame_callbacks_num++] = frame_callback;
+}
+
+static void
+handle_surface_set_region(
+    struct wl_client *client,
+    struct wl_resource *resource,
+    struct wl_resource *region)
+{
+  (void)client;
+  (void)resource;
+  (void)region;
+}
+
+static void
+upload_damage(struct surface *surface, struct wl_shm_buffer *shm_buffer)
+{
+  int32_t buffer_stride = wl_shm_buffer_get_stride(shm_buffer);
+  int32_t buffer_width = wl_shm_buffer_get_width(shm_buffer);
+  int32_t buffer_height = wl_shm_buffer_get_height(shm_buffer);
+  size_t texture_len = (size_t)buffer_stride * buffer_height;
+
+  if (surface->texture_len != texture_len) {
+    free(surface->texture);
+    surface->texture = malloc(texture_len);
+    surface->texture_len = surface->texture == NULL ? 0 : texture_len;
+  }
+  if (surface->texture == NULL) {
+    return;
+  }
+
+  int32_t x1 =
+      surface->damage_x1 < buffer_width ? surface->damage_x1 : buffer_width;
+  int32_t y1 =
+      surface->damage_y1 < buffer_height ? surface->damage_y1 : buffer_height;
+  if (surface->damage_x0 >= x1 || surface->damage_y0 >= y1) {
+    return;
+  }
+
+  /* assuming 4 bytes per pixel, like everything wsstest sends */
+  size_t offset = sizeof(uint32_t) * surface->damage_x0;
+  size_t len = sizeof(uint32_t) * (x1 - surface->damage_x0);
+
+  wl_shm_buffer_begin_access(shm_buffer);
+  const uint8_t *data = wl_shm_buffer_get_data(shm_buffer);
+  for (int32_t y = surface->damage_y0; y < y1; y++) {
+    size_t row = (size_t)buffer_stride * y + offset;
+    memcpy(&surface->texture[row], &data[row], len);
+  }
+  wl_shm_buffer_end_access(shm_buffer);
+}
+
+/* like a compositor done with the buffer as soon as it's uploaded */
+static void
+handle_surface_commit(struct wl_client *client, struct wl_resource *resource)
+{
+  struct surface *surface = wl_resource_get_user_data(resource);
+  (void)client;
+
+  struct bench_frames *frames = surface->frames;
+  if (frames != NULL && surface->buffer != NULL) {
+    frames->frames++;
+  }
+  if (frames != NULL && surface->answered_ns != 0 &&
+      frames->latencies_num < frames->latencies_max) {
+    frames->latencies_ns[frames->latencies_num++] =
+        now_ns() - surface->answered_ns;
+  }
+  surface->answered_ns = 0;
+
+  if (surface->buffer != NULL) {
+    struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get(surface->buffer);
+    if (shm_buffer != NULL) {
+      upload_damage(surface, shm_buffer);
+    }
+    wl_buffer_send_release(surface->buffer);
+    surface->buffer = NULL;
+  }
+  reset_damage(surface);
+
+  if (surface->refresh != NULL) {
+    surface->committed_num = surface->frame_callbacks_num;
+    return;
+  }
+  answer_frame_callbacks(surface, surface->frame_callbacks_num);
+}
+
+static void
+handle_surface_set_int(
+    struct wl_client *client,
+    struct wl_resource *resource,
+    int32_t value)
+{
+  (void)client;
+  (void)resource;
+  (void)value;
+}
+
+static const struct wl_surface_interface surface_implementation = {
+  .destroy = handle_surface_destroy,
+  .attach = handle_surface_attach,
+  .damage = handle_surface_damage,
+  .frame = handle_surface_frame,
+  .set_opaque_region = handle_surface_set_region,
+  .set_input_region = handle_surface_set_region,
+  .commit = handle_surface_commit,
+  .set_buffer_transform = handle_surface_set_int,
+  .set_buffer_scale = handle_surface_set_int,
+  .damage_buffer = handle_surface_damage,
+};
+
+static void
+handle_compositor_create_surface(
+    struct wl_client *client,
+    struct wl_resource *resource,
+    uint32_t id)
+{
+  struct bench_compositor *compositor = wl_resource_get_user_data(resource);
+
+  struct surface *surface = calloc(1, sizeof *surface);
+  if (surface == NULL) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+  surface->refresh_fd = -1;
+  reset_damage(surface);
+
+  size_t n = compositor->surfaces_num++;
+  if (n < compositor->frames_num) {
+    surface->frames = &compositor->frames[n];
+  }
+  if (compositor->paced) {
+    int error = pace_surface(
+        wl_display_get_event_loop(compositor->display),
+        n,
+        surface);
+    if (error != 0) {
+      free_surface(surface);
+      wl_client_post_no_memory(client);
+      return;
+    }
+  }
+
+  struct wl_resource *surface_resource = wl_resource_create(
+      client,
+      &wl_surface_interface,
+      wl_resource_get_version(resource),
+      id);
+  if (surface_resource == NULL) {
+    free_surface(surface);
+    wl_client_post_no_memory(client);
+    return;
+  }
+
+  wl_resource_set_implementation(
+      surface_resource,
+      &surface_implementation,
+      surface,
+      destroy_surface);
+}
+
+static void
+handle_compositor_create_region(
+    struct wl_client *client,
+    struct wl_resource *resource,
+    uint32_t id)
+{
+  (void)resource;
+
+  struct wl_resource *region =
+      wl_resource_create(client, &wl_region_interface, 1, id);
+  if (region == NULL) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+
+  wl_resource_set_implementation(region, &region_implementation, NULL, NULL);
+}
+
+static const struct wl_compositor_interface compositor_implementation = {
+  .create_surface = handle_compositor_create_surface,
+  .create_region = handle_compositor_create_region,
+};
+
+static void
+bind_compositor(
+    struct wl_client *client,
+    void *data,
+    uint32_t version,
+    uint32_t id)
+{
+  struct wl_resource *resource =
+      wl_resource_create(client, &wl_compositor_interface, version, id);
+  if (resource == NULL) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+
+  wl_resource_set_implementation(
+      resource,
+      &compositor_implementation,
+      data,
+      NULL);
+}
+
+static void
+handle_output_release(struct wl_client *client, struct wl_resource *resource)
+{
+  (void)client;
+  wl_resource_destroy(resource);
+}
+
+static const struct wl_output_interface output_implementation = {
+  .release = handle_output_release,
+};
+
+/* data is the index into output_modes, smuggled in the pointer */
+static void
+bind_output(struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+  size_t mode = (uintptr_t)data;
+
+  struct wl_resource *resource =
+      wl_resource_create(client, &wl_output_interface, version, id);
+  if (resource == NULL) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+
+  wl_resource_set_implementation(resource, &output_implementation, NULL, NULL);
+
+  wl_output_send_geometry(
+      resource,
+      0,
+      0,
+      0,
+      0,
+      WL_OUTPUT_SUBPIXEL_UNKNOWN,
+      "wsstest",
+      "bench",
+      WL_OUTPUT_TRANSFORM_NORMAL);
+  wl_output_send_mode(
+      resource,
+      WL_OUTPUT_MODE_CURRENT,
+      output_modes[mode].width,
+      output_modes[mode].height,
+      output_modes[mode].refresh);
+  if (version >= 2) {
+    wl_output_send_scale(resource, 1);
+    wl_output_send_done(resource);
+  }
+}
+
+static void
+handle_keyboard_release(struct wl_client *client, struct wl_resource *resource)
+{
+  (void)client;
+  wl_resource_destroy(resource);
+}
+
+static const struct wl_keyboard_interface keyboard_implementation = {
+  .release = handle_keyboard_release,
+};
+
+static void
+destroy_keyboard(struct wl_resource *resource)
+{
+  struct bench_compositor *compositor = wl_resource_get_user_data(resource);
+  if (compositor->keyboard == resource) {
+    compositor->keyboard = NULL;
+  }
+}
+
+static void
+handle_seat_get_keyboard(
+    struct wl_client *client,
+    struct wl_resource *resource,
+    uint32_t id)
+{
+  struct bench_compositor *compositor = wl_resource_get_user_data(resource);
+
+  struct wl_resource *keyboard = wl_resource_create(
+      client,
+      &wl_keyboard_interface,
+      wl_resource_get_version(resource),
+      id);
+  if (keyboard == NULL) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+
+  wl_resource_set_implementation(
+      keyboard,
+      &keyboard_implementation,
+      compositor,
+      destroy_keyboard);
+  wl_keyboard_send_keymap(
+      keyboard,
+      WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1,
+      compositor->keymap_fd,
+      compositor->keymap_len);
+  compositor->keyboard = keyboard;
+}
+
+/* there's only a keyboard */
+static void
+handle_seat_get_missing(
+    struct wl_client *client,
+    struct wl_resource *resource,
+    uint32_t id)
+{
+  (void)client;
+  (void)id;
+
+  wl_resource_post_error(
+      resource,
+      WL_SEAT_ERROR_MISSING_CAPABILITY,
+      "bench compositor: Only a keyboard");
+}
+
+static const struct wl_seat_interface seat_implementation = {
+  .get_pointer = handle_seat_get_missing,
+  .get_keyboard = handle_seat_get_keyboard,
+  .get_touch = handle_seat_get_missing,
+};
+
+static void
+bind_seat(struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+  struct wl_resource *resource =
+      wl_resource_create(client, &wl_seat_interface, version, id);
+  if (resource == NULL) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+
+  wl_resource_set_implementation(resource, &seat_implementation, data, NULL);
+  wl_seat_send_capabilities(resource, WL_SEAT_CAPABILITY_KEYBOARD);
+}
+
+/* the keymap sent to every keyboard, into a file for the fd to send */
+static int
+create_keymap(struct bench_compositor *compositor)
+{
+  struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+  if (context == NULL) {
+    fputs("xkb_context_new: Failed\n", stderr);
+    return -1;
+  }
+  struct xkb_keymap *keymap = xkb_keymap_new_from_names(
+      context,
+      NULL,
+      XKB_KEYMAP_COMPILE_NO_FLAGS);
+  xkb_context_unref(context);
+  if (keymap == NULL) {
+    fputs("xkb_keymap_new_from_names: Failed\n", stderr);
+    return -1;
+  }
+  char *keymap_string =
+      xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+  xkb_keymap_unref(keymap);
+  if (keymap_string == NULL) {
+    fputs("xkb_keymap_get_as_string: Failed\n", stderr);
+    return -1;
+  }
+
+  /* with the terminating nul, like compositors send it */
+  size_t len = strlen(keymap_string) + 1;
+  compositor->keymap_fd = memfd_create("wsstest-bench-keymap", MFD_CLOEXEC);
+  if (compositor->keymap_fd < 0) {
+    perror("memfd_create");
+    free(keymap_string);
+    return -1;
+  }
+  ssize_t written = write(compositor->keymap_fd, keymap_string, len);
+  free(keymap_string);
+  if (written < 0 || (size_t)written != len) {
+    perror("write");
+    return -1;
+  }
+  compositor->keymap_len = len;
+
+  return 0;
+}
+
+/* types one of the letters of the top row, or escape now and then */
+static int
+handle_key_timer(void *data)
+{
+  struct bench_compositor *compositor = data;
+
+  if (compositor->keyboard != NULL) {
+    uint32_t n = compositor->keys_num++;
+    uint32_t key = n % keys_cleared == 0 ? KEY_ESC : KEY_Q + n % 10;
+    uint32_t time = now_ms();
+    wl_keyboard_send_key(
+        compositor->keyboard,
+        2 * n,
+        time,
+        key,
+        WL_KEYBOARD_KEY_STATE_PRESSED);
+    wl_keyboard_send_key(
+        compositor->keyboard,
+        2 * n + 1,
+        time,
+        key,
+        WL_KEYBOARD_KEY_STATE_RELEASED);
+  }
+
+  wl_event_source_timer_update(compositor->key_timer, compositor->key_ms);
+  return 0;
+}
+
+/* plugs an output in, or the one it plugged in out again */
+static int
+handle_hotplug_timer(void *data)
+{
+  struct bench_compositor *compositor = data;
+
+  if (compositor->hotplugged != NULL) {
+    wl_global_remove(compositor->hotplugged);
+    compositor->unplugged = compositor->hotplugged;
+    compositor->hotplugged = NULL;
+  } else {
+    if (compositor->unplugged != NULL) {
+      wl_global_destroy(compositor->unplugged);
+      compositor->unplugged = NULL;
+    }
+    size_t mode = compositor->hotplugs_num++ % COUNTOF(output_modes);
+    compositor->hotplugged = wl_global_create(
+        compositor->display,
+        &wl_output_interface,
+        output_version,
+        (void *)(uintptr_t)mode,
+        bind_output);
+    if (compositor->hotplugged == NULL) {
+      perror("wl_global_create");
+    }
+  }
+
+  wl_event_source_timer_update(
+      compositor->hotplug_timer,
+      compositor->hotplug_ms);
+  return 0;
+}
+
+static void
+handle_buffer_destroy(struct wl_listener *listener, void *data)
+{
+  struct buffer_watch *watch = wl_container_of(listener, watch, destroy);
+  (void)data;
+
+  __atomic_sub_fetch(watch->buffers, 1, __ATOMIC_RELAXED);
+  free(watch);
+}
+
+/* libwayland's wl_shm makes the wl_buffers, so they're counted from here */
+static void
+handle_resource_created(struct wl_listener *listener, void *data)
+{
+  struct bench_compositor *compositor =
+      wl_container_of(listener, compositor, resource_created);
+  struct wl_resource *resource = data;
+
+  if (strcmp(wl_resource_get_class(resource), "wl_buffer") != 0) {
+    return;
+  }
+
+  struct buffer_watch *watch = calloc(1, sizeof *watch);
+  if (watch == NULL) {
+    perror("calloc");
+    return;
+  }
+  watch->buffers = compositor->buffers;
+  watch->destroy.notify = handle_buffer_destroy;
+  wl_resource_add_destroy_listener(resource, &watch->destroy);
+  __atomic_add_fetch(watch->buffers, 1, __ATOMIC_RELAXED);
+}
+
+static void *
+run_compositor(void *data)
+{
+  struct bench_compositor *compositor = data;
+  wl_display_run(compositor->display);
+  return NULL;
+}
+
+int
+bench_compositor_start(
+    struct bench_compositor **compositor,
+    const struct bench_compositor_options *options,
+    int *client_fd)
+{
+  int error = 0;
+
+  *compositor = calloc(1, sizeof **compositor);
+  if (*compositor == NULL) {
+    perror("calloc");
+    return -1;
+  }
+
+  (*compositor)->keymap_fd = -1;
+  (*compositor)->display = wl_display_create();
+  if ((*compositor)->display == NULL) {
+    perror("wl_display_create");
+    bench_compositor_stop(compositor);
+    return -1;
+  }
+
+  error = wl_display_init_shm((*compositor)->display);
+  if (error != 0) {
+    perror("wl_display_init_shm");
+    bench_compositor_stop(compositor);
+    return -1;
+  }
+
+  (*compositor)->paced = options->paced;
+  (*compositor)->frames = options->frames;
+  (*compositor)->frames_num = options->frames_num;
+  struct wl_global *global = wl_global_create(
+      (*compositor)->display,
+      &wl_compositor_interface,
+      compositor_version,
+      *compositor,
+      bind_compositor);
+  if (global == NULL) {
+    perror("wl_global_create");
+    bench_compositor_stop(compositor);
+    return -1;
+  }
+
+  for (size_t i = 0; i < options->outputs_num; i++) {
+    global = wl_global_create(
+        (*compositor)->display,
+        &wl_output_interface,
+        output_version,
+        (void *)(uintptr_t)(i % COUNTOF(output_modes)),
+        bind_output);
+    if (global == NULL) {
+      perror("wl_global_create");
+      bench_compositor_stop(compositor);
+      return -1;
+    }
+  }
+
+  if (options->hotplug_ms != 0) {
+    (*compositor)->hotplug_ms = options->hotplug_ms;
+    (*compositor)->hotplug_timer = wl_event_loop_add_timer(
+        wl_display_get_event_loop((*compositor)->display),
+        handle_hotplug_timer,
+        *compositor);
+    if ((*compositor)->hotplug_timer == NULL) {
+      perror("wl_event_loop_add_timer");
+      bench_compositor_stop(compositor);
+      return -1;
+    }
+    wl_event_source_timer_update(
+        (*compositor)->hotplug_timer,
+        options->hotplug_ms);
+  }
+
+  if (options->key_ms != 0) {
+    error = create_keymap(*compositor);
+    if (error != 0) {
+      bench_compositor_stop(compositor);
+      return -1;
+    }
+    global = wl_global_create(
+        (*compositor)->display,
+        &wl_seat_interface,
+        seat_version,
+        *compositor,
+        bind_seat);
+    if (global == NULL) {
+      perror("wl_global_create");
+      bench_compositor_stop(compositor);
+      return -1;
+    }
+    (*compositor)->key_ms = options->key_ms;
+    (*compositor)->key_timer = wl_event_loop_add_timer(
+        wl_display_get_event_loop((*compositor)->display),
+        handle_key_timer,
+        *compositor);
+    if ((*compositor)->key_timer == NULL) {
+      perror("wl_event_loop_add_timer");
+      bench_compositor_stop(compositor);
+      return -1;
+    }
+    wl_event_source_timer_update((*compositor)->key_timer, options->key_ms);
+  }
+
+  int fds[2] = { -1, -1 };
+  error = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  if (error != 0) {
+    perror("socketpair");
+    bench_compositor_stop(compositor);
+    return -1;
+  }
+
+  /* the display owns the server end from here on */
+  struct wl_client *client = wl_client_create((*compositor)->display, fds[0]);
+  if (client == NULL) {
+    perror("wl_client_create");
+    close(fds[0]);
+    close(fds[1]);
+    bench_compositor_stop(compositor);
+    return -1;
+  }
+
+  if (options->buffers != NULL) {
+    (*compositor)->buffers = options->buffers;
+    (*compositor)->resource_created.notify = handle_resource_created;
+    wl_client_add_resource_created_listener(
+        client,
+        &(*compositor)->resource_created);
+  }
+
+  error = pthread_create(
+      &(*compositor)->thread,
+      NULL,
+      run_compositor,
+      *compositor);
+  if (error != 0) {
+    errno = error;
+    perror("pthread_create");
+    close(fds[1]);
+    bench_compositor_stop(compositor);
+    return -1;
+  }
+
+  (*compositor)->running = true;
+  *client_fd = fds[1];
+  return 0;
+}
+
+void
+bench_compositor_stop(struct bench_compositor **compositor)
+{
+  if (*compositor == NULL) {
+    return;
+  }
+
+  if ((*compositor)->running) {
+    wl_display_terminate((*compositor)->display);
+    pthread_join((*compositor)->thread, NULL);
+  }
+
+  /* the event loop doesn't take its sources down with it */
+  if ((*compositor)->hotplug_timer != NULL) {
+    wl_event_source_remove((*compositor)->hotplug_timer);
+  }
+  if ((*compositor)->key_timer != NULL) {
+    wl_event_source_remove((*compositor)->key_timer);
+  }
+
+  /* their surfaces take their timers out of the event loop */
+  if ((*compositor)->display != NULL) {
+    wl_display_destroy_clients((*compositor)->display);
+    wl_display_destroy((*compositor)->display);
+  }
+
+  if ((*compositor)->keymap_fd >= 0) {
+    close((*compositor)->keymap_fd);
+  }
+  free(*compositor);
+  *compositor = NULL;
+}
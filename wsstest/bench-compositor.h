@@ -0,0 +1,70 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef WSSTEST_BENCH_COMPOSITOR_H
+#define WSSTEST_BENCH_COMPOSITOR_H
+
+/*
+ * a stand-in compositor on its own thread, for benchmarking the wayland side
+ * of the frame path without a real one. it implements just enough of
+ * wl_compositor and wl_shm for a surface to attach, damage and commit, copies
+ * the damaged part of each buffer like a compositor uploading it would, and
+ * answers frame callbacks right away, or paced to the refresh of an output.
+ * it can also pretend to have a number of outputs, of a few different modes,
+ * like a headless compositor would, and keep plugging one more in and out.
+ * with a seat, it types on a timer.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct bench_compositor;
+
+/* what the client committed to one of its surfaces */
+struct bench_frames
+{
+  /* commits that attached a buffer */
+  uint64_t frames;
+  /* from each frame callback to the commit after it, room for latencies_max */
+  uint64_t *latencies_ns;
+  size_t latencies_num;
+  size_t latencies_max;
+};
+
+struct bench_compositor_options
+{
+  /* there from the start */
+  size_t outputs_num;
+  /* every this often, another output is plugged in, or the one that was is
+   * unplugged again. 0 for never */
+  uint32_t hotplug_ms;
+  /* every this often, a key of the seat's keyboard is pressed and released.
+   * 0 for no seat */
+  uint32_t key_ms;
+  /* the frame callbacks of the nth surface the client makes are answered at
+   * the refresh rate of the nth output, like a vblank would */
+  bool paced;
+  /* if not NULL, counted for the first frames_num surfaces the client makes.
+   * only read them once the compositor is stopped */
+  struct bench_frames *frames;
+  size_t frames_num;
+  /* if not NULL, how many wl_buffers the client has, kept up to date
+   * atomically as it makes and destroys them */
+  size_t *buffers;
+};
+
+/* the client end of the connection is returned in client_fd */
+int
+bench_compositor_start(
+    struct bench_compositor **compositor,
+    const struct bench_compositor_options *options,
+    int *client_fd);
+
+void
+bench_compositor_stop(struct bench_compositor **compositor);
+
+#endif /* WSSTEST_BENCH_COMPOSITOR_H */
@@ -0,0 +1,71 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <security/pam_ext.h>
+#include <security/pam_modules.h>
+
+/*
+ * a PAM module for the auth benchmark, as slow as a network login or a
+ * faillock delay. it asks for the password like pam_unix does, then takes
+ * sleep_ms=N milliseconds to accept whatever it was.
+ */
+
+static const char sleep_arg[] = "sleep_ms=";
+
+PAM_EXTERN int
+pam_sm_authenticate(pam_handle_t *pam, int flags, int argc, const char **argv)
+{
+  (void)flags;
+
+  long sleep_ms = 0;
+  for (int i = 0; i < argc; i++) {
+    if (strncmp(argv[i], sleep_arg, sizeof sleep_arg - 1) == 0) {
+      sleep_ms = strtol(&argv[i][sizeof sleep_arg - 1], NULL, 10);
+    }
+  }
+
+  const char *password = NULL;
+  int error = pam_get_authtok(pam, PAM_AUTHTOK, &password, NULL);
+  if (error != PAM_SUCCESS) {
+    return error;
+  }
+
+  struct timespec sleep = {
+    .tv_sec = sleep_ms / 1000,
+    .tv_nsec = sleep_ms % 1000 * 1000000,
+  };
+  while (nanosleep(&sleep, &sleep) != 0 && errno == EINTR) {
+  }
+
+  return PAM_SUCCESS;
+}
+
+PAM_EXTERN int
+pam_sm_setcred(pam_handle_t *pam, int flags, int argc, const char **argv)
+{
+  (void)pam;
+  (void)flags;
+  (void)argc;
+  (void)argv;
+  return PAM_SUCCESS;
+}
+
+PAM_EXTERN int
+pam_sm_acct_mgmt(pam_handle_t *pam, int flags, int argc, const char **argv)
+{
+  (void)pam;
+  (void)flags;
+  (void)argc;
+  (void)argv;
+  return PAM_SUCCESS;
+}
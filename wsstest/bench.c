@@ -0,0 +1,2103 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define _POSIX_C_SOURCE 200809L
+/* memfd_create */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <wayland-client-core.h>
+#include <wayland-client-protocol.h>
+
+#include "auth.h"
+#include "bench-alloc.h"
+#include "bench-compositor.h"
+#include "capture.h"
+#include "copy.h"
+#include "frame.h"
+#include "input.h"
+#include "render.h"
+#include "replay.h"
+
+#define COUNTOF(array) (sizeof(array) / sizeof(array)[0])
+
+/*
+ * microbenchmarks for the pieces of the per-frame path. each result is one
+ * line of JSON on stdout, so runs can be kept and compared across machines
+ * and commits:
+ *
+ *   {"bench":"copy","variant":"3840x2160","iterations":2712,
+ *    "ns_per_op":92171.3,"bytes_per_op":33177600}
+ *
+ * the first line describes the machine. each benchmark repeats its operation
+ * for at least bench_ms. pass benchmark names as arguments to run only those.
+ */
+
+enum {
+  bench_ms = 250,
+  /* what capture_frame uses for a 1024 pixel wide frame */
+  bench_strip_height = 256,
+};
+
+/*
+ * the outputs benchmark runs the render thread of a capture per output like
+ * wsstest does without WSSTEST_MIRROR, for 1, 2, 4 and so on up to
+ * bench_outputs_max outputs (or just WSSTEST_BENCH_OUTPUTS of them). each for
+ * bench_outputs_ms, replaying bench_outputs_frames frames of the output's mode
+ * with bench_outputs_band rows changing every frame. the stand-in compositor
+ * answers frame callbacks at the refresh rate of each output. the heap
+ * allocations after the first bench_outputs_warmup_ms are counted, and it
+ * fails if any of them is the size of frame data.
+ */
+static const char bench_outputs_env[] = "WSSTEST_BENCH_OUTPUTS";
+enum {
+  bench_outputs_max = 16,
+  bench_outputs_ms = 2000,
+  bench_outputs_warmup_ms = 500,
+  bench_outputs_frames = 8,
+  bench_outputs_band = 192,
+  bench_latencies_max = 1 << 16,
+};
+
+/*
+ * the keys benchmark types on the keyboard of the stand-in compositor every
+ * bench_keys_period_ms, into the input thread of wsstest, while the render
+ * threads of bench_keys_outputs outputs (or WSSTEST_BENCH_OUTPUTS) keep the
+ * cores busy.
+ */
+enum {
+  bench_keys_outputs = 4,
+  bench_keys_period_ms = 8,
+};
+
+/*
+ * the auth benchmark authenticates over and over while the render threads of
+ * bench_keys_outputs outputs run, through a PAM service of its own that has
+ * bench-pam.c take bench_auth_sleep_ms every time. it fails if that held up
+ * any frame by half as long.
+ */
+static const char bench_pam_service[] = "wsstest-bench";
+enum {
+  bench_auth_sleep_ms = 500,
+};
+#ifndef BENCH_PAM_MODULE
+/* where CMake built bench-pam.c */
+#define BENCH_PAM_MODULE "pam_wsstest_bench.so"
+#endif
+
+/*
+ * the hotplug benchmark has the stand-in compositor plug an output in and out
+ * every bench_hotplug_period_ms for bench_hotplug_ms, while the outputs get a
+ * capture with buffers and lose them again through wsstest's own capture.c.
+ * each unplug has to give all of it back, and once bench_hotplug_settled
+ * outputs came and went, resident memory shouldn't grow anymore.
+ */
+enum {
+  bench_hotplug_ms = 4000,
+  bench_hotplug_period_ms = 5,
+  bench_hotplug_settled = 16,
+};
+
+/* escapes the buffers, so the compiler can't decide the work is unused */
+static void *volatile sink = NULL;
+
+static const struct
+{
+  int32_t width;
+  int32_t height;
+} copy_sizes[] = {
+  { 1024, 768 },
+  { 1920, 1080 },
+  { 2560, 1440 },
+  { 3840, 2160 },
+  { 7680, 4320 },
+};
+
+struct present
+{
+  struct wl_compositor *compositor;
+  struct wl_shm *shm;
+  bool done;
+};
+
+/* an output of the stand-in compositor, and the capture shown on it */
+struct wall_output
+{
+  struct wl_output *output;
+  int32_t width;
+  int32_t height;
+  /* in mHz */
+  int32_t refresh;
+
+  struct capture *capture;
+  struct output shown;
+  /* the buffers of the capture */
+  int shm_fd;
+  uint8_t *mem;
+  size_t mem_len;
+  /* the replay of the capture is another output's */
+  bool replay_shared;
+};
+
+struct hotplug;
+
+/* a plugged in output, shown the way wsstest would, and its capture */
+struct hotplug_output
+{
+  struct hotplug *hotplug;
+  /* name is 0 if the slot is free */
+  struct output shown;
+};
+
+struct hotplug
+{
+  struct wl_display *wl;
+  struct wl_compositor *compositor;
+  struct wl_shm *shm;
+  /* the buffers of the captures come out of it like in wsstest */
+  struct shm_arena shm_arena;
+  struct wl_shm_pool *pool;
+  struct hotplug_output outputs[4];
+  /* the wl_buffers of the client, counted by the stand-in compositor */
+  size_t buffers;
+  uint64_t plugged;
+  uint64_t unplugged;
+  /* an output was unplugged since the buffers were last counted */
+  bool uncounted;
+  uint64_t counted;
+  /* something wasn't given back */
+  bool leaked;
+  long settled_kb;
+  long max_kb;
+};
+
+struct wall
+{
+  struct wl_compositor *compositor;
+  struct wl_shm *shm;
+  uint32_t seat_name;
+  uint64_t auth_attempts;
+  uint64_t auth_succeeded;
+  size_t outputs_num;
+  struct wall_output outputs[bench_outputs_max];
+  /* of their surfaces, counted by the stand-in compositor */
+  struct bench_frames frames[bench_outputs_max];
+};
+
+static uint64_t
+now_ns(void)
+{
+  struct timespec now = { 0 };
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static bool
+elapsed_ms(uint64_t start, uint64_t ms, uint64_t *elapsed_ns)
+{
+  *elapsed_ns = now_ns() - start;
+  return *elapsed_ns >= ms * 1000000;
+}
+
+static bool
+elapsed(uint64_t start, uint64_t *elapsed_ns)
+{
+  return elapsed_ms(start, bench_ms, elapsed_ns);
+}
+
+static void
+report(
+    const char *bench,
+    const char *variant,
+    uint64_t iterations,
+    uint64_t elapsed_ns,
+    size_t bytes_per_op)
+{
+  printf(
+      "{\"bench\":\"%s\",\"variant\":\"%s\",\"iterations\":%" PRIu64
+      ",\"ns_per_op\":%.1f,\"bytes_per_op\":%zu}\n",
+      bench,
+      variant,
+      iterations,
+      (double)elapsed_ns / iterations,
+      bytes_per_op);
+}
+
+static void
+report_machine(void)
+{
+  char cpu[128] = "unknown";
+  char line[256] = { 0 };
+
+  FILE *cpuinfo = fopen("/proc/cpuinfo", "r");
+  while (cpuinfo != NULL && fgets(line, sizeof line, cpuinfo) != NULL) {
+    char *value = strchr(line, ':');
+    if (strncmp(line, "model name", 10) != 0 || value == NULL) {
+      continue;
+    }
+    /* keep it valid json, the model name is free text */
+    size_t len = 0;
+    for (value += 2; *value != '\0' && *value != '\n'; value++) {
+      if (*value != '"' && *value != '\\' && len < sizeof cpu - 1) {
+        cpu[len++] = *value;
+      }
+    }
+    cpu[len] = '\0';
+    break;
+  }
+  if (cpuinfo != NULL) {
+    fclose(cpuinfo);
+  }
+
+  printf(
+      "{\"bench\":\"machine\",\"cpu\":\"%s\",\"cpus\":%ld,"
+      "\"frame\":\"%dx%d\"}\n",
+      cpu,
+      sysconf(_SC_NPROCESSORS_ONLN),
+      width,
+      height);
+}
+
+/* the copy from a GetImage reply into a wl_shm buffer, at output sizes */
+static int
+bench_copy(void)
+{
+  for (size_t i = 0; i < COUNTOF(copy_sizes); i++) {
+    size_t len = sizeof(uint32_t) * copy_sizes[i].width * copy_sizes[i].height;
+    uint8_t *src = malloc(len);
+    uint8_t *dst = malloc(len);
+    if (src == NULL || dst == NULL) {
+      perror("malloc");
+      free(src);
+      free(dst);
+      return -1;
+    }
+    /* fault the pages in before timing */
+    memset(src, 0x55, len);
+    memset(dst, 0, len);
+    sink = dst;
+
+    uint64_t iterations = 0;
+    uint64_t elapsed_ns = 0;
+    uint64_t start = now_ns();
+    do {
+      memcpy(dst, src, len);
+      iterations++;
+    } while (!elapsed(start, &elapsed_ns));
+
+    char variant[32] = { 0 };
+    snprintf(
+        variant,
+        sizeof variant,
+        "%" PRId32 "x%" PRId32,
+        copy_sizes[i].width,
+        copy_sizes[i].height);
+    report("copy", variant, iterations, elapsed_ns, len);
+
+    free(src);
+    free(dst);
+  }
+
+  return 0;
+}
+
+/*
+ * the same copies through the copy engine, started once the way wsstest does.
+ * each size is copied as one frame, so it picks what an output that big gets
+ */
+static int
+bench_copy_engine(void)
+{
+  copy_start();
+  for (size_t i = 0; i < COUNTOF(copy_sizes); i++) {
+    size_t row_len = sizeof(uint32_t) * copy_sizes[i].width;
+    size_t len = row_len * copy_sizes[i].height;
+    uint8_t *src = malloc(len);
+    uint8_t *dst = malloc(len);
+    if (src == NULL || dst == NULL) {
+      perror("malloc");
+      free(src);
+      free(dst);
+      copy_stop();
+      return -1;
+    }
+    memset(src, 0x55, len);
+    memset(dst, 0, len);
+    sink = dst;
+
+    struct copy_span span = {
+      .dest = dst,
+      .src = src,
+      .stride = row_len,
+      .len = row_len,
+      .rows = copy_sizes[i].height,
+    };
+
+    uint64_t iterations = 0;
+    uint64_t elapsed_ns = 0;
+    uint64_t start = now_ns();
+    do {
+      copy_spans(&span, 1, len);
+      iterations++;
+    } while (!elapsed(start, &elapsed_ns));
+
+    char variant[32] = { 0 };
+    snprintf(
+        variant,
+        sizeof variant,
+        "%" PRId32 "x%" PRId32,
+        copy_sizes[i].width,
+        copy_sizes[i].height);
+    report("copy_engine", variant, iterations, elapsed_ns, len);
+
+    free(src);
+    free(dst);
+  }
+  copy_stop();
+
+  return 0;
+}
+
+static void
+damage_frame(
+    const struct layout *layout,
+    const uint8_t *src,
+    struct buffer *buffer,
+    struct frame *frame)
+{
+  *frame = (struct frame){
+    .damage_bounds = { INT32_MAX, INT32_MAX, 0, 0 },
+  };
+
+  int32_t capture_height = layout->capture_height;
+  size_t capture_stride = layout->capture_stride;
+  for (int32_t y = 0; y < capture_height; y += bench_strip_height) {
+    int32_t rows = capture_height - y < bench_strip_height
+                       ? capture_height - y
+                       : bench_strip_height;
+    update_strip(
+        layout,
+        &src[capture_stride * y],
+        y,
+        rows,
+        buffer,
+        buffer,
+        frame);
+  }
+
+  finish_damage(frame);
+  buffer->damage.valid = true;
+}
+
+/* hashing, comparing and copying a captured frame, strip by strip */
+static int
+bench_damage(void)
+{
+  static const char *const variants[] = { "unchanged", "one_tile", "all" };
+
+  uint8_t *src = malloc(buffer_size);
+  uint8_t *dst = malloc(buffer_size);
+  if (src == NULL || dst == NULL) {
+    perror("malloc");
+    free(src);
+    free(dst);
+    return -1;
+  }
+  for (size_t i = 0; i < buffer_size; i++) {
+    src[i] = i * 7;
+  }
+  sink = dst;
+
+  struct layout layout = { 0 };
+  layout_init(&layout, 0, pixel_xrgb8888, width, height);
+
+  for (size_t i = 0; i < COUNTOF(variants); i++) {
+    struct buffer buffer = { .mem = dst };
+    struct frame frame = { 0 };
+    damage_frame(&layout, src, &buffer, &frame);
+
+    uint64_t iterations = 0;
+    uint64_t elapsed_ns = 0;
+    uint64_t start = now_ns();
+    do {
+      if (i == 1) {
+        src[0] ^= 1;
+      }
+      if (i == 2) {
+        buffer.damage.valid = false;
+      }
+      damage_frame(&layout, src, &buffer, &frame);
+      iterations++;
+    } while (!elapsed(start, &elapsed_ns));
+
+    report("damage", variants[i], iterations, elapsed_ns, buffer_size);
+  }
+
+  free(src);
+  free(dst);
+  return 0;
+}
+
+/* a whole frame copied into a buffer laid out for a rotated output */
+static int
+bench_rotate(void)
+{
+  static const struct
+  {
+    const char *name;
+    /* enum wl_output_transform */
+    int32_t transform;
+  } variants[] = {
+    { "normal", 0 },
+    { "90", 1 },
+    { "180", 2 },
+    { "270", 3 },
+  };
+
+  uint8_t *src = malloc(buffer_size);
+  uint8_t *dst = malloc(buffer_size);
+  if (src == NULL || dst == NULL) {
+    perror("malloc");
+    free(src);
+    free(dst);
+    return -1;
+  }
+  for (size_t i = 0; i < buffer_size; i++) {
+    src[i] = i * 7;
+  }
+  sink = dst;
+
+  for (size_t i = 0; i < COUNTOF(variants); i++) {
+    struct layout layout = { 0 };
+    layout_init(
+        &layout,
+        variants[i].transform,
+        pixel_xrgb8888,
+        width,
+        height);
+    struct buffer buffer = { .mem = dst };
+    struct frame frame = { 0 };
+
+    uint64_t iterations = 0;
+    uint64_t elapsed_ns = 0;
+    uint64_t start = now_ns();
+    do {
+      buffer.damage.valid = false;
+      damage_frame(&layout, src, &buffer, &frame);
+      iterations++;
+    } while (!elapsed(start, &elapsed_ns));
+
+    report("rotate", variants[i].name, iterations, elapsed_ns, buffer_size);
+  }
+
+  free(src);
+  free(dst);
+  return 0;
+}
+
+/* a whole frame copied into buffers of each format, see WSSTEST_RGB565 */
+static int
+bench_convert(void)
+{
+  static const struct
+  {
+    const char *name;
+    /* enum pixel_format */
+    int32_t format;
+    /* enum wl_output_transform */
+    int32_t transform;
+  } variants[] = {
+    { "xrgb8888", pixel_xrgb8888, 0 },
+    { "rgb565", pixel_rgb565, 0 },
+    { "rgb565_dithered", pixel_rgb565_dithered, 0 },
+    { "rgb565_90", pixel_rgb565, 1 },
+  };
+
+  uint8_t *src = malloc(buffer_size);
+  uint8_t *dst = malloc(buffer_size);
+  if (src == NULL || dst == NULL) {
+    perror("malloc");
+    free(src);
+    free(dst);
+    return -1;
+  }
+  for (size_t i = 0; i < buffer_size; i++) {
+    src[i] = i * 7;
+  }
+  sink = dst;
+
+  for (size_t i = 0; i < COUNTOF(variants); i++) {
+    struct layout layout = { 0 };
+    layout_init(
+        &layout,
+        variants[i].transform,
+        variants[i].format,
+        width,
+        height);
+    struct buffer buffer = { .mem = dst };
+    struct frame frame = { 0 };
+
+    uint64_t iterations = 0;
+    uint64_t elapsed_ns = 0;
+    uint64_t start = now_ns();
+    do {
+      buffer.damage.valid = false;
+      damage_frame(&layout, src, &buffer, &frame);
+      iterations++;
+    } while (!elapsed(start, &elapsed_ns));
+
+    report("convert", variants[i].name, iterations, elapsed_ns, buffer_size);
+  }
+
+  free(src);
+  free(dst);
+  return 0;
+}
+
+static void
+handle_registry_global(
+    void *data,
+    struct wl_registry *registry,
+    uint32_t name,
+    const char *interface,
+    uint32_t version)
+{
+  struct present *present = data;
+  (void)version;
+
+  if (strcmp(interface, wl_compositor_interface.name) == 0) {
+    present->compositor =
+        wl_registry_bind(registry, name, &wl_compositor_interface, 4);
+  }
+  if (strcmp(interface, wl_shm_interface.name) == 0) {
+    present->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+  }
+}
+
+static void
+handle_registry_global_remove(
+    void *data,
+    struct wl_registry *registry,
+    uint32_t name)
+{
+  (void)data;
+  (void)registry;
+  (void)name;
+}
+
+static const struct wl_registry_listener registry_listener = {
+  .global = handle_registry_global,
+  .global_remove = handle_registry_global_remove,
+};
+
+static void
+handle_frame_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+  struct present *present = data;
+  (void)callback;
+  (void)time;
+
+  present->done = true;
+}
+
+static const struct wl_callback_listener frame_listener = {
+  .done = handle_frame_done,
+};
+
+/*
+ * attach, damage, frame and commit, then wait for the frame callback, the way
+ * present_frame drives a surface. the stand-in compositor answers right away,
+ * so this is the cost of the protocol and the upload, not of a display.
+ */
+static int
+bench_present(void)
+{
+  static const char *const variants[] = { "full", "one_tile" };
+  int error = 0;
+
+  struct bench_compositor *server = NULL;
+  int fd = -1;
+  error = bench_compositor_start(
+      &server,
+      &(struct bench_compositor_options){ 0 },
+      &fd);
+  if (error != 0) {
+    return -1;
+  }
+
+  struct wl_display *wl = wl_display_connect_to_fd(fd);
+  if (wl == NULL) {
+    perror("wl_display_connect_to_fd");
+    close(fd);
+    bench_compositor_stop(&server);
+    return -1;
+  }
+
+  struct present present = { 0 };
+  struct wl_registry *registry = wl_display_get_registry(wl);
+  wl_registry_add_listener(registry, &registry_listener, &present);
+  wl_display_roundtrip(wl);
+  if (present.compositor == NULL || present.shm == NULL) {
+    fputs("bench_present: Missing globals\n", stderr);
+    wl_display_disconnect(wl);
+    bench_compositor_stop(&server);
+    return -1;
+  }
+
+  int shm_fd = memfd_create("wsstest-bench", MFD_CLOEXEC);
+  if (shm_fd < 0 || ftruncate(shm_fd, buffer_size * 2) != 0) {
+    perror("memfd_create");
+    wl_display_disconnect(wl);
+    bench_compositor_stop(&server);
+    return -1;
+  }
+
+  struct wl_shm_pool *pool =
+      wl_shm_create_pool(present.shm, shm_fd, buffer_size * 2);
+  struct wl_buffer *buffers[2] = { NULL };
+  for (size_t i = 0; i < COUNTOF(buffers); i++) {
+    buffers[i] = wl_shm_pool_create_buffer(
+        pool,
+        buffer_size * i,
+        width,
+        height,
+        stride,
+        WL_SHM_FORMAT_XRGB8888);
+  }
+  struct wl_surface *surface =
+      wl_compositor_create_surface(present.compositor);
+
+  for (size_t i = 0; i < COUNTOF(variants) && error == 0; i++) {
+    int32_t damage_width = i == 0 ? width : tile_size;
+    int32_t damage_height = i == 0 ? height : tile_size;
+
+    uint64_t iterations = 0;
+    uint64_t elapsed_ns = 0;
+    uint64_t start = now_ns();
+    do {
+      wl_surface_attach(surface, buffers[iterations % 2], 0, 0);
+      wl_surface_damage_buffer(surface, 0, 0, damage_width, damage_height);
+      struct wl_callback *callback = wl_surface_frame(surface);
+      wl_callback_add_listener(callback, &frame_listener, &present);
+      wl_surface_commit(surface);
+
+      present.done = false;
+      while (!present.done && error >= 0) {
+        error = wl_display_dispatch(wl);
+      }
+      wl_callback_destroy(callback);
+      if (error < 0) {
+        perror("wl_display_dispatch");
+        break;
+      }
+      error = 0;
+      iterations++;
+    } while (!elapsed(start, &elapsed_ns));
+
+    if (error == 0) {
+      report(
+          "present",
+          variants[i],
+          iterations,
+          elapsed_ns,
+          sizeof(uint32_t) * damage_width * damage_height);
+    }
+  }
+
+  wl_surface_destroy(surface);
+  for (size_t i = 0; i < COUNTOF(buffers); i++) {
+    wl_buffer_destroy(buffers[i]);
+  }
+  wl_shm_pool_destroy(pool);
+  close(shm_fd);
+  wl_shm_destroy(present.shm);
+  wl_compositor_destroy(present.compositor);
+  wl_registry_destroy(registry);
+  wl_display_disconnect(wl);
+  bench_compositor_stop(&server);
+
+  return error == 0 ? 0 : -1;
+}
+
+static void
+handle_wall_global(
+    void *data,
+    struct wl_registry *registry,
+    uint32_t name,
+    const char *interface,
+    uint32_t version)
+{
+  struct wall *wall = data;
+  (void)version;
+
+  if (strcmp(interface, wl_compositor_interface.name) == 0) {
+    wall->compositor =
+        wl_registry_bind(registry, name, &wl_compositor_interface, 4);
+  }
+  if (strcmp(interface, wl_shm_interface.name) == 0) {
+    wall->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+  }
+  if (strcmp(interface, wl_output_interface.name) == 0 &&
+      wall->outputs_num < COUNTOF(wall->outputs)) {
+    struct wall_output *output = &wall->outputs[wall->outputs_num++];
+    output->output = wl_registry_bind(registry, name, &wl_output_interface, 2);
+  }
+  if (strcmp(interface, wl_seat_interface.name) == 0) {
+    wall->seat_name = name;
+  }
+}
+
+static const struct wl_registry_listener wall_registry_listener = {
+  .global = handle_wall_global,
+  .global_remove = handle_registry_global_remove,
+};
+
+static void
+handle_output_geometry(
+    void *data,
+    struct wl_output *wl_output,
+    int32_t x,
+    int32_t y,
+    int32_t physical_width,
+    int32_t physical_height,
+    int32_t subpixel,
+    const char *make,
+    const char *model,
+    int32_t transform)
+{
+  (void)data;
+  (void)wl_output;
+  (void)x;
+  (void)y;
+  (void)physical_width;
+  (void)physical_height;
+  (void)subpixel;
+  (void)make;
+  (void)model;
+  (void)transform;
+}
+
+static void
+handle_output_mode(
+    void *data,
+    struct wl_output *wl_output,
+    uint32_t flags,
+    int32_t width,
+    int32_t height,
+    int32_t refresh)
+{
+  struct wall_output *output = data;
+  (void)wl_output;
+
+  if ((flags & WL_OUTPUT_MODE_CURRENT) == 0) {
+    return;
+  }
+  output->width = width;
+  output->height = height;
+  output->refresh = refresh;
+}
+
+static void
+handle_output_done(void *data, struct wl_output *wl_output)
+{
+  (void)data;
+  (void)wl_output;
+}
+
+static void
+handle_output_scale(void *data, struct wl_output *wl_output, int32_t factor)
+{
+  (void)data;
+  (void)wl_output;
+  (void)factor;
+}
+
+static const struct wl_output_listener output_listener = {
+  .geometry = handle_output_geometry,
+  .mode = handle_output_mode,
+  .done = handle_output_done,
+  .scale = handle_output_scale,
+};
+
+/*
+ * a loop of bench_outputs_frames frames with a band of bench_outputs_band
+ * rows moving down them, recorded like record_frame does from a hack
+ */
+static int
+record_band(struct capture *capture)
+{
+  int error = 0;
+  const struct layout *layout = &capture->layout;
+
+  uint8_t *src = malloc(layout->size);
+  struct buffer *recorded = calloc(1, sizeof *recorded);
+  uint8_t *mem = malloc(layout->size);
+  if (src == NULL || recorded == NULL || mem == NULL) {
+    perror("malloc");
+    free(src);
+    free(recorded);
+    free(mem);
+    return -1;
+  }
+  for (size_t i = 0; i < layout->size; i++) {
+    src[i] = i * 7;
+  }
+  recorded->mem = mem;
+
+  /* never long enough, it's as long as we make it */
+  capture->replay.duration_ns = UINT64_MAX;
+  for (int32_t n = 0; n < bench_outputs_frames && error >= 0; n++) {
+    int32_t band_y =
+        n * tile_size % (layout->capture_height - bench_outputs_band);
+    memset(
+        &src[layout->capture_stride * band_y],
+        n,
+        layout->capture_stride * bench_outputs_band);
+
+    struct frame frame = { 0 };
+    damage_frame(layout, src, recorded, &frame);
+    error = replay_record(&capture->replay, layout, recorded);
+  }
+  capture->replay.duration_ns = 0;
+  capture->replay.playing = true;
+
+  free(src);
+  free(recorded);
+  free(mem);
+  return error < 0 ? -1 : 0;
+}
+
+/* its buffers in a pool of their own, and the surface they're shown on */
+static int
+create_surface_buffers(
+    struct wall_output *output,
+    struct wl_compositor *compositor,
+    struct wl_shm *shm)
+{
+  struct capture *capture = output->capture;
+  const struct layout *layout = &capture->layout;
+
+  output->mem_len = layout->size * capture->buffers_num;
+  output->shm_fd = memfd_create("wsstest-bench", MFD_CLOEXEC);
+  if (output->shm_fd < 0 || ftruncate(output->shm_fd, output->mem_len) != 0) {
+    perror("memfd_create");
+    return -1;
+  }
+  output->mem = mmap(
+      NULL,
+      output->mem_len,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED,
+      output->shm_fd,
+      0);
+  if (output->mem == MAP_FAILED) {
+    perror("mmap");
+    output->mem = NULL;
+    return -1;
+  }
+
+  struct wl_shm_pool *pool =
+      wl_shm_create_pool(shm, output->shm_fd, output->mem_len);
+  for (size_t i = 0; i < capture->buffers_num; i++) {
+    struct buffer *buffer = &capture->buffers[i];
+    buffer->mem = &output->mem[layout->size * i];
+    /* the output is in the first slot of its capture */
+    buffer->buffers[0] = wl_shm_pool_create_buffer(
+        pool,
+        layout->size * i,
+        layout->width,
+        layout->height,
+        layout->stride,
+        WL_SHM_FORMAT_XRGB8888);
+    wl_buffer_add_listener(buffer->buffers[0], &buffer_listener, buffer);
+  }
+  wl_shm_pool_destroy(pool);
+
+  output->shown.surface = wl_compositor_create_surface(compositor);
+  return 0;
+}
+
+/*
+ * a capture of the output's mode shown on it, the way wsstest sets one up for
+ * a render thread. outputs of the same mode play the same recording.
+ */
+static int
+setup_output(
+    struct wall *wall,
+    size_t output_n,
+    const struct render_context *context)
+{
+  int error = 0;
+  struct wall_output *output = &wall->outputs[output_n];
+
+  if (output->width <= 0 || output->height <= bench_outputs_band ||
+      output->width > frame_size_max || output->height > frame_size_max) {
+    fputs("setup_output: No mode to size the capture to\n", stderr);
+    return -1;
+  }
+
+  output->capture = calloc(1, sizeof *output->capture);
+  if (output->capture == NULL) {
+    perror("calloc");
+    return -1;
+  }
+  struct capture *capture = output->capture;
+  output->shm_fd = -1;
+  capture->context = context;
+  capture->trace_track = 1 + output_n;
+  capture->stop_fd = -1;
+  capture->present_fd = -1;
+  capture->pidfd = -1;
+  capture->buffer_scale = 1;
+  capture->buffers_num = buffers_max;
+  layout_init(
+      &capture->layout,
+      0,
+      pixel_xrgb8888,
+      output->width,
+      output->height);
+
+  capture->queue = wl_display_create_queue(context->wl);
+  if (capture->queue == NULL) {
+    perror("wl_display_create_queue");
+    return -1;
+  }
+
+  /* releases and frame callbacks go to the render thread */
+  struct wl_compositor *compositor = wl_proxy_create_wrapper(wall->compositor);
+  struct wl_shm *shm = wl_proxy_create_wrapper(wall->shm);
+  if (compositor == NULL || shm == NULL) {
+    perror("wl_proxy_create_wrapper");
+    error = -1;
+  } else {
+    wl_proxy_set_queue((struct wl_proxy *)compositor, capture->queue);
+    wl_proxy_set_queue((struct wl_proxy *)shm, capture->queue);
+    error = create_surface_buffers(output, compositor, shm);
+  }
+  if (compositor != NULL) {
+    wl_proxy_wrapper_destroy(compositor);
+  }
+  if (shm != NULL) {
+    wl_proxy_wrapper_destroy(shm);
+  }
+  if (error != 0) {
+    return -1;
+  }
+
+  /* there's no xdg_wm_base to configure it, it's as fullscreen as it gets */
+  output->shown.output = output->output;
+  output->shown.info = (struct output_info){
+    .width = output->width,
+    .height = output->height,
+    .refresh = output->refresh,
+    .scale = 1,
+    .done = true,
+    .updates = 1,
+  };
+  output->shown.trace_track = 1 + output_n;
+  output->shown.configured = true;
+  output->shown.capture = capture;
+  capture->outputs[0] = &output->shown;
+
+  for (size_t i = 0; i < output_n; i++) {
+    const struct wall_output *recorded = &wall->outputs[i];
+    if (recorded->width == output->width &&
+        recorded->height == output->height) {
+      capture->replay = recorded->capture->replay;
+      output->replay_shared = true;
+      return 0;
+    }
+  }
+  return record_band(capture);
+}
+
+/* its render thread has to be stopped */
+static void
+teardown_output(struct wall_output *output)
+{
+  struct capture *capture = output->capture;
+  if (capture == NULL) {
+    return;
+  }
+
+  if (output->shown.frame_callback != NULL) {
+    wl_callback_destroy(output->shown.frame_callback);
+  }
+  if (output->shown.surface != NULL) {
+    wl_surface_destroy(output->shown.surface);
+  }
+  for (size_t i = 0; i < COUNTOF(capture->buffers); i++) {
+    for (size_t j = 0; j < COUNTOF(capture->buffers[i].buffers); j++) {
+      if (capture->buffers[i].buffers[j] != NULL) {
+        wl_buffer_destroy(capture->buffers[i].buffers[j]);
+      }
+    }
+  }
+  if (output->mem != NULL) {
+    munmap(output->mem, output->mem_len);
+  }
+  if (output->shm_fd >= 0) {
+    close(output->shm_fd);
+  }
+  if (!output->replay_shared) {
+    replay_free(&capture->replay);
+  }
+  /* after everything that was on it */
+  if (capture->queue != NULL) {
+    wl_event_queue_destroy(capture->queue);
+  }
+
+  free(capture);
+  output->capture = NULL;
+}
+
+/* until bench_outputs_ms are up, unless a render thread failed before. the
+ * allocations so far are read into warm once bench_outputs_warmup_ms are */
+static int
+wait_wall(int stop_fd, uint64_t start_ns, struct bench_allocs *warm)
+{
+  struct pollfd stop_poll[1] = {
+    { .fd = stop_fd, .events = POLLIN },
+  };
+
+  bool warmed_up = false;
+  uint64_t elapsed_ns = 0;
+  while (!elapsed_ms(start_ns, bench_outputs_ms, &elapsed_ns)) {
+    int timeout_ms = bench_outputs_ms - elapsed_ns / 1000000;
+    if (!warmed_up && elapsed_ns / 1000000 >= bench_outputs_warmup_ms) {
+      bench_allocs_read(warm);
+      warmed_up = true;
+    } else if (!warmed_up) {
+      timeout_ms = bench_outputs_warmup_ms - elapsed_ns / 1000000;
+    }
+    int ready = poll(stop_poll, COUNTOF(stop_poll), timeout_ms);
+    if (ready < 0 && errno != EINTR) {
+      perror("poll");
+      return -1;
+    }
+    if (ready > 0) {
+      fputs("bench_wall: A render thread failed\n", stderr);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static int
+compare_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/* of a sorted array */
+static uint64_t
+percentile(const uint64_t *sorted, size_t num, int percent)
+{
+  if (num == 0) {
+    return 0;
+  }
+  return sorted[(num - 1) * percent / 100];
+}
+
+static long
+resident_kb(void)
+{
+  long pages = 0;
+  FILE *statm = fopen("/proc/self/statm", "r");
+  if (statm == NULL) {
+    return 0;
+  }
+  if (fscanf(statm, "%*s %ld", &pages) != 1) {
+    pages = 0;
+  }
+  fclose(statm);
+  return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static uint64_t
+cpu_ns(void)
+{
+  struct rusage usage = { 0 };
+  getrusage(RUSAGE_SELF, &usage);
+  return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+             1000000000 +
+         (uint64_t)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000;
+}
+
+/* of all outputs, sorted, NULL if out of memory */
+static uint64_t *
+sort_latencies(const struct wall *wall, size_t *num)
+{
+  size_t latencies_num = 0;
+  for (size_t i = 0; i < wall->outputs_num; i++) {
+    latencies_num += wall->frames[i].latencies_num;
+  }
+  uint64_t *latencies = malloc(sizeof *latencies * (latencies_num + 1));
+  if (latencies == NULL) {
+    perror("malloc");
+    return NULL;
+  }
+  *num = 0;
+  for (size_t i = 0; i < wall->outputs_num; i++) {
+    const struct bench_frames *frames = &wall->frames[i];
+    memcpy(
+        &latencies[*num],
+        frames->latencies_ns,
+        sizeof *latencies * frames->latencies_num);
+    *num += frames->latencies_num;
+  }
+  qsort(latencies, *num, sizeof *latencies, compare_u64);
+
+  return latencies;
+}
+
+/*
+ * one line per output count, with the frame rate of each output, the cpu time
+ * of the whole process (stand-in compositor included) per wall clock time,
+ * its resident memory at the end, percentiles of how long the frame
+ * callbacks of all outputs took to be answered with a commit, and the heap
+ * allocations once warmed up, per second and how many were frame-sized:
+ *
+ *   {"bench":"outputs","variant":"2","cpu_percent":18.2,"rss_kb":130512,
+ *    "latency_us":{"p50":850,"p90":1210,"p99":2300},
+ *    "allocs":{"per_s":1450.0,"large":0},
+ *    "outputs":[{"mode":"1920x1080@60","fps":60.0},...]}
+ */
+static int
+report_wall(
+    const struct wall *wall,
+    uint64_t elapsed_ns,
+    uint64_t used_ns,
+    long rss_kb,
+    const struct bench_allocs *steady)
+{
+  size_t num = 0;
+  uint64_t *latencies = sort_latencies(wall, &num);
+  if (latencies == NULL) {
+    return -1;
+  }
+
+  uint64_t steady_ns = elapsed_ns - (uint64_t)bench_outputs_warmup_ms * 1000000;
+  printf(
+      "{\"bench\":\"outputs\",\"variant\":\"%zu\",\"cpu_percent\":%.1f,"
+      "\"rss_kb\":%ld,\"latency_us\":{\"p50\":%" PRIu64 ",\"p90\":%" PRIu64
+      ",\"p99\":%" PRIu64 "},\"allocs\":{\"per_s\":%.1f,\"large\":%" PRIu64
+      "},\"outputs\":[",
+      wall->outputs_num,
+      100.0 * used_ns / elapsed_ns,
+      rss_kb,
+      percentile(latencies, num, 50) / 1000,
+      percentile(latencies, num, 90) / 1000,
+      percentile(latencies, num, 99) / 1000,
+      1e9 * steady->allocs / steady_ns,
+      steady->large);
+  for (size_t i = 0; i < wall->outputs_num; i++) {
+    const struct wall_output *output = &wall->outputs[i];
+    printf(
+        "%s{\"mode\":\"%" PRId32 "x%" PRId32 "@%" PRId32 "\",\"fps\":%.1f}",
+        i == 0 ? "" : ",",
+        output->width,
+        output->height,
+        output->refresh / 1000,
+        1e9 * wall->frames[i].frames / elapsed_ns);
+  }
+  printf("]}\n");
+
+  free(latencies);
+  if (steady->large != 0) {
+    fprintf(
+        stderr,
+        "report_wall: %" PRIu64 " frame-sized allocations once warmed up\n",
+        steady->large);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * how long the keys took to echo:
+ *
+ *   {"bench":"keys","variant":"4","keys":250,
+ *    "echo_us":{"p50":60,"p90":95,"p99":180,"max":420}}
+ */
+static void
+report_keys(const struct wall *wall)
+{
+  struct input_latency latency = { 0 };
+  input_latency(&latency);
+
+  printf(
+      "{\"bench\":\"keys\",\"variant\":\"%zu\",\"keys\":%" PRIu64
+      ",\"echo_us\":{\"p50\":%" PRIu64 ",\"p90\":%" PRIu64 ",\"p99\":%" PRIu64
+      ",\"max\":%" PRIu64 "}}\n",
+      wall->outputs_num,
+      latency.keys,
+      latency.p50_ns / 1000,
+      latency.p90_ns / 1000,
+      latency.p99_ns / 1000,
+      latency.max_ns / 1000);
+}
+
+/*
+ * how long PAM took, and how long frames took meanwhile. -1 if any of them
+ * waited for it:
+ *
+ *   {"bench":"auth","variant":"4","attempts":4,"sleep_ms":500,
+ *    "latency_us":{"p50":850,"p99":2300,"max":4100}}
+ */
+static int
+report_auth(const struct wall *wall)
+{
+  size_t num = 0;
+  uint64_t *latencies = sort_latencies(wall, &num);
+  if (latencies == NULL) {
+    return -1;
+  }
+  uint64_t max_ns = num == 0 ? 0 : latencies[num - 1];
+
+  printf(
+      "{\"bench\":\"auth\",\"variant\":\"%zu\",\"attempts\":%" PRIu64
+      ",\"sleep_ms\":%d,\"latency_us\":{\"p50\":%" PRIu64 ",\"p99\":%" PRIu64
+      ",\"max\":%" PRIu64 "}}\n",
+      wall->outputs_num,
+      wall->auth_attempts,
+      bench_auth_sleep_ms,
+      percentile(latencies, num, 50) / 1000,
+      percentile(latencies, num, 99) / 1000,
+      max_ns / 1000);
+  free(latencies);
+
+  if (wall->auth_attempts == 0 ||
+      wall->auth_succeeded != wall->auth_attempts) {
+    fprintf(
+        stderr,
+        "bench_auth: %" PRIu64 " of %" PRIu64 " attempts succeeded\n",
+        wall->auth_succeeded,
+        wall->auth_attempts);
+    return -1;
+  }
+  if (max_ns >= (uint64_t)bench_auth_sleep_ms * 1000000 / 2) {
+    fprintf(
+        stderr,
+        "bench_auth: A frame took %" PRIu64 " ms while PAM slept\n",
+        max_ns / 1000000);
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * tries the password again as soon as the last attempt is done, for as long
+ * as the render threads run
+ */
+static int
+run_auth(struct wall *wall, uint64_t start_ns)
+{
+  int error = 0;
+  static const char password[] = "bench";
+  struct pollfd auth_poll[1] = {
+    { .fd = auth_fd(), .events = POLLIN },
+  };
+
+  bool busy = false;
+  uint64_t elapsed_ns = 0;
+  while (!elapsed_ms(start_ns, bench_outputs_ms, &elapsed_ns)) {
+    if (!busy) {
+      error = auth_submit(password, sizeof password - 1);
+      if (error != 0) {
+        fputs("auth_submit: Still busy\n", stderr);
+        return -1;
+      }
+      busy = true;
+      wall->auth_attempts++;
+    }
+
+    error = poll(auth_poll, COUNTOF(auth_poll), bench_ms);
+    if (error < 0 && errno != EINTR) {
+      perror("poll");
+      return -1;
+    }
+    int result = auth_result();
+    if (result >= 0) {
+      busy = false;
+      wall->auth_succeeded += result;
+    }
+  }
+
+  return 0;
+}
+
+static void
+free_frames(struct wall *wall)
+{
+  for (size_t i = 0; i < COUNTOF(wall->frames); i++) {
+    free(wall->frames[i].latencies_ns);
+  }
+}
+
+/*
+ * the stand-in compositor with a capture shown on each of its outputs, each
+ * presented by a render thread of wsstest. with key_ms, the input thread reads
+ * what it types. with authenticating, auth_start was called and the attempts
+ * go on while the render threads run.
+ */
+static int
+bench_wall(const struct bench_compositor_options *options, bool authenticating)
+{
+  int error = 0;
+  size_t outputs_num = options->outputs_num;
+
+  struct wall wall = { 0 };
+  for (size_t i = 0; i < outputs_num; i++) {
+    wall.frames[i].latencies_ns =
+        malloc(sizeof *wall.frames[i].latencies_ns * bench_latencies_max);
+    wall.frames[i].latencies_max = bench_latencies_max;
+    if (wall.frames[i].latencies_ns == NULL) {
+      perror("malloc");
+      error = -1;
+    }
+  }
+
+  /* the surfaces are made in the order of the outputs, and paced by them */
+  struct bench_compositor_options paced = *options;
+  paced.paced = true;
+  paced.frames = wall.frames;
+  paced.frames_num = outputs_num;
+
+  struct bench_compositor *server = NULL;
+  int fd = -1;
+  if (error == 0) {
+    error = bench_compositor_start(&server, &paced, &fd);
+  }
+  if (error != 0) {
+    free_frames(&wall);
+    return -1;
+  }
+
+  struct wl_display *wl = wl_display_connect_to_fd(fd);
+  if (wl == NULL) {
+    perror("wl_display_connect_to_fd");
+    close(fd);
+    bench_compositor_stop(&server);
+    free_frames(&wall);
+    return -1;
+  }
+
+  struct wl_registry *registry = wl_display_get_registry(wl);
+  wl_registry_add_listener(registry, &wall_registry_listener, &wall);
+  wl_display_roundtrip(wl);
+  for (size_t i = 0; i < wall.outputs_num; i++) {
+    wl_output_add_listener(
+        wall.outputs[i].output,
+        &output_listener,
+        &wall.outputs[i]);
+  }
+  /* the modes */
+  wl_display_roundtrip(wl);
+  if (wall.compositor == NULL || wall.shm == NULL ||
+      wall.outputs_num != outputs_num ||
+      (options->key_ms != 0 && wall.seat_name == 0)) {
+    fputs("bench_wall: Missing globals\n", stderr);
+    error = -1;
+  }
+
+  /* written by the input thread if it fails */
+  int input_fail_fd = -1;
+  if (error == 0 && options->key_ms != 0) {
+    input_fail_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (input_fail_fd < 0) {
+      perror("eventfd");
+      error = -1;
+    }
+  }
+
+  /* there's no x server, the captures only replay */
+  struct render_context context = {
+    .wl = wl,
+    .stop_fd = -1,
+  };
+  if (error == 0) {
+    context.stop_fd = eventfd(0, EFD_CLOEXEC);
+    if (context.stop_fd < 0) {
+      perror("eventfd");
+      error = -1;
+    }
+  }
+  for (size_t i = 0; i < wall.outputs_num && error == 0; i++) {
+    error = setup_output(&wall, i, &context);
+  }
+
+  /* the buffers are set up and the recordings made by now */
+  if (error == 0 && input_fail_fd >= 0) {
+    error = input_start(wl, registry, wall.seat_name, input_fail_fd);
+  }
+  uint64_t start_cpu_ns = cpu_ns();
+  uint64_t start_ns = now_ns();
+  for (size_t i = 0; i < wall.outputs_num && error == 0; i++) {
+    error = start_render_thread(wall.outputs[i].capture);
+  }
+
+  if (error == 0 && authenticating) {
+    error = run_auth(&wall, start_ns);
+  }
+  struct bench_allocs warm = { 0 };
+  if (error == 0) {
+    error = wait_wall(context.stop_fd, start_ns, &warm);
+  }
+
+  for (size_t i = 0; i < wall.outputs_num; i++) {
+    if (wall.outputs[i].capture != NULL) {
+      stop_render_thread(wall.outputs[i].capture);
+    }
+  }
+  uint64_t elapsed_ns = now_ns() - start_ns;
+  uint64_t used_ns = cpu_ns() - start_cpu_ns;
+  long rss_kb = resident_kb();
+  struct bench_allocs steady = { 0 };
+  bench_allocs_read(&steady);
+  steady.allocs -= warm.allocs;
+  steady.large -= warm.large;
+  input_stop();
+
+  uint64_t input_failed = 0;
+  if (input_fail_fd >= 0 &&
+      read(input_fail_fd, &input_failed, sizeof input_failed) > 0) {
+    fputs("bench_wall: The input thread failed\n", stderr);
+    error = -1;
+  }
+  if (input_fail_fd >= 0) {
+    close(input_fail_fd);
+  }
+  if (context.stop_fd >= 0) {
+    close(context.stop_fd);
+  }
+
+  for (size_t i = 0; i < wall.outputs_num; i++) {
+    teardown_output(&wall.outputs[i]);
+    wl_output_destroy(wall.outputs[i].output);
+  }
+  if (wall.shm != NULL) {
+    wl_shm_destroy(wall.shm);
+  }
+  if (wall.compositor != NULL) {
+    wl_compositor_destroy(wall.compositor);
+  }
+  wl_registry_destroy(registry);
+  wl_display_disconnect(wl);
+  /* what it counted is all there is from here on */
+  bench_compositor_stop(&server);
+
+  if (error == 0 && authenticating) {
+    error = report_auth(&wall);
+  } else if (error == 0 && options->key_ms != 0) {
+    report_keys(&wall);
+  } else if (error == 0) {
+    error = report_wall(&wall, elapsed_ns, used_ns, rss_kb, &steady);
+  }
+
+  free_frames(&wall);
+  return error;
+}
+
+/* from bench_outputs_env, left alone if it isn't set */
+static int
+env_outputs(size_t *outputs_num)
+{
+  const char *outputs_env = getenv(bench_outputs_env);
+  if (outputs_env == NULL) {
+    return 0;
+  }
+
+  char *end = NULL;
+  long num = strtol(outputs_env, &end, 10);
+  if (end == outputs_env || *end != '\0' || num < 1 ||
+      num > bench_outputs_max) {
+    fprintf(
+        stderr,
+        "%s: Expected 1 to %d outputs\n",
+        bench_outputs_env,
+        bench_outputs_max);
+    return -1;
+  }
+  *outputs_num = num;
+  return 0;
+}
+
+/*
+ * how the render threads scale with the number of outputs, each with frames
+ * the size of its output's mode
+ */
+static int
+bench_outputs(void)
+{
+  int error = 0;
+
+  size_t outputs_num = 0;
+  error = env_outputs(&outputs_num);
+  if (error != 0) {
+    return -1;
+  }
+  if (outputs_num != 0) {
+    return bench_wall(
+        &(struct bench_compositor_options){ .outputs_num = outputs_num },
+        false);
+  }
+
+  for (outputs_num = 1; outputs_num <= bench_outputs_max; outputs_num *= 2) {
+    error = bench_wall(
+        &(struct bench_compositor_options){ .outputs_num = outputs_num },
+        false);
+    if (error != 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* the echo latency of the unlock prompt while every output is animating */
+static int
+bench_keys(void)
+{
+  size_t outputs_num = bench_keys_outputs;
+  if (env_outputs(&outputs_num) < 0) {
+    return -1;
+  }
+
+  return bench_wall(
+      &(struct bench_compositor_options){
+          .outputs_num = outputs_num,
+          .key_ms = bench_keys_period_ms,
+      },
+      false);
+}
+
+/*
+ * that the frames go on while PAM takes its time. the service only exists in
+ * a directory made for it, pointed to with the variables auth.c reads.
+ */
+static int
+bench_auth(void)
+{
+  int error = 0;
+
+  size_t outputs_num = bench_keys_outputs;
+  if (env_outputs(&outputs_num) < 0) {
+    return -1;
+  }
+
+  char confdir[] = "/tmp/wsstest-bench-XXXXXX";
+  if (mkdtemp(confdir) == NULL) {
+    perror("mkdtemp");
+    return -1;
+  }
+  char service_path[sizeof confdir + sizeof bench_pam_service] = { 0 };
+  snprintf(
+      service_path,
+      sizeof service_path,
+      "%s/%s",
+      confdir,
+      bench_pam_service);
+
+  FILE *service = fopen(service_path, "w");
+  if (service == NULL) {
+    perror("fopen");
+    rmdir(confdir);
+    return -1;
+  }
+  fprintf(
+      service,
+      "auth required %s sleep_ms=%d\n"
+      "account required %s\n",
+      BENCH_PAM_MODULE,
+      bench_auth_sleep_ms,
+      BENCH_PAM_MODULE);
+  error = fclose(service);
+  if (error != 0) {
+    perror("fclose");
+  }
+
+  /* nothing else runs yet, setenv is safe */
+  if (error == 0) {
+    error = setenv("WSSTEST_PAM_SERVICE", bench_pam_service, 1);
+  }
+  if (error == 0) {
+    error = setenv("WSSTEST_PAM_CONFDIR", confdir, 1);
+  }
+  if (error != 0) {
+    perror("setenv");
+  }
+
+  if (error == 0) {
+    error = auth_start();
+  }
+  if (error == 0) {
+    error = bench_wall(
+        &(struct bench_compositor_options){ .outputs_num = outputs_num },
+        true);
+    auth_stop();
+  }
+
+  unsetenv("WSSTEST_PAM_SERVICE");
+  unsetenv("WSSTEST_PAM_CONFDIR");
+  unlink(service_path);
+  rmdir(confdir);
+  return error == 0 ? 0 : -1;
+}
+
+static void
+handle_hotplug_output_mode(
+    void *data,
+    struct wl_output *wl_output,
+    uint32_t flags,
+    int32_t width,
+    int32_t height,
+    int32_t refresh)
+{
+  struct hotplug_output *output = data;
+  (void)wl_output;
+
+  if ((flags & WL_OUTPUT_MODE_CURRENT) == 0) {
+    return;
+  }
+  output->shown.info.width = width;
+  output->shown.info.height = height;
+  output->shown.info.refresh = refresh;
+}
+
+/* of the shared memory, what's handed out to buffers */
+static size_t
+shm_used(const struct shm_arena *shm_arena)
+{
+  size_t used = shm_arena->ranges.len;
+  for (size_t i = 0; i < shm_arena->ranges.free_num; i++) {
+    used -= shm_arena->ranges.free[i].len;
+  }
+  return used;
+}
+
+/* the wl_buffers the client holds */
+static size_t
+hotplug_buffers(const struct hotplug *hotplug)
+{
+  size_t buffers = 0;
+  for (size_t i = 0; i < COUNTOF(hotplug->outputs); i++) {
+    const struct capture *capture = hotplug->outputs[i].shown.capture;
+    if (capture == NULL) {
+      continue;
+    }
+    for (size_t j = 0; j < COUNTOF(capture->buffers); j++) {
+      for (size_t k = 0; k < COUNTOF(capture->buffers[j].buffers); k++) {
+        buffers += capture->buffers[j].buffers[k] != NULL;
+      }
+    }
+  }
+  return buffers;
+}
+
+/* a capture for the output with buffers of its size, the way wsstest makes
+ * them, and the first of them shown on a surface */
+static void
+handle_hotplug_output_done(void *data, struct wl_output *wl_output)
+{
+  int error = 0;
+  struct hotplug_output *output = data;
+  struct hotplug *hotplug = output->hotplug;
+  (void)wl_output;
+
+  if (output->shown.capture != NULL || output->shown.info.width <= 0 ||
+      output->shown.info.height <= 0 || hotplug->pool == NULL ||
+      hotplug->compositor == NULL) {
+    return;
+  }
+  output->shown.info.scale = 1;
+  output->shown.info.done = true;
+  output->shown.info.updates++;
+
+  struct capture *capture = calloc(1, sizeof *capture);
+  if (capture == NULL) {
+    perror("calloc");
+    return;
+  }
+  capture->stop_fd = -1;
+  capture->present_fd = -1;
+  capture->pidfd = -1;
+  capture->buffer_scale = 1;
+  layout_init(
+      &capture->layout,
+      0,
+      pixel_xrgb8888,
+      output->shown.info.width,
+      output->shown.info.height);
+  capture->frame_len = frame_len(&hotplug->shm_arena, &capture->layout);
+  capture->buffers_num =
+      reserve_frames(&hotplug->shm_arena, capture->frame_len);
+  if (capture->buffers_num == 0) {
+    fputs("handle_hotplug_output_done: Out of frame memory\n", stderr);
+    free(capture);
+    return;
+  }
+
+  /* from here on remove_output gives it all back */
+  output->shown.capture = capture;
+  capture->outputs[0] = &output->shown;
+  capture->queue = wl_display_create_queue(hotplug->wl);
+  if (capture->queue == NULL) {
+    perror("wl_display_create_queue");
+    return;
+  }
+  error = create_buffers(hotplug->pool, &hotplug->shm_arena, capture);
+  if (error != 0) {
+    return;
+  }
+
+  output->shown.surface = wl_compositor_create_surface(hotplug->compositor);
+  if (output->shown.surface == NULL) {
+    perror("wl_compositor_create_surface");
+    return;
+  }
+  wl_surface_attach(
+      output->shown.surface,
+      capture->buffers[0].buffers[0],
+      0,
+      0);
+  wl_surface_damage_buffer(output->shown.surface, 0, 0, INT32_MAX, INT32_MAX);
+  wl_surface_commit(output->shown.surface);
+  hotplug->plugged++;
+}
+
+static const struct wl_output_listener hotplug_output_listener = {
+  .geometry = handle_output_geometry,
+  .mode = handle_hotplug_output_mode,
+  .done = handle_hotplug_output_done,
+  .scale = handle_output_scale,
+};
+
+static void
+handle_hotplug_global(
+    void *data,
+    struct wl_registry *registry,
+    uint32_t name,
+    const char *interface,
+    uint32_t version)
+{
+  struct hotplug *hotplug = data;
+  (void)version;
+
+  if (strcmp(interface, wl_compositor_interface.name) == 0) {
+    hotplug->compositor =
+        wl_registry_bind(registry, name, &wl_compositor_interface, 4);
+  }
+  if (strcmp(interface, wl_shm_interface.name) == 0) {
+    hotplug->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+  }
+  if (strcmp(interface, wl_output_interface.name) != 0) {
+    return;
+  }
+
+  for (size_t i = 0; i < COUNTOF(hotplug->outputs); i++) {
+    struct hotplug_output *output = &hotplug->outputs[i];
+    if (output->shown.name != 0) {
+      continue;
+    }
+    *output = (struct hotplug_output){ .hotplug = hotplug };
+    output->shown.name = name;
+    snprintf(
+        output->shown.info.name,
+        sizeof output->shown.info.name,
+        "hotplug %" PRIu32,
+        name);
+    output->shown.output =
+        wl_registry_bind(registry, name, &wl_output_interface, 2);
+    wl_output_add_listener(
+        output->shown.output,
+        &hotplug_output_listener,
+        output);
+    return;
+  }
+  fprintf(stderr, "bench_hotplug: No slot for output %" PRIu32 "\n", name);
+}
+
+/*
+ * remove_output gives back what the output had, the same as in wsstest. with
+ * no other output plugged in, nothing of the shared memory or the budget
+ * should be in use after.
+ */
+static void
+handle_hotplug_global_remove(
+    void *data,
+    struct wl_registry *registry,
+    uint32_t name)
+{
+  struct hotplug *hotplug = data;
+  (void)registry;
+
+  for (size_t i = 0; i < COUNTOF(hotplug->outputs); i++) {
+    struct hotplug_output *output = &hotplug->outputs[i];
+    if (output->shown.name != name) {
+      continue;
+    }
+
+    struct capture *capture = output->shown.capture;
+    remove_output(NULL, &hotplug->shm_arena, &output->shown);
+    free(capture);
+    *output = (struct hotplug_output){ 0 };
+
+    bool plugged_in = false;
+    for (size_t j = 0; j < COUNTOF(hotplug->outputs); j++) {
+      plugged_in = plugged_in || hotplug->outputs[j].shown.name != 0;
+    }
+    size_t used = shm_used(&hotplug->shm_arena);
+    if (!plugged_in && (used != 0 || hotplug->shm_arena.frames_len != 0)) {
+      fprintf(
+          stderr,
+          "bench_hotplug: %zu bytes of shared memory and %zu of frame memory"
+          " still in use\n",
+          used,
+          hotplug->shm_arena.frames_len);
+      hotplug->leaked = true;
+    }
+
+    hotplug->unplugged++;
+    hotplug->uncounted = true;
+    long kb = resident_kb();
+    if (hotplug->unplugged == bench_hotplug_settled) {
+      hotplug->settled_kb = kb;
+    }
+    if (kb > hotplug->max_kb) {
+      hotplug->max_kb = kb;
+    }
+  }
+}
+
+static const struct wl_registry_listener hotplug_registry_listener = {
+  .global = handle_hotplug_global,
+  .global_remove = handle_hotplug_global_remove,
+};
+
+/*
+ * once the stand-in compositor caught up, it should have as many wl_buffers
+ * as the captures. not if an output was plugged in or out meanwhile, it may
+ * have seen some of those requests already
+ */
+static int
+count_hotplug_buffers(struct hotplug *hotplug)
+{
+  uint64_t plugged = hotplug->plugged;
+  uint64_t unplugged = hotplug->unplugged;
+  if (wl_display_roundtrip(hotplug->wl) < 0) {
+    perror("wl_display_roundtrip");
+    return -1;
+  }
+  if (hotplug->plugged != plugged || hotplug->unplugged != unplugged) {
+    return 0;
+  }
+
+  size_t expected = hotplug_buffers(hotplug);
+  size_t buffers = __atomic_load_n(&hotplug->buffers, __ATOMIC_RELAXED);
+  hotplug->counted++;
+  if (buffers != expected) {
+    fprintf(
+        stderr,
+        "bench_hotplug: The compositor has %zu wl_buffers, not %zu\n",
+        buffers,
+        expected);
+    hotplug->leaked = true;
+  }
+  return 0;
+}
+
+/*
+ * resident memory after the first outputs came and went, at its most, and at
+ * the end, for as many outputs as were unplugged, and how many times the
+ * wl_buffers were counted. it fails if any of the shared memory, the budget
+ * or the wl_buffers of an output outlive it:
+ *
+ *   {"bench":"hotplug","variant":"5ms","cycles":398,"counted":395,
+ *    "rss_kb":{"settled":30512,"max":30620,"end":30540}}
+ */
+static int
+bench_hotplug(void)
+{
+  int error = 0;
+
+  struct hotplug hotplug = {
+    .shm_arena = {
+      .fd = -1,
+      .region = { .addr = MAP_FAILED },
+      .frames_budget = shm_len_max,
+    },
+  };
+  error = create_shm(&hotplug.shm_arena);
+  if (error != 0) {
+    cleanup_shm_arena(&hotplug.shm_arena);
+    return -1;
+  }
+
+  /* nothing is plugged in to begin with, so there's nothing to count on */
+  struct bench_compositor *server = NULL;
+  int fd = -1;
+  error = bench_compositor_start(
+      &server,
+      &(struct bench_compositor_options){
+          .hotplug_ms = bench_hotplug_period_ms,
+          .buffers = &hotplug.buffers,
+      },
+      &fd);
+  if (error != 0) {
+    cleanup_shm_arena(&hotplug.shm_arena);
+    return -1;
+  }
+
+  hotplug.wl = wl_display_connect_to_fd(fd);
+  if (hotplug.wl == NULL) {
+    perror("wl_display_connect_to_fd");
+    close(fd);
+    bench_compositor_stop(&server);
+    cleanup_shm_arena(&hotplug.shm_arena);
+    return -1;
+  }
+
+  struct wl_registry *registry = wl_display_get_registry(hotplug.wl);
+  wl_registry_add_listener(registry, &hotplug_registry_listener, &hotplug);
+  wl_display_roundtrip(hotplug.wl);
+  if (hotplug.compositor == NULL || hotplug.shm == NULL) {
+    fputs("bench_hotplug: Missing globals\n", stderr);
+    error = -1;
+  } else {
+    hotplug.pool = wl_shm_create_pool(
+        hotplug.shm,
+        hotplug.shm_arena.fd,
+        hotplug.shm_arena.len);
+    if (hotplug.pool == NULL) {
+      perror("wl_shm_create_pool");
+      error = -1;
+    }
+  }
+
+  uint64_t start = now_ns();
+  uint64_t elapsed_ns = 0;
+  while (error == 0 && !elapsed_ms(start, bench_hotplug_ms, &elapsed_ns)) {
+    if (wl_display_dispatch(hotplug.wl) < 0) {
+      perror("wl_display_dispatch");
+      error = -1;
+    }
+    if (error == 0 && hotplug.uncounted) {
+      hotplug.uncounted = false;
+      error = count_hotplug_buffers(&hotplug);
+    }
+  }
+
+  if (error == 0 && hotplug.unplugged < bench_hotplug_settled) {
+    fprintf(
+        stderr,
+        "bench_hotplug: Only %" PRIu64 " outputs were unplugged\n",
+        hotplug.unplugged);
+    error = -1;
+  }
+  if (error == 0 && hotplug.counted == 0) {
+    fputs("bench_hotplug: The wl_buffers were never counted\n", stderr);
+    error = -1;
+  }
+  if (error == 0 && hotplug.leaked) {
+    error = -1;
+  }
+  if (error == 0) {
+    printf(
+        "{\"bench\":\"hotplug\",\"variant\":\"%dms\",\"cycles\":%" PRIu64
+        ",\"counted\":%" PRIu64
+        ",\"rss_kb\":{\"settled\":%ld,\"max\":%ld,\"end\":%ld}}\n",
+        bench_hotplug_period_ms,
+        hotplug.unplugged,
+        hotplug.counted,
+        hotplug.settled_kb,
+        hotplug.max_kb,
+        resident_kb());
+  }
+
+  for (size_t i = 0; i < COUNTOF(hotplug.outputs); i++) {
+    if (hotplug.outputs[i].shown.name != 0) {
+      handle_hotplug_global_remove(
+          &hotplug,
+          registry,
+          hotplug.outputs[i].shown.name);
+    }
+  }
+  if (hotplug.pool != NULL) {
+    wl_shm_pool_destroy(hotplug.pool);
+  }
+  if (hotplug.shm != NULL) {
+    wl_shm_destroy(hotplug.shm);
+  }
+  if (hotplug.compositor != NULL) {
+    wl_compositor_destroy(hotplug.compositor);
+  }
+  wl_registry_destroy(registry);
+  wl_display_disconnect(hotplug.wl);
+  bench_compositor_stop(&server);
+  cleanup_shm_arena(&hotplug.shm_arena);
+
+  return error;
+}
+
+static const struct
+{
+  const char *name;
+  int (*run)(void);
+} benches[] = {
+  { "copy", bench_copy },
+  { "copy_engine", bench_copy_engine },
+  { "damage", bench_damage },
+  { "rotate", bench_rotate },
+  { "convert", bench_convert },
+  { "present", bench_present },
+  { "outputs", bench_outputs },
+  { "hotplug", bench_hotplug },
+  { "keys", bench_keys },
+  { "auth", bench_auth },
+};
+
+int
+main(int argc, char **argv)
+{
+  int error = 0;
+
+  report_machine();
+
+  for (size_t i = 0; i < COUNTOF(benches); i++) {
+    bool selected = argc < 2;
+    for (int arg = 1; arg < argc; arg++) {
+      selected = selected || strcmp(argv[arg], benches[i].name) == 0;
+    }
+    if (!selected) {
+      continue;
+    }
+
+    error = benches[i].run();
+    if (error != 0) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,708 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define _POSIX_C_SOURCE 200809L
+/* memfd_create, file sealing and transparent huge pages */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <wayland-client-core.h>
+#include <wayland-client-protocol.h>
+#include <wayland-client-protocols/viewporter.h>
+#include <wayland-client-protocols/xdg-shell.h>
+#include <xcb/xcb.h>
+
+#include "arena.h"
+#include "capture.h"
+#include "frame.h"
+#include "render.h"
+#include "replay.h"
+#include "trace.h"
+
+#define CLEANUP(how) __attribute__((cleanup(cleanup_##how)))
+#define COUNTOF(array) (sizeof(array) / sizeof(array)[0])
+
+static const char memfd_name[] = "wsstest";
+static const char shm_name[] = "/wsstest_shm";
+
+static void
+cleanup_wl_surface(struct wl_surface **surface)
+{
+  if (*surface != NULL) {
+    wl_surface_destroy(*surface);
+    *surface = NULL;
+  }
+}
+
+static void
+cleanup_wl_callback(struct wl_callback **callback)
+{
+  if (*callback != NULL) {
+    wl_callback_destroy(*callback);
+    *callback = NULL;
+  }
+}
+
+static void
+cleanup_wl_shm_pool_wrapper(struct wl_shm_pool **shm_pool)
+{
+  if (*shm_pool != NULL) {
+    wl_proxy_wrapper_destroy(*shm_pool);
+    *shm_pool = NULL;
+  }
+}
+
+static void
+cleanup_wl_buffer(struct wl_buffer **buffer)
+{
+  if (*buffer != NULL) {
+    wl_buffer_destroy(*buffer);
+    *buffer = NULL;
+  }
+}
+
+/* the wl_buffers of every surface, not the memory */
+static void
+cleanup_wl_buffers(struct buffer *buffer)
+{
+  for (size_t i = 0; i < COUNTOF(buffer->buffers); i++) {
+    cleanup_wl_buffer(&buffer->buffers[i]);
+  }
+}
+
+static void
+cleanup_xdg_surface(struct xdg_surface **xdg_surface)
+{
+  if (*xdg_surface != NULL) {
+    xdg_surface_destroy(*xdg_surface);
+    *xdg_surface = NULL;
+  }
+}
+
+static void
+cleanup_xdg_toplevel(struct xdg_toplevel **toplevel)
+{
+  if (*toplevel != NULL) {
+    xdg_toplevel_destroy(*toplevel);
+    *toplevel = NULL;
+  }
+}
+
+static void
+cleanup_wp_viewport(struct wp_viewport **viewport)
+{
+  if (*viewport != NULL) {
+    wp_viewport_destroy(*viewport);
+    *viewport = NULL;
+  }
+}
+
+static void
+cleanup_fd(int *fd)
+{
+  int error = 0;
+
+  if (*fd >= 0) {
+    error = close(*fd);
+    if (error != 0) {
+      perror("close");
+    }
+    *fd = -1;
+  }
+}
+
+void
+cleanup_shm_region(struct shm_region *shm_region)
+{
+  int error = 0;
+
+  if (shm_region->addr != MAP_FAILED) {
+    error = munmap(shm_region->addr, shm_region->len);
+    if (error != 0) {
+      perror("munmap");
+    }
+    shm_region->addr = MAP_FAILED;
+    shm_region->len = 0;
+  }
+}
+
+void
+cleanup_shm_arena(struct shm_arena *shm_arena)
+{
+  /* the file mappings go with the reservation */
+  cleanup_shm_region(&shm_arena->region);
+  cleanup_fd(&shm_arena->fd);
+}
+
+/*
+ * grow the file to at least len, map the new part right after the rest and
+ * tell the compositor, if it has the pool already. nothing mapped before
+ * moves, buffers in it stay where they are. quiet is for attempts that are
+ * expected to fail, like hugetlb.
+ */
+static int
+grow_shm(
+    struct shm_arena *shm_arena,
+    size_t len,
+    bool quiet,
+    struct wl_shm_pool *shm_pool)
+{
+  int error = 0;
+
+  len = (len + shm_arena->granule - 1) / shm_arena->granule *
+        shm_arena->granule;
+  if (len <= shm_arena->len) {
+    return 0;
+  }
+  if (len > shm_arena->region.len) {
+    fputs("grow_shm: Out of reserved address space\n", stderr);
+    return -1;
+  }
+
+  error = ftruncate(shm_arena->fd, len);
+  if (error != 0) {
+    if (!quiet) {
+      perror("ftruncate");
+    }
+    return -1;
+  }
+
+  uint8_t *tail = (uint8_t *)shm_arena->region.addr + shm_arena->len;
+  void *addr = mmap(
+      /*   addr */ tail,
+      /* length */ len - shm_arena->len,
+      /*   prot */ PROT_READ | PROT_WRITE,
+      /*  flags */ MAP_SHARED | MAP_FIXED,
+      /*     fd */ shm_arena->fd,
+      /* offset */ shm_arena->len);
+  if (addr == MAP_FAILED) {
+    if (!quiet) {
+      perror("mmap");
+    }
+    return -1;
+  }
+
+  if (!shm_arena->hugetlb) {
+    error = madvise(tail, len - shm_arena->len, MADV_HUGEPAGE);
+    if (error != 0 && shm_arena->debug) {
+      perror("madvise");
+    }
+  }
+
+  if (shm_pool != NULL) {
+    wl_shm_pool_resize(shm_pool, len);
+  }
+  shm_arena->len = len;
+
+  return 0;
+}
+
+/* address space for the pool to grow into, mapped over bit by bit */
+static int
+reserve_shm(struct shm_region *shm_region)
+{
+  shm_region->addr = mmap(
+      /*   addr */ NULL,
+      /* length */ shm_len_max,
+      /*   prot */ PROT_NONE,
+      /*  flags */ MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+      /*     fd */ -1,
+      /* offset */ 0);
+  if (shm_region->addr == MAP_FAILED) {
+    perror("mmap");
+    return -1;
+  }
+  shm_region->len = shm_len_max;
+
+  return 0;
+}
+
+static int
+open_shm(struct shm_arena *shm_arena, bool hugetlb, bool quiet)
+{
+  int error = 0;
+
+  /* hugetlbfs reports its page size here, others the usual pages */
+  struct stat shm_stat = { 0 };
+  error = fstat(shm_arena->fd, &shm_stat);
+  if (error != 0) {
+    perror("fstat");
+    return -1;
+  }
+  shm_arena->granule = shm_stat.st_blksize > 0 ? shm_stat.st_blksize : 4096;
+  shm_arena->hugetlb = hugetlb;
+  shm_arena->len = 0;
+  shm_arena->ranges = (struct arena){ .len_max = shm_len_max };
+
+  return grow_shm(shm_arena, shm_len_initial, quiet, NULL);
+}
+
+int
+create_shm(struct shm_arena *shm_arena)
+{
+  int error = 0;
+
+  error = reserve_shm(&shm_arena->region);
+  if (error != 0) {
+    return -1;
+  }
+
+#ifdef MFD_CLOEXEC
+  static const unsigned int memfd_flags[] = {
+    MFD_CLOEXEC | MFD_ALLOW_SEALING | MFD_HUGETLB,
+    MFD_CLOEXEC | MFD_ALLOW_SEALING,
+  };
+  for (size_t i = 0; i < COUNTOF(memfd_flags); i++) {
+    bool hugetlb = (memfd_flags[i] & MFD_HUGETLB) != 0;
+
+    shm_arena->fd = memfd_create(memfd_name, memfd_flags[i]);
+    if (shm_arena->fd < 0 && errno == ENOSYS) {
+      break;
+    }
+    if (shm_arena->fd < 0) {
+      /* EINVAL if the kernel can't do hugetlb memfds */
+      if (!hugetlb || errno != EINVAL) {
+        perror("memfd_create");
+      }
+      continue;
+    }
+
+    /* without reserved huge pages this fails at ftruncate or mmap */
+    error = open_shm(shm_arena, hugetlb, hugetlb && !shm_arena->debug);
+    if (error != 0) {
+      cleanup_fd(&shm_arena->fd);
+      continue;
+    }
+
+    /* the compositor maps this too, don't let it get truncated under it. it
+     * may still grow */
+    error = fcntl(shm_arena->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL);
+    if (error != 0) {
+      perror("fcntl");
+    }
+
+    fprintf(stderr, "memfd_create: %s pages\n", hugetlb ? "hugetlb" : "normal");
+    return 0;
+  }
+#endif
+
+  shm_arena->fd =
+      shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+  if (shm_arena->fd < 0) {
+    perror("shm_open");
+    return -1;
+  }
+
+  error = shm_unlink(shm_name);
+  if (error != 0) {
+    perror("shm_unlink");
+    /*
+     * not fatal, but may cause problems with O_CREAT | O_EXCL in shm_open next
+     * time we run. NOTE: "fixing" it by removing O_EXCL opens up a race
+     * condition if multiple instances of this program are started
+     * simultaneously.
+     */
+  }
+
+  return open_shm(shm_arena, false, false);
+}
+
+int
+alloc_shm(
+    struct shm_arena *shm_arena,
+    struct wl_shm_pool *shm_pool,
+    size_t len,
+    size_t *offset)
+{
+  int error = 0;
+
+  len = (len + shm_arena->granule - 1) / shm_arena->granule *
+        shm_arena->granule;
+  error = arena_alloc(&shm_arena->ranges, len, offset);
+  if (error != 0) {
+    return -1;
+  }
+
+  error = grow_shm(shm_arena, shm_arena->ranges.len, false, shm_pool);
+  if (error != 0) {
+    arena_free(&shm_arena->ranges, *offset, len);
+    return -1;
+  }
+
+  return 0;
+}
+
+void
+free_shm(struct shm_arena *shm_arena, size_t offset, size_t len)
+{
+  int error = 0;
+
+  len = (len + shm_arena->granule - 1) / shm_arena->granule *
+        shm_arena->granule;
+  error = madvise(
+      (uint8_t *)shm_arena->region.addr + offset,
+      len,
+      MADV_REMOVE);
+  if (error != 0 && shm_arena->debug) {
+    perror("madvise");
+  }
+
+  arena_free(&shm_arena->ranges, offset, len);
+}
+
+size_t
+frame_len(const struct shm_arena *shm_arena, const struct layout *layout)
+{
+  size_t len = layout->capture_stride * layout->capture_height;
+  return (len + shm_arena->granule - 1) / shm_arena->granule *
+         shm_arena->granule;
+}
+
+/* usage against the budget, whenever it changes */
+static void
+report_frames(const struct shm_arena *shm_arena)
+{
+  fprintf(
+      stderr,
+      "report_frames: %zu of %zu KiB of frame memory in use\n",
+      shm_arena->frames_len >> 10,
+      shm_arena->frames_budget >> 10);
+  trace_instant("frame memory", 0, shm_arena->frames_len >> 10);
+}
+
+size_t
+reserve_frames(struct shm_arena *shm_arena, size_t len)
+{
+  size_t left = shm_arena->frames_budget - shm_arena->frames_len;
+  if (left / len < buffers_max) {
+    return 0;
+  }
+
+  shm_arena->frames_len += buffers_max * len;
+  report_frames(shm_arena);
+  return buffers_max;
+}
+
+void
+release_frames(struct shm_arena *shm_arena, size_t buffers_num, size_t len)
+{
+  if (buffers_num == 0) {
+    return;
+  }
+
+  shm_arena->frames_len -= buffers_num * len;
+  report_frames(shm_arena);
+}
+
+uint32_t
+shm_format(const struct layout *layout)
+{
+  if (layout->format == pixel_xrgb8888) {
+    return WL_SHM_FORMAT_XRGB8888;
+  }
+  return WL_SHM_FORMAT_RGB565;
+}
+
+/* TODO-BUFFER */
+int
+create_buffers(
+    struct wl_shm_pool *shm_pool,
+    struct shm_arena *shm_arena,
+    struct capture *capture)
+{
+  int error = 0;
+
+  /* releases go to the render thread, like in create_output_surface */
+  CLEANUP(wl_shm_pool_wrapper)
+  struct wl_shm_pool *shm_pool_wrapper = wl_proxy_create_wrapper(shm_pool);
+  if (shm_pool_wrapper == NULL) {
+    perror("wl_proxy_create_wrapper");
+    return -1;
+  }
+  wl_proxy_set_queue((struct wl_proxy *)shm_pool_wrapper, capture->queue);
+
+  /* the budget was reserved when the capture started */
+  for (size_t i = 0; i < capture->buffers_num; i++) {
+    struct buffer *buffer = &capture->buffers[i];
+
+    error = alloc_shm(
+        shm_arena,
+        shm_pool,
+        capture->layout.size,
+        &buffer->offset);
+    if (error != 0) {
+      return -1;
+    }
+    buffer->mem = (uint8_t *)shm_arena->region.addr + buffer->offset;
+
+    /* one for each surface, so each is released on its own */
+    for (size_t j = 0; j < COUNTOF(buffer->buffers); j++) {
+      buffer->buffers[j] = wl_shm_pool_create_buffer(
+          /* wl_shm_pool */ shm_pool_wrapper,
+          /*      offset */ buffer->offset,
+          /*       width */ capture->layout.width,
+          /*      height */ capture->layout.height,
+          /*      stride */ capture->layout.stride,
+          /*      format */ shm_format(&capture->layout));
+      if (buffer->buffers[j] == NULL) {
+        perror("wl_shm_pool_create_buffer");
+        return -1;
+      }
+
+      error = wl_buffer_add_listener(
+          buffer->buffers[j],
+          &buffer_listener,
+          buffer);
+      if (error != 0) {
+        fputs("wl_buffer_add_listener: listener already set\n", stderr);
+        return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+bool
+has_released_buffers(const struct buffer *buffers, size_t buffers_num)
+{
+  for (size_t i = 0; i < buffers_num; i++) {
+    const struct buffer *buffer = &buffers[i];
+    if (buffer->buffers[0] != NULL &&
+        __atomic_load_n(&buffer->busy, __ATOMIC_ACQUIRE) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void
+free_released_buffers(struct shm_arena *shm_arena, struct capture *capture)
+{
+  size_t held_num = 0;
+  for (size_t i = 0; i < COUNTOF(capture->buffers); i++) {
+    struct buffer *buffer = &capture->buffers[i];
+    if (buffer->buffers[0] == NULL) {
+      continue;
+    }
+    if (buffer->busy != 0) {
+      held_num++;
+      continue;
+    }
+    cleanup_wl_buffers(buffer);
+    free_shm(shm_arena, buffer->offset, capture->layout.size);
+    *buffer = (struct buffer){ 0 };
+  }
+
+  /* whether or not they were made yet */
+  release_frames(
+      shm_arena,
+      capture->buffers_num - held_num,
+      capture->frame_len);
+  capture->buffers_num = held_num;
+}
+
+void
+free_retired_buffers(struct shm_arena *shm_arena, struct capture *capture)
+{
+  for (size_t i = 0; i < COUNTOF(capture->retired); i++) {
+    struct buffer *buffer = &capture->retired[i];
+    if (buffer->buffers[0] == NULL || buffer->busy != 0) {
+      continue;
+    }
+    cleanup_wl_buffers(buffer);
+    free_shm(shm_arena, buffer->offset, capture->retired_size);
+    *buffer = (struct buffer){ 0 };
+    release_frames(shm_arena, 1, capture->retired_frame_len);
+    capture->retired_num--;
+  }
+}
+
+static void
+report_screensaver_exit(const siginfo_t *screensaver_info)
+{
+  psiginfo(screensaver_info, NULL);
+
+  if (screensaver_info->si_code == CLD_EXITED) {
+    fprintf(stderr, "Child exited normally: %d\n", screensaver_info->si_status);
+  } else {
+    psignal(screensaver_info->si_status, "Child exited by an uncaught signal");
+  }
+}
+
+void
+cleanup_screensaver(pid_t *screensaver_pid)
+{
+  int error = 0;
+
+  if (*screensaver_pid <= 0) {
+    return;
+  }
+
+  error = kill(*screensaver_pid, SIGTERM);
+  /* zombie processes count as existing, no need to exempt ESRCH */
+  if (error != 0) {
+    perror("kill");
+    return;
+  }
+
+  siginfo_t screensaver_info = { 0 };
+  error = waitid(P_PID, *screensaver_pid, &screensaver_info, WEXITED);
+  if (error != 0) {
+    perror("waitid");
+    return;
+  }
+
+  report_screensaver_exit(&screensaver_info);
+  *screensaver_pid = 0;
+}
+
+bool
+reap_screensaver(pid_t *screensaver_pid)
+{
+  int error = 0;
+
+  siginfo_t screensaver_info = { 0 };
+  error = waitid(
+      P_PID,
+      *screensaver_pid,
+      &screensaver_info,
+      WEXITED | WNOHANG);
+  if (error != 0) {
+    perror("waitid");
+    return false;
+  }
+  if (screensaver_info.si_pid == 0) {
+    return false;
+  }
+
+  report_screensaver_exit(&screensaver_info);
+  *screensaver_pid = 0;
+  return true;
+}
+
+void
+cleanup_output(struct output *output)
+{
+  if (output->output == NULL) {
+    return;
+  }
+
+  cleanup_wl_callback(&output->frame_callback);
+  cleanup_wp_viewport(&output->viewport);
+  cleanup_xdg_toplevel(&output->toplevel);
+  cleanup_xdg_surface(&output->xdg_surface);
+  cleanup_wl_surface(&output->surface);
+  /* tells the compositor we're done with it, since v3 */
+  if (wl_output_get_version(output->output) >= 3) {
+    wl_output_release(output->output);
+  } else {
+    wl_output_destroy(output->output);
+  }
+  *output = (struct output){ 0 };
+}
+
+void
+cleanup_capture(struct capture *capture)
+{
+  cleanup_screensaver(&capture->screensaver_pid);
+  cleanup_screensaver(&capture->next_pid);
+  for (size_t i = 0; i < COUNTOF(capture->buffers); i++) {
+    cleanup_wl_buffers(&capture->buffers[i]);
+    cleanup_wl_buffers(&capture->retired[i]);
+  }
+  cleanup_wl_buffers(&capture->blank);
+  unshare_strips(NULL, capture);
+  replay_free(&capture->replay);
+  /* after the outputs, whose surfaces are on it too */
+  if (capture->queue != NULL) {
+    wl_event_queue_destroy(capture->queue);
+    cleanup_fd(&capture->present_fd);
+    cleanup_fd(&capture->pidfd);
+  }
+  *capture = (struct capture){ 0 };
+}
+
+void
+remove_output(
+    xcb_connection_t *x11,
+    struct shm_arena *shm_arena,
+    struct output *output)
+{
+  struct capture *capture = output->capture;
+
+  fprintf(stderr, "remove_output: %s\n", output->info.name);
+
+  if (capture == NULL) {
+    cleanup_output(output);
+    return;
+  }
+
+  stop_render_thread(capture);
+
+  bool shown = false;
+  for (size_t i = 0; i < COUNTOF(capture->outputs); i++) {
+    if (capture->outputs[i] == output) {
+      capture->outputs[i] = NULL;
+    }
+    shown = shown || capture->outputs[i] != NULL;
+  }
+  cleanup_output(output);
+  if (shown) {
+    return;
+  }
+
+  /* stop the hack before taking its window away */
+  discard_strips(x11, capture);
+  unshare_strips(x11, capture);
+  xcb_window_t window = capture->window;
+  xcb_window_t next_window = capture->next_window;
+  struct buffer buffers[COUNTOF(capture->buffers)] = { 0 };
+  memcpy(buffers, capture->buffers, sizeof buffers);
+  struct buffer retired[COUNTOF(capture->retired)] = { 0 };
+  memcpy(retired, capture->retired, sizeof retired);
+  struct buffer blank = capture->blank;
+  size_t buffers_num = capture->buffers_num;
+  size_t buffer_len = capture->layout.size;
+  size_t buffer_frame_len = capture->frame_len;
+  size_t retired_num = capture->retired_num;
+  size_t retired_size = capture->retired_size;
+  size_t retired_frame_len = capture->retired_frame_len;
+  cleanup_capture(capture);
+  /* captures made after blanking have no window */
+  if (window != 0) {
+    xcb_destroy_window(x11, window);
+  }
+  if (next_window != 0) {
+    xcb_destroy_window(x11, next_window);
+  }
+
+  for (size_t i = 0; i < COUNTOF(buffers); i++) {
+    if (buffers[i].mem != NULL) {
+      free_shm(shm_arena, buffers[i].offset, buffer_len);
+    }
+    if (retired[i].mem != NULL) {
+      free_shm(shm_arena, retired[i].offset, retired_size);
+    }
+  }
+  /* whether or not they were made yet */
+  release_frames(shm_arena, buffers_num, buffer_frame_len);
+  release_frames(shm_arena, retired_num, retired_frame_len);
+  if (blank.mem != NULL) {
+    free_shm(shm_arena, blank.offset, sizeof(uint32_t));
+  }
+}
@@ -0,0 +1,159 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef WSSTEST_CAPTURE_H
+#define WSSTEST_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <wayland-client-core.h>
+#include <wayland-client-protocol.h>
+#include <xcb/xcb.h>
+
+#include "arena.h"
+#include "frame.h"
+#include "render.h"
+
+/*
+ * the shared memory the buffers of the captures live in, and the buffers
+ * themselves, from when a capture gets them until its output is unplugged.
+ * the event loop does all of this while the render thread of the capture is
+ * stopped.
+ */
+
+/*
+ * the buffers of all captures live in one pool shared with the compositor. it
+ * starts with room for one capture and grows as outputs show up, into address
+ * space reserved up front so the buffers never move.
+ */
+enum {
+  shm_len_initial = buffer_size * 2, /* TODO-BUFFER */
+  shm_len_max = 1 << 30,
+};
+
+struct shm_region
+{
+  void *addr;
+  size_t len;
+};
+
+struct shm_arena
+{
+  int fd;
+  /* all of the reserved address space, the file is mapped at the start */
+  struct shm_region region;
+  /* of the file and the pool */
+  size_t len;
+  /* pages of the file, which ranges are aligned to */
+  size_t granule;
+  bool hugetlb;
+  struct arena ranges;
+  /* of ranges, what the frame buffers take and may take, see budget_env */
+  size_t frames_len;
+  size_t frames_budget;
+  /* failed madvise hints are reported too */
+  bool debug;
+};
+
+/* unmaps it, if addr isn't MAP_FAILED */
+void
+cleanup_shm_region(struct shm_region *shm_region);
+
+/* fd is -1 and region.addr MAP_FAILED until then */
+int
+create_shm(struct shm_arena *shm_arena);
+
+void
+cleanup_shm_arena(struct shm_arena *shm_arena);
+
+/* a range of the pool for a buffer, growing it if none is free */
+int
+alloc_shm(
+    struct shm_arena *shm_arena,
+    struct wl_shm_pool *shm_pool,
+    size_t len,
+    size_t *offset);
+
+/* the memory goes back to the kernel until the range is used again */
+void
+free_shm(struct shm_arena *shm_arena, size_t offset, size_t len);
+
+/* of the pool, a frame buffer of layout takes at most this much. rgb565 ones
+ * take half, but which they'll be may not be known yet when the budget is
+ * reserved */
+size_t
+frame_len(const struct shm_arena *shm_arena, const struct layout *layout);
+
+/*
+ * the budget of a new capture, buffers_max buffers of len bytes. returns how
+ * many that is, 0 if there's no room for all of them.
+ */
+size_t
+reserve_frames(struct shm_arena *shm_arena, size_t len);
+
+void
+release_frames(struct shm_arena *shm_arena, size_t buffers_num, size_t len);
+
+/* enum wl_shm_format of the buffers */
+uint32_t
+shm_format(const struct layout *layout);
+
+/* buffers_num of them in the layout of the capture, on its queue. the budget
+ * was reserved when the capture started */
+int
+create_buffers(
+    struct wl_shm_pool *shm_pool,
+    struct shm_arena *shm_arena,
+    struct capture *capture);
+
+/* of buffers that are to be freed, one that was released since */
+bool
+has_released_buffers(const struct buffer *buffers, size_t buffers_num);
+
+/*
+ * the frame buffers of a blanked capture that no surface shows anymore, and
+ * the budget of those. the compositor may go on reading a buffer it hasn't
+ * released (like one it scans out directly), so those wait.
+ */
+void
+free_released_buffers(struct shm_arena *shm_arena, struct capture *capture);
+
+/* like free_released_buffers, for the buffers relayout_capture retired */
+void
+free_retired_buffers(struct shm_arena *shm_arena, struct capture *capture);
+
+/* the hack gets a SIGTERM, and is waited for */
+void
+cleanup_screensaver(pid_t *screensaver_pid);
+
+/* true if the hack exited, it's reaped then */
+bool
+reap_screensaver(pid_t *screensaver_pid);
+
+/* its surface and wl_output, not its capture */
+void
+cleanup_output(struct output *output);
+
+/* the hacks, buffers and queue of the capture, not the memory of the buffers.
+ * the outputs have to be gone. shared strips are only unmapped */
+void
+cleanup_capture(struct capture *capture);
+
+/*
+ * what's left of an output after it was unplugged. its capture goes too if
+ * nothing else shows it, hack and all, and its part of the shared memory is
+ * given back. x11 may be NULL for captures without a window.
+ */
+void
+remove_output(
+    xcb_connection_t *x11,
+    struct shm_arena *shm_arena,
+    struct output *output);
+
+#endif /* WSSTEST_CAPTURE_H */
@@ -0,0 +1,581 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define _POSIX_C_SOURCE 200809L
+/* _SC_LEVEL3_CACHE_SIZE */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "copy.h"
+
+enum {
+  /* the calling thread copies a stripe too */
+  copy_workers_max = 3,
+  /* frames this big are split across the workers. 4k and up */
+  copy_parallel_frame_min = 16 << 20,
+  /* below this, waking the workers costs more than it saves */
+  copy_parallel_batch_min = 256 << 10,
+  /* when the cache size is unknown */
+  copy_cache_size_default = 8 << 20,
+};
+
+enum copy_stores {
+  copy_stores_plain,
+  copy_stores_sse2,
+  copy_stores_avx,
+};
+
+static struct
+{
+  /* the fastest streaming stores of the cpu, and the size they pay off at */
+  enum copy_stores streaming;
+  size_t streaming_min;
+  size_t workers_num;
+  pthread_t workers[copy_workers_max];
+
+  pthread_mutex_t lock;
+  /* a new batch, or stopping */
+  pthread_cond_t start;
+  /* the last stripe of a batch is done */
+  pthread_cond_t done;
+  bool busy;
+  bool stopping;
+  uint64_t batch;
+  /* the batch before the workers were started */
+  uint64_t workers_batch;
+  enum copy_stores stores;
+  const struct copy_span *spans;
+  size_t spans_num;
+  int32_t rows;
+  size_t stripes_pending;
+} copy = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .start = PTHREAD_COND_INITIALIZER,
+  .done = PTHREAD_COND_INITIALIZER,
+};
+
+#if defined(__x86_64__)
+/* the dest of each row is aligned with plain copies of its head and tail */
+static void
+stream_row_sse2(uint8_t *dest, const uint8_t *src, size_t len)
+{
+  size_t head = (16 - (uintptr_t)dest % 16) % 16;
+  if (head > len) {
+    head = len;
+  }
+  memcpy(dest, src, head);
+
+  size_t i = head;
+  for (; i + 64 <= len; i += 64) {
+    __m128i a = _mm_loadu_si128((const __m128i *)&src[i]);
+    __m128i b = _mm_loadu_si128((const __m128i *)&src[i + 16]);
+    __m128i c = _mm_loadu_si128((const __m128i *)&src[i + 32]);
+    __m128i d = _mm_loadu_si128((const __m128i *)&src[i + 48]);
+    _mm_stream_si128((__m128i *)&dest[i], a);
+    _mm_stream_si128((__m128i *)&dest[i + 16], b);
+    _mm_stream_si128((__m128i *)&dest[i + 32], c);
+    _mm_stream_si128((__m128i *)&dest[i + 48], d);
+  }
+
+  memcpy(&dest[i], &src[i], len - i);
+}
+
+__attribute__((target("avx"))) static void
+stream_row_avx(uint8_t *dest, const uint8_t *src, size_t len)
+{
+  size_t head = (32 - (uintptr_t)dest % 32) % 32;
+  if (head > len) {
+    head = len;
+  }
+  memcpy(dest, src, head);
+
+  size_t i = head;
+  for (; i + 64 <= len; i += 64) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)&src[i]);
+    __m256i b = _mm256_loadu_si256((const __m256i *)&src[i + 32]);
+    _mm256_stream_si256((__m256i *)&dest[i], a);
+    _mm256_stream_si256((__m256i *)&dest[i + 32], b);
+  }
+
+  memcpy(&dest[i], &src[i], len - i);
+}
+#endif
+
+static void
+copy_row(enum copy_stores stores, uint8_t *dest, const uint8_t *src, size_t len)
+{
+  switch (stores) {
+#if defined(__x86_64__)
+  case copy_stores_avx:
+    stream_row_avx(dest, src, len);
+    break;
+  case copy_stores_sse2:
+    stream_row_sse2(dest, src, len);
+    break;
+#endif
+  default:
+    memcpy(dest, src, len);
+    break;
+  }
+}
+
+/* rows first to last of the batch, counting through the spans in order */
+static void
+copy_stripe(
+    enum copy_stores stores,
+    const struct copy_span *spans,
+    size_t spans_num,
+    int32_t first,
+    int32_t last)
+{
+  int32_t span_first = 0;
+
+  for (size_t i = 0; i < spans_num && span_first < last; i++) {
+    const struct copy_span *span = &spans[i];
+    int32_t span_last = span_first + span->rows;
+
+    int32_t row = first > span_first ? first - span_first : 0;
+    int32_t end = last < span_last ? last - span_first : span->rows;
+    for (; row < end; row++) {
+      copy_row(
+          stores,
+          &span->dest[span->stride * row],
+          &span->src[span->stride * row],
+          span->len);
+    }
+
+    span_first = span_last;
+  }
+
+#if defined(__x86_64__)
+  /* streaming stores aren't ordered with the others, publish them */
+  if (stores != copy_stores_plain) {
+    _mm_sfence();
+  }
+#endif
+}
+
+static void *
+copy_worker(void *data)
+{
+  size_t n = (size_t)(uintptr_t)data;
+  uint64_t batch = copy.workers_batch;
+
+  pthread_mutex_lock(&copy.lock);
+  while (true) {
+    while (copy.batch == batch && !copy.stopping) {
+      pthread_cond_wait(&copy.start, &copy.lock);
+    }
+    if (copy.stopping) {
+      break;
+    }
+    batch = copy.batch;
+
+    /* stripe 0 is the caller's */
+    size_t stripes = copy.workers_num + 1;
+    int32_t first = copy.rows * (n + 1) / stripes;
+    int32_t last = copy.rows * (n + 2) / stripes;
+    enum copy_stores stores = copy.stores;
+    const struct copy_span *spans = copy.spans;
+    size_t spans_num = copy.spans_num;
+    pthread_mutex_unlock(&copy.lock);
+
+    copy_stripe(stores, spans, spans_num, first, last);
+
+    pthread_mutex_lock(&copy.lock);
+    copy.stripes_pending--;
+    if (copy.stripes_pending == 0) {
+      pthread_cond_signal(&copy.done);
+    }
+  }
+  pthread_mutex_unlock(&copy.lock);
+
+  return NULL;
+}
+
+static size_t
+cache_size(void)
+{
+  long size = -1;
+#if defined(_SC_LEVEL3_CACHE_SIZE)
+  size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  if (size <= 0) {
+    size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+  }
+#endif
+  return size > 0 ? (size_t)size : copy_cache_size_default;
+}
+
+void
+copy_start(void)
+{
+  int error = 0;
+  const char *stores_name = "plain";
+
+  /* a frame that takes more than half the cache would only evict the rest */
+  copy.streaming_min = cache_size() / 2;
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx")) {
+    copy.streaming = copy_stores_avx;
+    stores_name = "avx streaming";
+  } else {
+    /* always there on x86_64 */
+    copy.streaming = copy_stores_sse2;
+    stores_name = "sse2 streaming";
+  }
+#endif
+
+  /* they sleep through the batches of smaller frames */
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t workers_num = 0;
+  if (cpus > 1) {
+    workers_num = (size_t)cpus - 1 < copy_workers_max ? (size_t)cpus - 1
+                                                      : copy_workers_max;
+  }
+
+  copy.workers_batch = copy.batch;
+  for (size_t i = 0; i < workers_num; i++) {
+    error = pthread_create(
+        &copy.workers[i],
+        NULL,
+        copy_worker,
+        (void *)(uintptr_t)i);
+    if (error != 0) {
+      /* make do with the ones we have */
+      errno = error;
+      perror("pthread_create");
+      break;
+    }
+    copy.workers_num = i + 1;
+  }
+
+  fprintf(
+      stderr,
+      "copy_start: %s stores from %zu KiB frames, %zu workers from %d MiB\n",
+      stores_name,
+      copy.streaming_min >> 10,
+      copy.workers_num,
+      copy_parallel_frame_min >> 20);
+}
+
+void
+copy_spans(
+    const struct copy_span *spans,
+    size_t spans_num,
+    size_t frame_size)
+{
+  int32_t rows = 0;
+  size_t bytes = 0;
+  for (size_t i = 0; i < spans_num; i++) {
+    rows += spans[i].rows;
+    bytes += spans[i].len * spans[i].rows;
+  }
+
+  enum copy_stores stores = copy_stores_plain;
+  if (copy.streaming_min > 0 && frame_size >= copy.streaming_min) {
+    stores = copy.streaming;
+  }
+
+  bool parallel = copy.workers_num > 0 &&
+                  frame_size >= copy_parallel_frame_min &&
+                  bytes >= copy_parallel_batch_min;
+  if (parallel) {
+    pthread_mutex_lock(&copy.lock);
+    parallel = !copy.busy;
+    if (parallel) {
+      copy.busy = true;
+      copy.stores = stores;
+      copy.spans = spans;
+      copy.spans_num = spans_num;
+      copy.rows = rows;
+      copy.stripes_pending = copy.workers_num;
+      copy.batch++;
+      pthread_cond_broadcast(&copy.start);
+    }
+    pthread_mutex_unlock(&copy.lock);
+  }
+
+  if (!parallel) {
+    copy_stripe(stores, spans, spans_num, 0, rows);
+    return;
+  }
+
+  copy_stripe(stores, spans, spans_num, 0, rows / (copy.workers_num + 1));
+
+  pthread_mutex_lock(&copy.lock);
+  while (copy.stripes_pending > 0) {
+    pthread_cond_wait(&copy.done, &copy.lock);
+  }
+  copy.busy = false;
+  pthread_mutex_unlock(&copy.lock);
+}
+
+void
+copy_stop(void)
+{
+  pthread_mutex_lock(&copy.lock);
+  copy.stopping = true;
+  pthread_cond_broadcast(&copy.start);
+  pthread_mutex_unlock(&copy.lock);
+
+  for (size_t i = 0; i < copy.workers_num; i++) {
+    pthread_join(copy.workers[i], NULL);
+  }
+
+  copy.workers_num = 0;
+  copy.stopping = false;
+  copy.streaming = copy_stores_plain;
+  copy.streaming_min = 0;
+}
+
+#if defined(__x86_64__)
+/*
+ * 4 rows of a quarter turn. each 4x4 block is transposed, so a column of src
+ * becomes a vector that's a run of 4 pixels in dest, backwards if step_y is
+ * negative.
+ */
+static void
+transpose_rows_sse2(
+    uint32_t *dest,
+    ptrdiff_t step_x,
+    ptrdiff_t step_y,
+    const uint8_t *src,
+    size_t src_stride,
+    int32_t width)
+{
+  int32_t x = 0;
+  for (; x + 4 <= width; x += 4) {
+    const uint8_t *block = &src[sizeof(uint32_t) * x];
+    __m128i r0 = _mm_loadu_si128((const __m128i *)block);
+    __m128i r1 = _mm_loadu_si128((const __m128i *)&block[src_stride]);
+    __m128i r2 = _mm_loadu_si128((const __m128i *)&block[src_stride * 2]);
+    __m128i r3 = _mm_loadu_si128((const __m128i *)&block[src_stride * 3]);
+
+    __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+    __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+    __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+    __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+    __m128i columns[4] = {
+      _mm_unpacklo_epi64(t0, t1),
+      _mm_unpackhi_epi64(t0, t1),
+      _mm_unpacklo_epi64(t2, t3),
+      _mm_unpackhi_epi64(t2, t3),
+    };
+
+    for (int i = 0; i < 4; i++) {
+      uint32_t *run = &dest[step_x * (x + i)];
+      if (step_y < 0) {
+        columns[i] = _mm_shuffle_epi32(columns[i], _MM_SHUFFLE(0, 1, 2, 3));
+        run -= 3;
+      }
+      _mm_storeu_si128((__m128i *)run, columns[i]);
+    }
+  }
+
+  for (; x < width; x++) {
+    for (int y = 0; y < 4; y++) {
+      memcpy(
+          &dest[step_x * x + step_y * y],
+          &src[src_stride * y + sizeof(uint32_t) * x],
+          sizeof(uint32_t));
+    }
+  }
+}
+
+/* a row mirrored, for half turns and flips */
+static void
+reverse_row_sse2(uint32_t *dest, const uint8_t *src, int32_t width)
+{
+  int32_t x = 0;
+  for (; x + 4 <= width; x += 4) {
+    __m128i pixels =
+        _mm_loadu_si128((const __m128i *)&src[sizeof(uint32_t) * x]);
+    pixels = _mm_shuffle_epi32(pixels, _MM_SHUFFLE(0, 1, 2, 3));
+    _mm_storeu_si128((__m128i *)&dest[-(x + 3)], pixels);
+  }
+
+  for (; x < width; x++) {
+    memcpy(&dest[-x], &src[sizeof(uint32_t) * x], sizeof(uint32_t));
+  }
+}
+#endif
+
+void
+copy_transformed(
+    uint32_t *dest,
+    ptrdiff_t step_x,
+    ptrdiff_t step_y,
+    const uint8_t *src,
+    size_t src_stride,
+    int32_t width,
+    int32_t rows)
+{
+  int32_t y = 0;
+
+#if defined(__x86_64__)
+  if (step_y == 1 || step_y == -1) {
+    for (; y + 4 <= rows; y += 4) {
+      transpose_rows_sse2(
+          &dest[step_y * y],
+          step_x,
+          step_y,
+          &src[src_stride * y],
+          src_stride,
+          width);
+    }
+  } else if (step_x == -1) {
+    for (; y < rows; y++) {
+      reverse_row_sse2(&dest[step_y * y], &src[src_stride * y], width);
+    }
+  }
+#endif
+
+  /* flips that keep rows in order, and whatever the above left */
+  for (; y < rows; y++) {
+    const uint8_t *row = &src[src_stride * y];
+    if (step_x == 1) {
+      memcpy(&dest[step_y * y], row, sizeof(uint32_t) * width);
+      continue;
+    }
+    for (int32_t x = 0; x < width; x++) {
+      memcpy(
+          &dest[step_x * x + step_y * y],
+          &row[sizeof(uint32_t) * x],
+          sizeof(uint32_t));
+    }
+  }
+}
+
+/* thresholds of the ordered dither, a 4x4 bayer matrix */
+static const uint8_t dither_matrix[4][4] = {
+  { 0, 8, 2, 10 },
+  { 12, 4, 14, 6 },
+  { 3, 11, 1, 9 },
+  { 15, 7, 13, 5 },
+};
+
+/*
+ * added to the channels of pixel (x, y) of the capture before their low bits
+ * are dropped, as many as are: 3 of red and blue, 2 of green
+ */
+static uint32_t
+dither_offset(int32_t x, int32_t y)
+{
+  uint32_t threshold = dither_matrix[y & 3][x & 3];
+  return (threshold >> 1) << 16 | (threshold >> 2) << 8 | threshold >> 1;
+}
+
+static uint16_t
+pixel_rgb565(uint32_t pixel, uint32_t offset)
+{
+  uint32_t red = (pixel >> 16 & 0xff) + (offset >> 16 & 0xff);
+  uint32_t green = (pixel >> 8 & 0xff) + (offset >> 8 & 0xff);
+  uint32_t blue = (pixel & 0xff) + (offset & 0xff);
+  red = red < 0xff ? red : 0xff;
+  green = green < 0xff ? green : 0xff;
+  blue = blue < 0xff ? blue : 0xff;
+  return (uint16_t)((red >> 3) << 11 | (green >> 2) << 5 | blue >> 3);
+}
+
+#if defined(__x86_64__)
+/* 4 pixels, each in the low half of its lane */
+static __m128i
+pixels_rgb565_sse2(__m128i pixels)
+{
+  __m128i red =
+      _mm_and_si128(_mm_srli_epi32(pixels, 8), _mm_set1_epi32(0xf800));
+  __m128i green =
+      _mm_and_si128(_mm_srli_epi32(pixels, 5), _mm_set1_epi32(0x07e0));
+  __m128i blue =
+      _mm_and_si128(_mm_srli_epi32(pixels, 3), _mm_set1_epi32(0x001f));
+  __m128i packed = _mm_or_si128(_mm_or_si128(red, green), blue);
+  /* sign extended, so packing them with signed saturation keeps every bit */
+  return _mm_srai_epi32(_mm_slli_epi32(packed, 16), 16);
+}
+
+/*
+ * as much of a row as fills whole vectors, returns how many pixels that was.
+ * offsets are those of the first 4, the dither repeats every 4 pixels.
+ */
+static int32_t
+row_rgb565_sse2(
+    uint16_t *dest,
+    ptrdiff_t step_x,
+    const uint8_t *src,
+    int32_t width,
+    const uint32_t *offsets)
+{
+  __m128i offset = _mm_loadu_si128((const __m128i *)offsets);
+
+  int32_t x = 0;
+  for (; x + 8 <= width; x += 8) {
+    const uint8_t *block = &src[sizeof(uint32_t) * x];
+    __m128i lo = _mm_loadu_si128((const __m128i *)block);
+    __m128i hi = _mm_loadu_si128((const __m128i *)&block[16]);
+    /* per channel, saturating */
+    lo = _mm_adds_epu8(lo, offset);
+    hi = _mm_adds_epu8(hi, offset);
+    __m128i run =
+        _mm_packs_epi32(pixels_rgb565_sse2(lo), pixels_rgb565_sse2(hi));
+
+    if (step_x == 1) {
+      _mm_storeu_si128((__m128i *)&dest[x], run);
+      continue;
+    }
+    uint16_t pixels[8] = { 0 };
+    _mm_storeu_si128((__m128i *)pixels, run);
+    for (int i = 0; i < 8; i++) {
+      dest[step_x * (x + i)] = pixels[i];
+    }
+  }
+
+  return x;
+}
+#endif
+
+void
+copy_rgb565(
+    uint16_t *dest,
+    ptrdiff_t step_x,
+    ptrdiff_t step_y,
+    const uint8_t *src,
+    size_t src_stride,
+    int32_t x,
+    int32_t y,
+    int32_t width,
+    int32_t rows,
+    bool dither)
+{
+  for (int32_t row = 0; row < rows; row++) {
+    uint16_t *dest_row = &dest[step_y * row];
+    const uint8_t *src_row = &src[src_stride * row];
+    uint32_t offsets[4] = { 0 };
+    for (int i = 0; i < 4 && dither; i++) {
+      offsets[i] = dither_offset(x + i, y + row);
+    }
+
+    int32_t i = 0;
+#if defined(__x86_64__)
+    i = row_rgb565_sse2(dest_row, step_x, src_row, width, offsets);
+#endif
+    for (; i < width; i++) {
+      uint32_t pixel = 0;
+      memcpy(&pixel, &src_row[sizeof pixel * i], sizeof pixel);
+      dest_row[step_x * i] = pixel_rgb565(pixel, offsets[i % 4]);
+    }
+  }
+}
@@ -0,0 +1,84 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef WSSTEST_COPY_H
+#define WSSTEST_COPY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * copying captured pixels into buffers. nothing reads those buffers again but
+ * the compositor, so for frames that don't fit in the cache anyway the rows are
+ * written with streaming stores, instead of evicting the hack's working set.
+ * big frames are also split into stripes of rows across a few worker threads.
+ *
+ * copy_start looks at the cache and the cpu, and starts the workers. each
+ * batch picks both from the size of the frame it's part of, so captures of
+ * different outputs get what suits them. until copy_start, or if it doesn't
+ * pay off, spans are copied with memcpy on the calling thread. one batch uses
+ * the workers at a time, others copy on their own thread meanwhile.
+ */
+
+struct copy_span
+{
+  uint8_t *dest;
+  const uint8_t *src;
+  /* of both, in bytes */
+  size_t stride;
+  /* bytes to copy from each row */
+  size_t len;
+  int32_t rows;
+};
+
+void
+copy_start(void);
+
+/* frame_size is of the whole frame the spans are a part of */
+void
+copy_spans(
+    const struct copy_span *spans,
+    size_t spans_num,
+    size_t frame_size);
+
+void
+copy_stop(void);
+
+/*
+ * a rectangle of 32-bit pixels into a rotated or flipped buffer, on the calling
+ * thread. pixel (x, y) of src goes to dest[step_x * x + step_y * y], steps in
+ * pixels. quarter turns go through 4x4 blocks, transposed in registers.
+ */
+void
+copy_transformed(
+    uint32_t *dest,
+    ptrdiff_t step_x,
+    ptrdiff_t step_y,
+    const uint8_t *src,
+    size_t src_stride,
+    int32_t width,
+    int32_t rows);
+
+/*
+ * the same, but converting to 16-bit rgb565 pixels, 8 at a time. src is at
+ * pixel (x, y) of the capture, which the 4x4 ordered dither is anchored to, so
+ * with dither the pattern stays put from one frame to the next.
+ */
+void
+copy_rgb565(
+    uint16_t *dest,
+    ptrdiff_t step_x,
+    ptrdiff_t step_y,
+    const uint8_t *src,
+    size_t src_stride,
+    int32_t x,
+    int32_t y,
+    int32_t width,
+    int32_t rows,
+    bool dither);
+
+#endif /* WSSTEST_COPY_H */
@@ -0,0 +1,198 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "debug-log.h"
+
+enum {
+  /* power of 2, so the indices can wrap freely */
+  debug_log_records = 1 << 12,
+  debug_log_drain_ms = 50,
+};
+
+struct debug_log_entry
+{
+  /* which turn of the ring this entry is on, see below */
+  size_t sequence;
+  uint64_t time;
+  const char *format;
+  int64_t args[debug_log_args];
+};
+
+/*
+ * any number of producers (the event loop and the render threads) and one
+ * consumer (the drain thread). producers claim the entry at head by bumping it,
+ * the consumer takes the one at tail. an entry's sequence says whose turn it
+ * is: its position to be written, position + 1 to be read, and position + the
+ * size of the ring to be written again on the next turn.
+ */
+static struct
+{
+  struct debug_log_entry *entries;
+  uint64_t epoch;
+  size_t head;
+  size_t tail;
+  uint64_t dropped;
+  bool running;
+  pthread_t thread;
+} debug_log = { 0 };
+
+static uint64_t
+monotonic_ns(void)
+{
+  struct timespec now = { 0 };
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void
+debug_log_record(const char *format, const int64_t args[debug_log_args])
+{
+  if (debug_log.entries == NULL) {
+    return;
+  }
+
+  struct debug_log_entry *entry = NULL;
+  size_t head = __atomic_load_n(&debug_log.head, __ATOMIC_RELAXED);
+  while (true) {
+    entry = &debug_log.entries[head & (debug_log_records - 1)];
+    size_t sequence = __atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE);
+    if (sequence != head) {
+      /* still holds a record from the last turn, the ring is full */
+      if ((ptrdiff_t)(sequence - head) < 0) {
+        __atomic_add_fetch(&debug_log.dropped, 1, __ATOMIC_RELAXED);
+        return;
+      }
+      /* another producer took it first */
+      head = __atomic_load_n(&debug_log.head, __ATOMIC_RELAXED);
+      continue;
+    }
+    if (__atomic_compare_exchange_n(
+            &debug_log.head,
+            &head,
+            head + 1,
+            false,
+            __ATOMIC_RELAXED,
+            __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+
+  entry->time = monotonic_ns() - debug_log.epoch;
+  entry->format = format;
+  for (size_t i = 0; i < debug_log_args; i++) {
+    entry->args[i] = args[i];
+  }
+
+  __atomic_store_n(&entry->sequence, head + 1, __ATOMIC_RELEASE);
+}
+
+static void
+drain(void)
+{
+  for (size_t tail = debug_log.tail;; tail++) {
+    struct debug_log_entry *entry =
+        &debug_log.entries[tail & (debug_log_records - 1)];
+    /* stop at the first record that isn't completely written yet */
+    if (__atomic_load_n(&entry->sequence, __ATOMIC_ACQUIRE) != tail + 1) {
+      debug_log.tail = tail;
+      break;
+    }
+
+    fprintf(
+        stderr,
+        "[%5" PRIu64 ".%06" PRIu64 "] ",
+        entry->time / 1000000000,
+        entry->time / 1000 % 1000000);
+    /* extra arguments are ignored, the format only takes what it needs */
+    fprintf(
+        stderr,
+        entry->format,
+        entry->args[0],
+        entry->args[1],
+        entry->args[2],
+        entry->args[3]);
+
+    __atomic_store_n(
+        &entry->sequence,
+        tail + debug_log_records,
+        __ATOMIC_RELEASE);
+  }
+
+  uint64_t dropped =
+      __atomic_exchange_n(&debug_log.dropped, 0, __ATOMIC_RELAXED);
+  if (dropped != 0) {
+    fprintf(stderr, "debug_log: Dropped %" PRIu64 " records\n", dropped);
+  }
+}
+
+static void *
+drain_thread(void *data)
+{
+  (void)data;
+  struct timespec interval = { 0, debug_log_drain_ms * 1000000L };
+
+  while (__atomic_load_n(&debug_log.running, __ATOMIC_ACQUIRE)) {
+    drain();
+    nanosleep(&interval, NULL);
+  }
+
+  return NULL;
+}
+
+int
+debug_log_start(void)
+{
+  int error = 0;
+
+  debug_log.entries = calloc(debug_log_records, sizeof *debug_log.entries);
+  if (debug_log.entries == NULL) {
+    perror("calloc");
+    return -1;
+  }
+  for (size_t i = 0; i < debug_log_records; i++) {
+    debug_log.entries[i].sequence = i;
+  }
+  debug_log.epoch = monotonic_ns();
+
+  debug_log.running = true;
+  error = pthread_create(&debug_log.thread, NULL, drain_thread, NULL);
+  if (error != 0) {
+    errno = error;
+    perror("pthread_create");
+    debug_log.running = false;
+    free(debug_log.entries);
+    debug_log.entries = NULL;
+    return -1;
+  }
+
+  return 0;
+}
+
+void
+debug_log_stop(void)
+{
+  if (!debug_log.running) {
+    return;
+  }
+
+  __atomic_store_n(&debug_log.running, false, __ATOMIC_RELEASE);
+  pthread_join(debug_log.thread, NULL);
+
+  /* the producer is done too by now, take the rest on this thread */
+  drain();
+  free(debug_log.entries);
+  debug_log.entries = NULL;
+}
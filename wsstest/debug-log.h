@@ -0,0 +1,48 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef WSSTEST_DEBUG_LOG_H
+#define WSSTEST_DEBUG_LOG_H
+
+#include <inttypes.h>
+#include <stdint.h>
+
+/*
+ * debug messages that stay off the frame path. a record is a timestamp, the
+ * format string and its arguments, copied into a ring buffer without locking
+ * or formatting. a drain thread formats and writes them to stderr a little
+ * later. if the ring fills up, records are dropped and counted, the event loop
+ * never waits for stderr. any thread may log.
+ *
+ * formats must be string literals, only the pointer is kept, and may only
+ * convert int64_t arguments (PRId64 and friends). up to debug_log_args of them:
+ *
+ *   DEBUG_LOG("poll: %" PRId64 "\n", poll_ready);
+ *   DEBUG_LOG("poll: No events\n");
+ *
+ * records are dropped while the log isn't started.
+ */
+
+enum {
+  debug_log_args = 4,
+};
+
+/* a 0 goes after the arguments, so there's always at least one for c99 */
+#define DEBUG_LOG(...) DEBUG_LOG_ARGS(__VA_ARGS__, 0)
+#define DEBUG_LOG_ARGS(format, ...)                                            \
+  debug_log_record((format), (int64_t[debug_log_args + 1]){ __VA_ARGS__ })
+
+int
+debug_log_start(void);
+
+void
+debug_log_record(const char *format, const int64_t args[debug_log_args]);
+
+/* writes out whatever is left */
+void
+debug_log_stop(void);
+
+#endif /* WSSTEST_DEBUG_LOG_H */
@@ -0,0 +1,378 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <string.h>
+
+#include "copy.h"
+#include "frame.h"
+
+/* where pixel (x, y) of the capture goes */
+static void
+layout_point(
+    const struct layout *layout,
+    int32_t x,
+    int32_t y,
+    int32_t *buffer_x,
+    int32_t *buffer_y)
+{
+  int32_t capture_width = layout->capture_width;
+  int32_t capture_height = layout->capture_height;
+
+  switch (layout->transform) {
+  case 1: /* 90 */
+    *buffer_x = y;
+    *buffer_y = capture_width - 1 - x;
+    break;
+  case 2: /* 180 */
+    *buffer_x = capture_width - 1 - x;
+    *buffer_y = capture_height - 1 - y;
+    break;
+  case 3: /* 270 */
+    *buffer_x = capture_height - 1 - y;
+    *buffer_y = x;
+    break;
+  case 4: /* flipped */
+    *buffer_x = capture_width - 1 - x;
+    *buffer_y = y;
+    break;
+  case 5: /* flipped 90 */
+    *buffer_x = capture_height - 1 - y;
+    *buffer_y = capture_width - 1 - x;
+    break;
+  case 6: /* flipped 180 */
+    *buffer_x = x;
+    *buffer_y = capture_height - 1 - y;
+    break;
+  case 7: /* flipped 270 */
+    *buffer_x = y;
+    *buffer_y = x;
+    break;
+  default:
+    *buffer_x = x;
+    *buffer_y = y;
+    break;
+  } /* switch (layout->transform) */
+}
+
+static ptrdiff_t
+layout_index(const struct layout *layout, int32_t x, int32_t y)
+{
+  int32_t buffer_x = 0;
+  int32_t buffer_y = 0;
+  layout_point(layout, x, y, &buffer_x, &buffer_y);
+  return (ptrdiff_t)layout->width * buffer_y + buffer_x;
+}
+
+void
+layout_init(
+    struct layout *layout,
+    int32_t transform,
+    int32_t format,
+    int32_t capture_width,
+    int32_t capture_height)
+{
+  layout->capture_width = capture_width;
+  layout->capture_height = capture_height;
+  layout->capture_stride = sizeof(uint32_t) * capture_width;
+  layout->tiles_x = (capture_width + tile_size - 1) / tile_size;
+  layout->tiles_y = (capture_height + tile_size - 1) / tile_size;
+  layout->transform = transform >= 0 && transform < 8 ? transform : 0;
+  layout->format = format;
+  layout->pixel_size =
+      format == pixel_xrgb8888 ? sizeof(uint32_t) : sizeof(uint16_t);
+  /* the odd ones are a quarter turn */
+  bool turned = layout->transform % 2 != 0;
+  layout->width = turned ? capture_height : capture_width;
+  layout->height = turned ? capture_width : capture_height;
+  layout->stride = layout->pixel_size * layout->width;
+  layout->size = layout->stride * layout->height;
+  layout->origin = layout_index(layout, 0, 0);
+  layout->step_x = layout_index(layout, 1, 0) - layout->origin;
+  layout->step_y = layout_index(layout, 0, 1) - layout->origin;
+}
+
+struct damage_rect
+layout_rect(const struct layout *layout, struct damage_rect rect)
+{
+  /* runs of whole tiles may reach past the edges */
+  if (rect.width > layout->capture_width - rect.x) {
+    rect.width = layout->capture_width - rect.x;
+  }
+  if (rect.height > layout->capture_height - rect.y) {
+    rect.height = layout->capture_height - rect.y;
+  }
+  if (layout->transform == 0 || rect.width <= 0 || rect.height <= 0) {
+    return rect;
+  }
+
+  int32_t x0 = 0;
+  int32_t y0 = 0;
+  int32_t x1 = 0;
+  int32_t y1 = 0;
+  layout_point(layout, rect.x, rect.y, &x0, &y0);
+  layout_point(
+      layout,
+      rect.x + rect.width - 1,
+      rect.y + rect.height - 1,
+      &x1,
+      &y1);
+
+  return (struct damage_rect){
+    .x = x0 < x1 ? x0 : x1,
+    .y = y0 < y1 ? y0 : y1,
+    .width = (x0 < x1 ? x1 - x0 : x0 - x1) + 1,
+    .height = (y0 < y1 ? y1 - y0 : y0 - y1) + 1,
+  };
+}
+
+/*
+ * hash in 8 independent 32-bit lanes so the inner loop vectorizes. the tail of
+ * a row that doesn't fill the lanes goes to the first ones.
+ */
+uint64_t
+hash_tile(
+    const uint8_t *tile,
+    size_t tile_stride,
+    int32_t tile_width,
+    int32_t tile_height)
+{
+  uint32_t lanes[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+  for (int32_t y = 0; y < tile_height; y++) {
+    const uint8_t *row = &tile[tile_stride * y];
+    int32_t x = 0;
+    for (; x + 8 <= tile_width; x += 8) {
+      for (int lane = 0; lane < 8; lane++) {
+        uint32_t pixel = 0;
+        memcpy(&pixel, &row[sizeof pixel * (x + lane)], sizeof pixel);
+        uint32_t h = (lanes[lane] ^ pixel) * UINT32_C(0x9e3779b1);
+        lanes[lane] = h ^ (h >> 15);
+      }
+    }
+    for (int lane = 0; lane < 8 && x + lane < tile_width; lane++) {
+      uint32_t pixel = 0;
+      memcpy(&pixel, &row[sizeof pixel * (x + lane)], sizeof pixel);
+      uint32_t h = (lanes[lane] ^ pixel) * UINT32_C(0x9e3779b1);
+      lanes[lane] = h ^ (h >> 15);
+    }
+  }
+
+  uint64_t hash = UINT64_C(0xcbf29ce484222325);
+  for (int lane = 0; lane < 8; lane++) {
+    hash = (hash ^ lanes[lane]) * UINT64_C(0x100000001b3);
+  }
+  return hash;
+}
+
+/*
+ * runs of changed tiles in a row become one rectangle, which grows downwards
+ * while the rows below have the same run.
+ */
+void
+add_damage_row(
+    const struct layout *layout,
+    struct frame *frame,
+    int32_t tile_y,
+    const bool *changed)
+{
+  int32_t tiles_x = layout->tiles_x;
+  struct damage_rect *bounds = &frame->damage_bounds;
+  int32_t run_start = -1;
+
+  for (int32_t tile_x = 0; tile_x <= tiles_x; tile_x++) {
+    bool tile_changed = tile_x < tiles_x && changed[tile_x];
+    if (tile_changed && run_start < 0) {
+      run_start = tile_x;
+    }
+    if (tile_changed || run_start < 0) {
+      continue;
+    }
+
+    struct damage_rect run = {
+      .x = run_start * tile_size,
+      .y = tile_y * tile_size,
+      .width = (tile_x - run_start) * tile_size,
+      .height = tile_size,
+    };
+    run_start = -1;
+
+    if (run.x < bounds->x) {
+      bounds->x = run.x;
+    }
+    if (run.y < bounds->y) {
+      bounds->y = run.y;
+    }
+    if (run.x + run.width > bounds->width) {
+      bounds->width = run.x + run.width;
+    }
+    bounds->height = run.y + run.height;
+
+    size_t i = 0;
+    for (; i < frame->damage_rects_num; i++) {
+      struct damage_rect *rect = &frame->damage_rects[i];
+      if (rect->x == run.x && rect->width == run.width &&
+          rect->y + rect->height == run.y) {
+        rect->height += run.height;
+        break;
+      }
+    }
+    if (i < frame->damage_rects_num) {
+      continue;
+    }
+    if (frame->damage_rects_num >= damage_rects_max) {
+      frame->damage_overflow = true;
+      continue;
+    }
+    frame->damage_rects[frame->damage_rects_num++] = run;
+  }
+}
+
+void
+finish_damage(struct frame *frame)
+{
+  if (!frame->damage_overflow) {
+    return;
+  }
+
+  /* bounds.width and height are still the right and bottom edges */
+  frame->damage_rects[0] = frame->damage_bounds;
+  frame->damage_rects[0].width -= frame->damage_bounds.x;
+  frame->damage_rects[0].height -= frame->damage_bounds.y;
+  frame->damage_rects_num = 1;
+  frame->damage_overflow = false;
+}
+
+/* rows of the capture from (x, y) on, rotated or converted as they're copied */
+static void
+copy_laid_out(
+    const struct layout *layout,
+    uint8_t *mem,
+    const uint8_t *src,
+    int32_t x,
+    int32_t y,
+    int32_t copy_width,
+    int32_t rows)
+{
+  ptrdiff_t index = layout->origin + layout->step_x * x + layout->step_y * y;
+
+  if (layout->format == pixel_xrgb8888) {
+    copy_transformed(
+        &((uint32_t *)mem)[index],
+        layout->step_x,
+        layout->step_y,
+        src,
+        layout->capture_stride,
+        copy_width,
+        rows);
+    return;
+  }
+
+  copy_rgb565(
+      &((uint16_t *)mem)[index],
+      layout->step_x,
+      layout->step_y,
+      src,
+      layout->capture_stride,
+      x,
+      y,
+      copy_width,
+      rows,
+      layout->format == pixel_rgb565_dithered);
+}
+
+/*
+ * hash the tile rows of a strip starting at row strip_y. tiles that differ
+ * from what the destination buffer holds are copied into it, tiles that differ
+ * from the buffer on screen are damaged. they can be the same buffer. the
+ * copies of the whole strip are done in one go, so they can be split up.
+ * rotated or converted ones are done right away, tile row by tile row.
+ */
+void
+update_strip(
+    const struct layout *layout,
+    const uint8_t *strip,
+    int32_t strip_y,
+    int32_t strip_rows,
+    struct buffer *dest,
+    const struct buffer *shown,
+    struct frame *frame)
+{
+  int32_t capture_width = layout->capture_width;
+  size_t capture_stride = layout->capture_stride;
+  int32_t tiles_x = layout->tiles_x;
+  struct copy_span spans[frame_tiles_max] = { { 0 } };
+  size_t spans_num = 0;
+
+  for (int32_t y = 0; y < strip_rows; y += tile_size) {
+    int32_t tile_y = (strip_y + y) / tile_size;
+    int32_t tile_height =
+        strip_rows - y < tile_size ? strip_rows - y : tile_size;
+    bool changed[frame_tiles_max] = { false };
+    int32_t copy_start = tiles_x;
+    int32_t copy_end = 0;
+
+    for (int32_t tile_x = 0; tile_x < tiles_x; tile_x++) {
+      int32_t x = tile_x * tile_size;
+      int32_t tile_width =
+          capture_width - x < tile_size ? capture_width - x : tile_size;
+      uint64_t hash = hash_tile(
+          &strip[capture_stride * y + sizeof(uint32_t) * x],
+          capture_stride,
+          tile_width,
+          tile_height);
+
+      changed[tile_x] = !shown->damage.valid ||
+                        shown->damage.tile_hashes[tile_y][tile_x] != hash;
+      if (!dest->damage.valid ||
+          dest->damage.tile_hashes[tile_y][tile_x] != hash) {
+        if (tile_x < copy_start) {
+          copy_start = tile_x;
+        }
+        copy_end = tile_x + 1;
+      }
+      dest->damage.tile_hashes[tile_y][tile_x] = hash;
+    }
+
+    bool laid_out =
+        layout->transform != 0 || layout->format != pixel_xrgb8888;
+    if (copy_start < copy_end && laid_out) {
+      int32_t x = tile_size * copy_start;
+      int32_t x_end = tile_size * copy_end;
+      if (x_end > capture_width) {
+        x_end = capture_width;
+      }
+      copy_laid_out(
+          layout,
+          dest->mem,
+          &strip[capture_stride * y + sizeof(uint32_t) * x],
+          x,
+          strip_y + y,
+          x_end - x,
+          tile_height);
+      copy_start = copy_end;
+    }
+
+    /* one span per pixel row, from the first to the last tile that differs */
+    if (copy_start < copy_end) {
+      size_t offset = sizeof(uint32_t) * tile_size * copy_start;
+      size_t end = sizeof(uint32_t) * tile_size * copy_end;
+      if (end > capture_stride) {
+        end = capture_stride;
+      }
+      spans[spans_num++] = (struct copy_span){
+        .dest = &dest->mem[capture_stride * (strip_y + y) + offset],
+        .src = &strip[capture_stride * y + offset],
+        .stride = capture_stride,
+        .len = end - offset,
+        .rows = tile_height,
+      };
+    }
+
+    add_damage_row(layout, frame, tile_y, changed);
+  }
+
+  copy_spans(spans, spans_num, layout->size);
+}
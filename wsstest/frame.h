@@ -0,0 +1,183 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef WSSTEST_FRAME_H
+#define WSSTEST_FRAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * the per-frame work that doesn't talk to either server: finding damage and
+ * copying captured pixels into buffers. kept apart from main.c so the
+ * benchmarks can run it on its own.
+ */
+
+struct wl_buffer;
+
+/*
+ * captures are the size of their output, up to frame_size_max pixels a side.
+ * bigger outputs, and those that don't say, get width by height frames that
+ * the compositor scales up.
+ * TODO: allocate buffers dynamically (search: TODO-BUFFER)
+ */
+enum {
+  width = 1024,
+  height = 768,
+  stride = sizeof(uint32_t) * width,
+  buffer_size = stride * height,
+  frame_size_max = 4096,
+};
+
+/*
+ * we don't get damage from the x server, so we find it ourselves by hashing
+ * square tiles of each captured frame and comparing with the last one shown.
+ * damage in excess of damage_rects_max rectangles is merged into its bounds.
+ */
+enum {
+  tile_size = 64,
+  frame_tiles_max = (frame_size_max + tile_size - 1) / tile_size,
+  damage_rects_max = 16,
+};
+
+/*
+ * the pixels of the buffers. captures are always 32-bit xrgb, rgb565 halves
+ * what's copied and sent to the compositor, for when that goes over a slow
+ * link. its dithered variant trades banding in gradients for a fine pattern.
+ */
+enum pixel_format {
+  pixel_xrgb8888,
+  pixel_rgb565,
+  pixel_rgb565_dithered,
+};
+
+/*
+ * how a capture is laid out in its buffers. on a rotated output the frames are
+ * rotated as they're copied, so the compositor can scan the buffers out as
+ * they are (see wl_surface.set_buffer_transform) instead of rotating them
+ * every frame. pixel (x, y) of the capture is pixel origin + x * step_x +
+ * y * step_y of a buffer. tile hashes and damage stay in capture coordinates.
+ */
+struct layout
+{
+  /* of the capture, 32-bit xrgb as it comes */
+  int32_t capture_width;
+  int32_t capture_height;
+  size_t capture_stride;
+  int32_t tiles_x;
+  int32_t tiles_y;
+  /* enum wl_output_transform */
+  int32_t transform;
+  /* enum pixel_format */
+  int32_t format;
+  /* of the buffers */
+  size_t pixel_size;
+  int32_t width;
+  int32_t height;
+  size_t stride;
+  size_t size;
+  ptrdiff_t origin;
+  ptrdiff_t step_x;
+  ptrdiff_t step_y;
+};
+
+/* of a capture, see struct buffer. TODO-OUTPUT */
+enum {
+  buffer_surfaces_max = 3,
+};
+
+struct damage
+{
+  bool valid;
+  /* tiles_y by tiles_x of the layout */
+  uint64_t tile_hashes[frame_tiles_max][frame_tiles_max];
+};
+
+struct damage_rect
+{
+  int32_t x;
+  int32_t y;
+  int32_t width;
+  int32_t height;
+};
+
+/*
+ * a buffer has a wl_buffer of its own for each surface it may be shown on,
+ * all of the same memory. the compositor only releases a wl_buffer reliably
+ * if it was committed to just the one surface, see wl_surface.attach.
+ */
+struct buffer
+{
+  /* in the slots of the outputs of its capture */
+  struct wl_buffer *buffers[buffer_surfaces_max];
+  uint8_t *mem;
+  /* of mem in the shm pool */
+  size_t offset;
+  /* of buffers, those committed to their surface and not released yet */
+  bool held[buffer_surfaces_max];
+  /* how many of them are held, mem is only written once none are */
+  uint32_t busy;
+  /* which frame of its capture is in mem, see frame_seq */
+  uint64_t seq;
+  /* hashes of the tiles currently in mem */
+  struct damage damage;
+};
+
+/* what changed in a capture, to be presented on each surface showing it */
+struct frame
+{
+  /* NULL if nothing changed */
+  struct buffer *buffer;
+  bool full_damage;
+  size_t damage_rects_num;
+  struct damage_rect damage_rects[damage_rects_max];
+  /* right and bottom edges until the overflow is resolved */
+  bool damage_overflow;
+  struct damage_rect damage_bounds;
+};
+
+void
+layout_init(
+    struct layout *layout,
+    int32_t transform,
+    int32_t format,
+    int32_t capture_width,
+    int32_t capture_height);
+
+/* a rectangle of the capture, where it ends up in a buffer */
+struct damage_rect
+layout_rect(const struct layout *layout, struct damage_rect rect);
+
+uint64_t
+hash_tile(
+    const uint8_t *tile,
+    size_t tile_stride,
+    int32_t tile_width,
+    int32_t tile_height);
+
+/* changed has tiles_x of the layout */
+void
+add_damage_row(
+    const struct layout *layout,
+    struct frame *frame,
+    int32_t tile_y,
+    const bool *changed);
+
+void
+finish_damage(struct frame *frame);
+
+void
+update_strip(
+    const struct layout *layout,
+    const uint8_t *strip,
+    int32_t strip_y,
+    int32_t strip_rows,
+    struct buffer *dest,
+    const struct buffer *shown,
+    struct frame *frame);
+
+#endif /* WSSTEST_FRAME_H */
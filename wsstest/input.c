@@ -0,0 +1,621 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define _POSIX_C_SOURCE 200809L
+/* explicit_bzero */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <xkbcommon/xkbcommon.h>
+
+#include "auth.h"
+#include "debug-log.h"
+#include "input.h"
+#include "trace.h"
+
+#define COUNTOF(array) (sizeof(array) / sizeof(array)[0])
+
+enum {
+  seat_version = 1, /* latest: 9 */
+  /* evdev keycodes are offset by 8 in xkb */
+  xkb_keycode_offset = 8,
+  /* anything later than this is from a compositor on another clock */
+  latency_max_ms = 10000,
+  /* the percentiles are of the last this many keys */
+  latencies_max = 4096,
+};
+
+static struct
+{
+  struct wl_display *wl;
+  struct wl_event_queue *queue;
+  struct wl_seat *seat;
+  struct wl_keyboard *keyboard;
+  struct xkb_context *xkb_context;
+  struct xkb_keymap *keymap;
+  struct xkb_state *state;
+  /* what was typed so far, wiped as soon as it's done with */
+  char password[256];
+  size_t password_len;
+  /* characters in password, not bytes */
+  size_t echo;
+  uint64_t keys;
+  uint64_t latency_max_ns;
+  /* a ring, keys is where the next one goes */
+  uint64_t latencies_ns[latencies_max];
+  struct input_latency latency;
+  /* the event loop's, written if we fail */
+  int fail_fd;
+  int stop_fd;
+  pthread_t thread;
+  bool running;
+} input = {
+  .fail_fd = -1,
+  .stop_fd = -1,
+};
+
+static uint64_t
+monotonic_ns(void)
+{
+  struct timespec now = { 0 };
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void
+clear_password(void)
+{
+  explicit_bzero(input.password, sizeof input.password);
+  input.password_len = 0;
+}
+
+/* utf-8 continuation bytes are the ones that look like 0b10xxxxxx */
+static bool
+continues_char(char c)
+{
+  return ((unsigned char)c & 0xc0) == 0x80;
+}
+
+/* the prompt shows what's typed as this many characters */
+static void
+echo_password(uint32_t time)
+{
+  size_t echo = 0;
+  for (size_t i = 0; i < input.password_len; i++) {
+    echo += !continues_char(input.password[i]);
+  }
+  __atomic_store_n(&input.echo, echo, __ATOMIC_RELEASE);
+
+  /*
+   * the compositor's timestamps are in milliseconds of CLOCK_MONOTONIC (at
+   * least on the usual compositors), so the keypress is taken to be at the
+   * start of its millisecond.
+   */
+  uint64_t now = monotonic_ns();
+  uint32_t elapsed_ms = (uint32_t)(now / 1000000) - time;
+  uint64_t latency = (uint64_t)elapsed_ms * 1000000 + now % 1000000;
+  if (elapsed_ms > latency_max_ms) {
+    return;
+  }
+
+  input.latencies_ns[input.keys % latencies_max] = latency;
+  input.keys += 1;
+  if (latency > input.latency_max_ns) {
+    input.latency_max_ns = latency;
+  }
+
+  uint64_t trace_end = trace_now();
+  if (trace_end > latency) {
+    trace_span("key", trace_track_input, trace_end - latency, echo);
+  }
+  DEBUG_LOG("input: Echoed in %" PRId64 " ns\n", (int64_t)latency);
+}
+
+static void
+handle_key_press(uint32_t key)
+{
+  xkb_keycode_t keycode = key + xkb_keycode_offset;
+  xkb_keysym_t keysym = xkb_state_key_get_one_sym(input.state, keycode);
+
+  switch (keysym) {
+  case XKB_KEY_Return:
+  case XKB_KEY_KP_Enter:
+    /* typing on while an attempt runs would only race it, start over */
+    if (auth_submit(input.password, input.password_len) != 0) {
+      fputs("auth_submit: Still busy\n", stderr);
+    }
+    clear_password();
+    return;
+
+  case XKB_KEY_Escape:
+    clear_password();
+    return;
+
+  case XKB_KEY_BackSpace:
+    while (input.password_len > 0) {
+      input.password_len -= 1;
+      char c = input.password[input.password_len];
+      input.password[input.password_len] = '\0';
+      if (!continues_char(c)) {
+        break;
+      }
+    }
+    return;
+
+  default:
+    break;
+  } /* switch (keysym) */
+
+  char text[8] = { 0 };
+  int text_len =
+      xkb_state_key_get_utf8(input.state, keycode, text, sizeof text);
+  /* modifiers, dead keys and control characters type nothing */
+  if (text_len <= 0 || (size_t)text_len >= sizeof text ||
+      (unsigned char)text[0] < 0x20 || text[0] == 0x7f) {
+    return;
+  }
+  if (input.password_len + text_len >= sizeof input.password) {
+    return;
+  }
+
+  memcpy(&input.password[input.password_len], text, text_len);
+  input.password_len += text_len;
+  explicit_bzero(text, sizeof text);
+}
+
+static void
+handle_wl_keyboard_keymap(
+    void *data,
+    struct wl_keyboard *wl_keyboard,
+    uint32_t format,
+    int32_t fd,
+    uint32_t size)
+{
+  (void)data;
+  (void)wl_keyboard;
+
+  if (format != WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1) {
+    fprintf(
+        stderr,
+        "wl_keyboard.keymap: Unknown format %" PRIu32 "\n",
+        format);
+    close(fd);
+    return;
+  }
+
+  /* MAP_PRIVATE, since version 7 the compositor may hand out a sealed fd */
+  char *keymap_string = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (keymap_string == MAP_FAILED) {
+    perror("mmap");
+    return;
+  }
+
+  struct xkb_keymap *keymap = xkb_keymap_new_from_string(
+      input.xkb_context,
+      keymap_string,
+      XKB_KEYMAP_FORMAT_TEXT_V1,
+      XKB_KEYMAP_COMPILE_NO_FLAGS);
+  munmap(keymap_string, size);
+  if (keymap == NULL) {
+    fputs("xkb_keymap_new_from_string: Failed\n", stderr);
+    return;
+  }
+
+  struct xkb_state *state = xkb_state_new(keymap);
+  if (state == NULL) {
+    fputs("xkb_state_new: Failed\n", stderr);
+    xkb_keymap_unref(keymap);
+    return;
+  }
+
+  xkb_state_unref(input.state);
+  xkb_keymap_unref(input.keymap);
+  input.keymap = keymap;
+  input.state = state;
+}
+
+static void
+handle_wl_keyboard_enter(
+    void *data,
+    struct wl_keyboard *wl_keyboard,
+    uint32_t serial,
+    struct wl_surface *surface,
+    struct wl_array *keys)
+{
+  (void)data;
+  (void)wl_keyboard;
+  (void)serial;
+  (void)surface;
+  (void)keys;
+}
+
+static void
+handle_wl_keyboard_leave(
+    void *data,
+    struct wl_keyboard *wl_keyboard,
+    uint32_t serial,
+    struct wl_surface *surface)
+{
+  (void)data;
+  (void)wl_keyboard;
+  (void)serial;
+  (void)surface;
+}
+
+static void
+handle_wl_keyboard_key(
+    void *data,
+    struct wl_keyboard *wl_keyboard,
+    uint32_t serial,
+    uint32_t time,
+    uint32_t key,
+    uint32_t state)
+{
+  (void)data;
+  (void)wl_keyboard;
+  (void)serial;
+
+  if (input.state == NULL || state != WL_KEYBOARD_KEY_STATE_PRESSED) {
+    return;
+  }
+
+  handle_key_press(key);
+  echo_password(time);
+}
+
+static void
+handle_wl_keyboard_modifiers(
+    void *data,
+    struct wl_keyboard *wl_keyboard,
+    uint32_t serial,
+    uint32_t mods_depressed,
+    uint32_t mods_latched,
+    uint32_t mods_locked,
+    uint32_t group)
+{
+  (void)data;
+  (void)wl_keyboard;
+  (void)serial;
+
+  if (input.state == NULL) {
+    return;
+  }
+
+  xkb_state_update_mask(
+      input.state,
+      mods_depressed,
+      mods_latched,
+      mods_locked,
+      0,
+      0,
+      group);
+}
+
+static void
+handle_wl_keyboard_repeat_info(
+    void *data,
+    struct wl_keyboard *wl_keyboard,
+    int32_t rate,
+    int32_t delay)
+{
+  (void)data;
+  (void)wl_keyboard;
+  (void)rate;
+  (void)delay;
+}
+
+static const struct wl_keyboard_listener keyboard_listener = {
+  .keymap = handle_wl_keyboard_keymap,
+  .enter = handle_wl_keyboard_enter,
+  .leave = handle_wl_keyboard_leave,
+  .key = handle_wl_keyboard_key,
+  .modifiers = handle_wl_keyboard_modifiers,
+  .repeat_info = handle_wl_keyboard_repeat_info,
+};
+
+static void
+handle_wl_seat_capabilities(
+    void *data,
+    struct wl_seat *wl_seat,
+    uint32_t capabilities)
+{
+  int error = 0;
+  (void)data;
+
+  bool has_keyboard = (capabilities & WL_SEAT_CAPABILITY_KEYBOARD) != 0;
+  if (has_keyboard && input.keyboard == NULL) {
+    input.keyboard = wl_seat_get_keyboard(wl_seat);
+    if (input.keyboard == NULL) {
+      perror("wl_seat_get_keyboard");
+      return;
+    }
+    error = wl_keyboard_add_listener(input.keyboard, &keyboard_listener, NULL);
+    if (error != 0) {
+      fputs("wl_keyboard_add_listener: listener already set\n", stderr);
+    }
+  }
+
+  if (!has_keyboard && input.keyboard != NULL) {
+    wl_keyboard_destroy(input.keyboard);
+    input.keyboard = NULL;
+    clear_password();
+  }
+}
+
+static void
+handle_wl_seat_name(void *data, struct wl_seat *wl_seat, const char *name)
+{
+  (void)data;
+  (void)wl_seat;
+  (void)name;
+}
+
+static const struct wl_seat_listener seat_listener = {
+  .capabilities = handle_wl_seat_capabilities,
+  .name = handle_wl_seat_name,
+};
+
+/* same as the render threads, but only for the input queue */
+static int
+read_input_events(void)
+{
+  int error = 0;
+  struct pollfd input_poll[2] = {
+    { .fd = wl_display_get_fd(input.wl), .events = POLLIN },
+    { .fd = input.stop_fd, .events = POLLIN },
+  };
+
+  while (true) {
+    error = wl_display_dispatch_queue_pending(input.wl, input.queue);
+    if (error < 0) {
+      perror("wl_display_dispatch_queue_pending");
+      return -1;
+    }
+
+    error = wl_display_prepare_read_queue(input.wl, input.queue);
+    if (error != 0) {
+      continue;
+    }
+
+    error = poll(input_poll, COUNTOF(input_poll), -1);
+    if (error < 0) {
+      wl_display_cancel_read(input.wl);
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
+      return -1;
+    }
+
+    if (input_poll[1].revents != 0) {
+      wl_display_cancel_read(input.wl);
+      return 0;
+    }
+
+    if ((input_poll[0].revents & POLLIN) == 0) {
+      wl_display_cancel_read(input.wl);
+      fputs("poll: Wayland connection closed\n", stderr);
+      return -1;
+    }
+    error = wl_display_read_events(input.wl);
+    if (error != 0) {
+      perror("wl_display_read_events");
+      return -1;
+    }
+  }
+}
+
+static void *
+input_thread(void *data)
+{
+  (void)data;
+
+  int error = read_input_events();
+  if (error != 0) {
+    uint64_t stop = 1;
+    ssize_t written = write(input.fail_fd, &stop, sizeof stop);
+    if (written < 0) {
+      perror("write");
+    }
+  }
+
+  return NULL;
+}
+
+static void
+cleanup_input(void)
+{
+  clear_password();
+  __atomic_store_n(&input.echo, 0, __ATOMIC_RELEASE);
+  if (input.keyboard != NULL) {
+    wl_keyboard_destroy(input.keyboard);
+    input.keyboard = NULL;
+  }
+  if (input.seat != NULL) {
+    wl_seat_destroy(input.seat);
+    input.seat = NULL;
+  }
+  if (input.queue != NULL) {
+    wl_event_queue_destroy(input.queue);
+    input.queue = NULL;
+  }
+  xkb_state_unref(input.state);
+  input.state = NULL;
+  xkb_keymap_unref(input.keymap);
+  input.keymap = NULL;
+  xkb_context_unref(input.xkb_context);
+  input.xkb_context = NULL;
+  if (input.stop_fd >= 0) {
+    close(input.stop_fd);
+    input.stop_fd = -1;
+  }
+}
+
+int
+input_start(
+    struct wl_display *wl,
+    struct wl_registry *registry,
+    uint32_t seat_name,
+    int stop_fd)
+{
+  int error = 0;
+
+  input.wl = wl;
+  input.fail_fd = stop_fd;
+
+  input.xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+  if (input.xkb_context == NULL) {
+    fputs("xkb_context_new: Failed\n", stderr);
+    return -1;
+  }
+
+  input.queue = wl_display_create_queue(wl);
+  if (input.queue == NULL) {
+    perror("wl_display_create_queue");
+    cleanup_input();
+    return -1;
+  }
+
+  /* the seat and the keyboard it makes are on the input queue from the start,
+   * none of their events can end up on the default queue */
+  struct wl_registry *registry_wrapper = wl_proxy_create_wrapper(registry);
+  if (registry_wrapper == NULL) {
+    perror("wl_proxy_create_wrapper");
+    cleanup_input();
+    return -1;
+  }
+  wl_proxy_set_queue((struct wl_proxy *)registry_wrapper, input.queue);
+  input.seat = wl_registry_bind(
+      registry_wrapper,
+      seat_name,
+      &wl_seat_interface,
+      seat_version);
+  wl_proxy_wrapper_destroy(registry_wrapper);
+  if (input.seat == NULL) {
+    perror(wl_seat_interface.name);
+    cleanup_input();
+    return -1;
+  }
+
+  error = wl_seat_add_listener(input.seat, &seat_listener, NULL);
+  if (error != 0) {
+    fputs("wl_seat_add_listener: listener already set\n", stderr);
+    cleanup_input();
+    return -1;
+  }
+
+  input.stop_fd = eventfd(0, EFD_CLOEXEC);
+  if (input.stop_fd < 0) {
+    perror("eventfd");
+    cleanup_input();
+    return -1;
+  }
+
+  error = pthread_create(&input.thread, NULL, input_thread, NULL);
+  if (error != 0) {
+    errno = error;
+    perror("pthread_create");
+    cleanup_input();
+    return -1;
+  }
+  input.running = true;
+
+  /* ahead of the render threads when there aren't enough cores for all. only
+   * allowed with CAP_SYS_NICE or an RLIMIT_RTPRIO, it's fine without */
+  struct sched_param param = {
+    .sched_priority = sched_get_priority_min(SCHED_FIFO),
+  };
+  error = pthread_setschedparam(input.thread, SCHED_FIFO, &param);
+  fprintf(
+      stderr,
+      "input_start: %s priority\n",
+      error == 0 ? "realtime" : "normal");
+
+  return 0;
+}
+
+static int
+compare_latency(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/* of the ring, which is left sorted */
+static void
+summarize_latency(void)
+{
+  size_t num = input.keys < latencies_max ? input.keys : latencies_max;
+  qsort(input.latencies_ns, num, sizeof *input.latencies_ns, compare_latency);
+
+  input.latency = (struct input_latency){
+    .keys = input.keys,
+    .max_ns = input.latency_max_ns,
+  };
+  if (num == 0) {
+    return;
+  }
+  input.latency.p50_ns = input.latencies_ns[(num - 1) * 50 / 100];
+  input.latency.p90_ns = input.latencies_ns[(num - 1) * 90 / 100];
+  input.latency.p99_ns = input.latencies_ns[(num - 1) * 99 / 100];
+}
+
+size_t
+input_echo(void)
+{
+  return __atomic_load_n(&input.echo, __ATOMIC_ACQUIRE);
+}
+
+void
+input_stop(void)
+{
+  if (!input.running) {
+    return;
+  }
+
+  uint64_t stop = 1;
+  ssize_t written = write(input.stop_fd, &stop, sizeof stop);
+  if (written < 0) {
+    perror("write");
+  }
+  pthread_join(input.thread, NULL);
+  input.running = false;
+
+  summarize_latency();
+  if (input.keys > 0) {
+    fprintf(
+        stderr,
+        "input: %" PRIu64 " keys echoed in %.3f ms at the median, "
+        "%.3f ms at p99, %.3f ms at most\n",
+        input.keys,
+        input.latency.p50_ns / 1e6,
+        input.latency.p99_ns / 1e6,
+        input.latency.max_ns / 1e6);
+  }
+
+  cleanup_input();
+}
+
+void
+input_latency(struct input_latency *latency)
+{
+  *latency = input.latency;
+}
@@ -0,0 +1,57 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef WSSTEST_INPUT_H
+#define WSSTEST_INPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <wayland-client-core.h>
+#include <wayland-client-protocol.h>
+
+/*
+ * the keyboard, on a thread and event queue of its own so typing into the
+ * unlock prompt is never stuck behind capturing and copying frames. what's
+ * typed is kept here and echoed as a count of characters, for whoever draws
+ * the prompt, and handed to auth_submit on enter.
+ *
+ * every keypress is timed from the compositor's timestamp to its echo. the
+ * numbers are printed by input_stop, and each keypress is a span on the input
+ * track of the trace.
+ */
+
+/* how long keypresses took to echo, the percentiles of the last few thousand */
+struct input_latency
+{
+  uint64_t keys;
+  uint64_t p50_ns;
+  uint64_t p90_ns;
+  uint64_t p99_ns;
+  uint64_t max_ns;
+};
+
+/* binds the seat with registry name seat_name. if the thread fails, it
+ * writes to stop_fd to take the event loop down with it */
+int
+input_start(
+    struct wl_display *wl,
+    struct wl_registry *registry,
+    uint32_t seat_name,
+    int stop_fd);
+
+/* characters in the prompt, from any thread */
+size_t
+input_echo(void);
+
+void
+input_stop(void);
+
+/* up to the last input_stop */
+void
+input_latency(struct input_latency *latency);
+
+#endif /* WSSTEST_INPUT_H */
@@ -5,28 +5,56 @@
  */
 
 #define _POSIX_C_SOURCE 200809L
+/* memfd_create, file sealing and transparent huge pages */
+#define _GNU_SOURCE
 
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <malloc.h>
 #include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <spawn.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 extern char **environ;
 
 #include <wayland-client-core.h>
 #include <wayland-client-protocol.h>
 #include <wayland-client-protocols/ext-session-lock-v1.h>
+#include <wayland-client-protocols/single-pixel-buffer-v1.h>
+#include <wayland-client-protocols/viewporter.h>
 #include <wayland-client-protocols/xdg-shell.h>
+#include <xcb/present.h>
+#include <xcb/shm.h>
 #include <xcb/xcb.h>
 #include <xcb/xcb_util.h>
+
+#include "arena.h"
+#include "auth.h"
+#include "capture.h"
+#include "copy.h"
+#include "debug-log.h"
+#include "frame.h"
+#include "input.h"
+#include "quality.h"
+#include "render.h"
+#include "replay.h"
+#include "trace.h"
 enum {
   XCB_ERROR = 0,
   XCB_REPLY = 1,
@@ -37,119 +65,128 @@ enum {
 
 static const char app_id[] = "wsstest";
 static const char instance_class[] = "wsstest\0Wsstest";
-static const char shm_name[] = "/wsstest_shm";
 static const char debug_env[] = "WSSTEST_DEBUG";
+static const char mirror_env[] = "WSSTEST_MIRROR";
+static const char trace_env[] = "WSSTEST_TRACE";
+static const char replay_env[] = "WSSTEST_REPLAY";
+static const char blank_env[] = "WSSTEST_BLANK";
+static const char cycle_env[] = "WSSTEST_CYCLE";
+static const char budget_env[] = "WSSTEST_BUDGET";
+static const char rgb565_env[] = "WSSTEST_RGB565";
+static const char cache_env[] = "XDG_CACHE_HOME";
+static const char hack_window_env[] = "XSCREENSAVER_WINDOW";
+static const char cache_dir[] = "wsstest";
+static const char frame_cache_magic[8] = "WSSFRM2";
+
+/*
+ * the frame buffers of all captures stay within a budget, WSSTEST_BUDGET
+ * mebibytes of the pool or all of it. a capture gets all of its buffers_max
+ * buffers or none: the compositor may hold on to the one it shows for as long
+ * as it likes (scanning it out, say), so a capture with just that one would
+ * freeze. an output with no room left for a capture of its own shows one of
+ * the others, as in mirror mode.
+ */
+enum {
+  budget_default_mib = shm_len_max >> 20,
+};
+
+/*
+ * hacks that exit are restarted after a backoff that doubles with each restart
+ * in a row, up to hack_restarts_max of them. a hack that made progress for
+ * hack_healthy_s starts over. one that neither changed its window nor used
+ * the cpu for hack_stall_s is taken to be hung and killed.
+ */
+enum {
+  hack_stall_s = 60,
+  hack_healthy_s = 60,
+  hack_backoff_min_s = 1,
+  hack_backoff_max_s = 32,
+  hack_restarts_max = 5,
+  watchdog_interval_s = 1,
+};
+
+/*
+ * with more than one hack, each capture moves on to the next every
+ * cycle_default_s (or WSSTEST_CYCLE) seconds. the next hack is started
+ * cycle_lead_s ahead of time and switched to once it presented a frame, or had
+ * cycle_settle_s to draw one if it doesn't present.
+ */
+enum {
+  cycle_default_s = 600,
+  cycle_lead_s = 1,
+  cycle_settle_s = 2,
+};
+
+/* the hacks to cycle through, from the command line */
+struct hacks
+{
+  char *const *paths;
+  size_t num;
+  uint64_t cycle_ns;
+};
 
 /*
- * TODO: find these values dynamically for each output (search: TODO-SHM)
- * TODO: allocate buffers dynamically and listen for wl_buffer release events
- * (search: TODO-BUFFER)
+ * a capture that can't keep up steps down, see quality.h. at quality_hack_niced
+ * its hack runs at hack_nice.
  */
 enum {
-  width = 1024,
-  height = 768,
-  stride = sizeof(uint32_t) * width,
-  buffer_size = stride * height,
-  shm_pool_size = buffer_size * 2,
+  hack_nice = 10,
 };
 
 struct names
 {
   uint32_t compositor;
   /* TODO: sensible dynamic allocation (search: TODO-OUTPUT) */
+  /* 0 in the slots that are free, or whose output was unplugged */
   uint32_t outputs[3];
-  size_t outputs_num;
+  /* of each of outputs, as the compositor has it */
+  uint32_t output_versions[3];
   uint32_t shm;
   uint32_t wm_base;
   uint32_t session_lock_manager;
+  uint32_t viewporter;
+  uint32_t single_pixel_buffer_manager;
+  /* the first one, that's all we read the keyboard of */
+  uint32_t seat;
 };
 
 enum {
   compositor_version = 4, /* latest: 6 */
-  output_version = 1,     /* latest: 4 */
+  output_version = 4,     /* latest: 4, or what the compositor has */
   shm_version = 1,        /* latest: 2 */
   wm_base_version = 1,    /* latest: 7 */
   session_lock_manager_version = 1,
+  viewporter_version = 1,
+  single_pixel_buffer_manager_version = 1,
 };
 
 struct messages
 {
-  uint32_t frame_time;
   uint32_t ping;
-  uint32_t configure;
+  /* the compositor takes rgb565 buffers */
+  bool shm_rgb565;
 };
 
-struct outputs
+/* the pixels of the frame follow right after, in the buffer's layout */
+struct frame_cache_header
 {
-  size_t num;
-  struct wl_output *outputs[3]; /* TODO-OUTPUT */
+  char magic[8];
+  uint32_t width;
+  uint32_t height;
+  uint32_t stride;
+  uint32_t format;
+  /* enum wl_output_transform, of the layout */
+  uint32_t transform;
 };
 
-struct shm_region
+/* in the same slots as names.outputs, unbound while output is NULL */
+struct outputs
 {
-  void *addr;
-  size_t len;
+  struct output outputs[3]; /* TODO-OUTPUT */
 };
 
 static bool debug = false;
 
-static int
-flush_wl(struct wl_display *wl)
-{
-  int error = 0;
-  struct pollfd flush_poll[1] = {
-    { .fd = wl_display_get_fd(wl), .events = POLLOUT },
-  };
-
-  /* TODO: handle POLLOUT in the event loop (so it's less blocking) and augment
-   * it with error checking on revents (see _xcb_conn_wait) */
-  do {
-    error = poll(flush_poll, COUNTOF(flush_poll), -1);
-    if (error <= 0) {
-      perror("poll");
-      break;
-    }
-    /* doesn't block, instead errors with EAGAIN */
-    /* TODO: how does it behave after a partial flush? is it possible? */
-    error = wl_display_flush(wl);
-    if (error < 0 && errno != EAGAIN && errno != EPIPE) {
-      perror("wl_display_flush");
-      break;
-    }
-  } while (error < 0 && errno == EAGAIN);
-
-  /* if the connection was closed, continue and try to read the error later */
-  if (error < 0 && errno != EPIPE) {
-    return -1;
-  }
-  if (debug) {
-    fprintf(stderr, "wl_display_flush: %d\n", error);
-  }
-
-  return 0;
-}
-
-static int
-read_wl_events(struct wl_display *wl)
-{
-  int error = 0;
-
-  error = wl_display_prepare_read(wl);
-  if (error != 0) {
-    fputs("wl_display_prepare_read: Pending queue\n", stderr);
-    /* unexpectedly pending queue is not fatal */
-    return 0;
-  }
-
-  error = wl_display_read_events(wl);
-  if (error != 0) {
-    perror("wl_display_read_events");
-    return -1;
-  }
-
-  return 0;
-}
-
 static void
 handle_wl_registry_global(
     void *data,
@@ -160,7 +197,6 @@ handle_wl_registry_global(
 {
   struct names *names = data;
   (void)wl_registry;
-  (void)version;
 
   if (names == NULL) {
     fputs("handle_wl_registry_global: Missing names\n", stderr);
@@ -173,13 +209,19 @@ handle_wl_registry_global(
   }
 
   if (strcmp(interface, wl_output_interface.name) == 0) {
-    size_t n = names->outputs_num;
     /* TODO-OUTPUT */
-    if (n >= 3) {
-      return;
+    for (size_t i = 0; i < COUNTOF(names->outputs); i++) {
+      if (names->outputs[i] == 0) {
+        names->outputs[i] = name;
+        names->output_versions[i] = version;
+        return;
+      }
     }
-    names->outputs[n] = name;
-    names->outputs_num = n + 1;
+    fprintf(
+        stderr,
+        "handle_wl_registry_global: No slot for output %" PRIu32
+        ", ignoring it\n",
+        name);
     return;
   }
 
@@ -197,15 +239,32 @@ handle_wl_registry_global(
     names->session_lock_manager = name;
     return;
   }
+
+  if (strcmp(interface, wp_viewporter_interface.name) == 0) {
+    names->viewporter = name;
+    return;
+  }
+
+  if (strcmp(interface, wp_single_pixel_buffer_manager_v1_interface.name) ==
+      0) {
+    names->single_pixel_buffer_manager = name;
+    return;
+  }
+
+  if (strcmp(interface, wl_seat_interface.name) == 0 && names->seat == 0) {
+    names->seat = name;
+    return;
+  }
 }
 
+/* the event loop tears down what was built for the output when it notices */
 static void
 handle_wl_registry_global_remove(
     void *data,
     struct wl_registry *wl_registry,
     uint32_t name)
 {
-  (void)data;
+  struct names *names = data;
   (void)wl_registry;
 
   fprintf(
@@ -213,6 +272,17 @@ handle_wl_registry_global_remove(
       "Wayland global_remove\n"
       "  name: %" PRIu32 "\n",
       name);
+
+  if (names == NULL) {
+    fputs("handle_wl_registry_global_remove: Missing names\n", stderr);
+    return;
+  }
+
+  for (size_t i = 0; i < COUNTOF(names->outputs); i++) {
+    if (names->outputs[i] == name) {
+      names->outputs[i] = 0;
+    }
+  }
 }
 
 static const struct wl_registry_listener registry_listener = {
@@ -221,34 +291,141 @@ static const struct wl_registry_listener registry_listener = {
 };
 
 static void
-handle_frame_callback_done(
+handle_wl_output_geometry(
     void *data,
-    struct wl_callback *wl_callback,
-    uint32_t callback_data)
+    struct wl_output *wl_output,
+    int32_t x,
+    int32_t y,
+    int32_t physical_width,
+    int32_t physical_height,
+    int32_t subpixel,
+    const char *make,
+    const char *model,
+    int32_t transform)
 {
-  struct messages *messages = data;
-  (void)wl_callback;
+  struct output_info *info = data;
+  (void)wl_output;
+  (void)physical_width;
+  (void)physical_height;
+  (void)subpixel;
+
+  if (info == NULL) {
+    fputs("handle_wl_output_geometry: Missing info\n", stderr);
+    return;
+  }
 
-  if (messages == NULL) {
-    fputs("handle_wl_callback_done: Missing messages\n", stderr);
+  snprintf(info->name, COUNTOF(info->name), "%s %s", make, model);
+  info->x = x;
+  info->y = y;
+  info->transform = transform;
+}
+
+static void
+handle_wl_output_mode(
+    void *data,
+    struct wl_output *wl_output,
+    uint32_t flags,
+    int32_t width,
+    int32_t height,
+    int32_t refresh)
+{
+  struct output_info *info = data;
+  (void)wl_output;
+
+  if (info == NULL) {
+    fputs("handle_wl_output_mode: Missing info\n", stderr);
+    return;
+  }
+
+  if ((flags & WL_OUTPUT_MODE_CURRENT) == 0) {
+    return;
+  }
+
+  info->width = width;
+  info->height = height;
+  info->refresh = refresh;
+}
+
+static void
+handle_wl_output_done(void *data, struct wl_output *wl_output)
+{
+  struct output_info *info = data;
+  (void)wl_output;
+
+  if (info == NULL) {
+    fputs("handle_wl_output_done: Missing info\n", stderr);
+    return;
+  }
+
+  info->done = true;
+  info->updates++;
+}
+
+static void
+handle_wl_output_scale(void *data, struct wl_output *wl_output, int32_t factor)
+{
+  struct output_info *info = data;
+  (void)wl_output;
+
+  if (info == NULL) {
+    fputs("handle_wl_output_scale: Missing info\n", stderr);
+    return;
+  }
+
+  info->scale = factor;
+}
+
+static void
+handle_wl_output_name(void *data, struct wl_output *wl_output, const char *name)
+{
+  struct output_info *info = data;
+  (void)wl_output;
+
+  if (info == NULL) {
+    fputs("handle_wl_output_name: Missing info\n", stderr);
     return;
   }
 
-  messages->frame_time = callback_data;
+  snprintf(info->connector, COUNTOF(info->connector), "%s", name);
+}
+
+static void
+handle_wl_output_description(
+    void *data,
+    struct wl_output *wl_output,
+    const char *description)
+{
+  (void)data;
+  (void)wl_output;
+  (void)description;
 }
 
-static const struct wl_callback_listener frame_callback_listener = {
-  .done = handle_frame_callback_done,
+static const struct wl_output_listener output_listener = {
+  .geometry = handle_wl_output_geometry,
+  .mode = handle_wl_output_mode,
+  .done = handle_wl_output_done,
+  .scale = handle_wl_output_scale,
+  .name = handle_wl_output_name,
+  .description = handle_wl_output_description,
 };
 
 static void
 handle_wl_shm_format(void *data, struct wl_shm *wl_shm, uint32_t format)
 {
-  (void)data;
+  struct messages *messages = data;
   (void)wl_shm;
 
+  if (messages == NULL) {
+    fputs("handle_wl_shm_format: Missing messages\n", stderr);
+    return;
+  }
+
   char fourcc[4] = { 0 };
   switch (format) {
+  case WL_SHM_FORMAT_RGB565:
+    memcpy(fourcc, "RG16", 4);
+    messages->shm_rgb565 = true;
+    break;
   case WL_SHM_FORMAT_ARGB8888:
     memcpy(fourcc, "AR24", 4);
     break;
@@ -303,15 +480,15 @@ handle_xdg_surface_configure(
     struct xdg_surface *xdg_surface,
     uint32_t serial)
 {
-  struct messages *messages = data;
+  struct output *output = data;
   (void)xdg_surface;
 
-  if (messages == NULL) {
-    fputs("handle_xdg_surface_configure: Missing messages\n", stderr);
+  if (output == NULL) {
+    fputs("handle_xdg_surface_configure: Missing output\n", stderr);
     return;
   }
 
-  messages->configure = serial;
+  output->configure = serial;
 }
 
 static const struct xdg_surface_listener xdg_surface_listener = {
@@ -322,8 +499,7 @@ static int
 bind_compositor(
     struct wl_registry *registry,
     uint32_t name,
-    struct wl_compositor **compositor,
-    struct wl_surface **surface)
+    struct wl_compositor **compositor)
 {
   *compositor = wl_registry_bind(
       registry,
@@ -335,49 +511,48 @@ bind_compositor(
     return -1;
   }
 
-  *surface = wl_compositor_create_surface(*compositor);
-  if (*surface == NULL) {
-    perror("wl_compositor_create_surface");
-    return -1;
-  }
-
   return 0;
 }
 
+/* at the version the compositor has, if it's older than output_version */
 static int
-bind_outputs(
+bind_output(
     struct wl_registry *registry,
-    size_t outputs_num,
-    uint32_t *names,
-    struct outputs *outputs)
+    uint32_t name,
+    uint32_t version,
+    struct output *output)
 {
-  /* TODO-OUTPUT */
-  for (size_t i = outputs->num; i < outputs_num && i < 3; i++) {
-    outputs->outputs[i] = wl_registry_bind(
-        registry,
-        names[i],
-        &wl_output_interface,
-        output_version);
-    if (outputs->outputs[i] == NULL) {
-      perror(wl_output_interface.name);
-      return -1;
-    }
+  int error = 0;
+
+  if (version > output_version) {
+    version = output_version;
+  }
+  output->output =
+      wl_registry_bind(registry, name, &wl_output_interface, version);
+  if (output->output == NULL) {
+    perror(wl_output_interface.name);
+    return -1;
+  }
+  output->name = name;
 
-    outputs->num = i + 1;
+  error =
+      wl_output_add_listener(output->output, &output_listener, &output->info);
+  if (error != 0) {
+    fputs("wl_output_add_listener: listener already set\n", stderr);
+    return -1;
   }
 
   return 0;
 }
 
-/* TODO-SHM TODO-BUFFER */
 static int
 bind_shm(
     struct wl_registry *registry,
     uint32_t name,
-    int shm_fd,
+    const struct shm_arena *shm_arena,
+    struct messages *messages,
     struct wl_shm **shm,
-    struct wl_shm_pool **shm_pool,
-    struct wl_buffer *(*buffers)[2])
+    struct wl_shm_pool **shm_pool)
 {
   int error = 0;
 
@@ -387,42 +562,18 @@ bind_shm(
     return -1;
   }
 
-  error = wl_shm_add_listener(*shm, &shm_listener, NULL);
+  error = wl_shm_add_listener(*shm, &shm_listener, messages);
   if (error != 0) {
     fputs("wl_shm_add_listener: listener already set\n", stderr);
     return -1;
   }
 
-  *shm_pool = wl_shm_create_pool(*shm, shm_fd, shm_pool_size);
+  *shm_pool = wl_shm_create_pool(*shm, shm_arena->fd, shm_arena->len);
   if (*shm_pool == NULL) {
     perror("wl_shm_create_pool");
     return -1;
   }
 
-  (*buffers)[0] = wl_shm_pool_create_buffer(
-      /* wl_shm_pool */ *shm_pool,
-      /*      offset */ buffer_size * 0,
-      /*       width */ width,
-      /*      height */ height,
-      /*      stride */ stride,
-      /*      format */ WL_SHM_FORMAT_XRGB8888);
-  if ((*buffers)[0] == NULL) {
-    perror("wl_shm_pool_create_buffer");
-    return -1;
-  }
-
-  (*buffers)[1] = wl_shm_pool_create_buffer(
-      /* wl_shm_pool */ *shm_pool,
-      /*      offset */ buffer_size * 1,
-      /*       width */ width,
-      /*      height */ height,
-      /*      stride */ stride,
-      /*      format */ WL_SHM_FORMAT_XRGB8888);
-  if ((*buffers)[1] == NULL) {
-    perror("wl_shm_pool_create_buffer");
-    return -1;
-  }
-
   return 0;
 }
 
@@ -431,10 +582,7 @@ bind_wm_base(
     struct wl_registry *registry,
     uint32_t name,
     struct messages *messages,
-    struct wl_surface *surface,
-    struct xdg_wm_base **wm_base,
-    struct xdg_surface **xdg_surface,
-    struct xdg_toplevel **toplevel)
+    struct xdg_wm_base **wm_base)
 {
   int error = 0;
 
@@ -451,30 +599,6 @@ bind_wm_base(
     return -1;
   }
 
-  *xdg_surface = xdg_wm_base_get_xdg_surface(*wm_base, surface);
-  if (*xdg_surface == NULL) {
-    perror("xdg_wm_base_get_xdg_surface");
-    return -1;
-  }
-
-  error =
-      xdg_surface_add_listener(*xdg_surface, &xdg_surface_listener, messages);
-  if (error != 0) {
-    fputs("xdg_surface_add_listener: listener already set\n", stderr);
-    return -1;
-  }
-
-  *toplevel = xdg_surface_get_toplevel(*xdg_surface);
-  if (*toplevel == NULL) {
-    perror("xdg_surface_get_toplevel");
-    return -1;
-  }
-
-  xdg_toplevel_set_app_id(*toplevel, app_id);
-
-  /* commit the unattached surface to prompt the server to configure it */
-  wl_surface_commit(surface);
-
   return 0;
 }
 
@@ -497,6 +621,44 @@ bind_session_lock_manager(
   return 0;
 }
 
+static int
+bind_viewporter(
+    struct wl_registry *registry,
+    uint32_t name,
+    struct wp_viewporter **viewporter)
+{
+  *viewporter = wl_registry_bind(
+      registry,
+      name,
+      &wp_viewporter_interface,
+      viewporter_version);
+  if (*viewporter == NULL) {
+    perror(wp_viewporter_interface.name);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int
+bind_single_pixel_buffer_manager(
+    struct wl_registry *registry,
+    uint32_t name,
+    struct wp_single_pixel_buffer_manager_v1 **single_pixel_buffer_manager)
+{
+  *single_pixel_buffer_manager = wl_registry_bind(
+      registry,
+      name,
+      &wp_single_pixel_buffer_manager_v1_interface,
+      single_pixel_buffer_manager_version);
+  if (*single_pixel_buffer_manager == NULL) {
+    perror(wp_single_pixel_buffer_manager_v1_interface.name);
+    return -1;
+  }
+
+  return 0;
+}
+
 static void
 cleanup_x11_event(xcb_generic_event_t **event)
 {
@@ -506,19 +668,67 @@ cleanup_x11_event(xcb_generic_event_t **event)
   }
 }
 
+/* wake the render thread of the capture whose hack presented a frame */
+static void
+handle_present_complete(
+    struct captures *captures,
+    const xcb_present_complete_notify_event_t *event)
+{
+  /* msc notifications and skipped frames leave the window as it was */
+  if (event->kind != XCB_PRESENT_COMPLETE_KIND_PIXMAP ||
+      event->mode == XCB_PRESENT_COMPLETE_MODE_SKIP) {
+    return;
+  }
+  DEBUG_LOG("PresentCompleteNotify: %#" PRIx64 "\n", event->window);
+
+  for (size_t i = 0; i < COUNTOF(captures->captures); i++) {
+    struct capture *capture = &captures->captures[i];
+    /* the next hack is ready to be cycled to */
+    if (capture->queue != NULL && capture->next_window != 0 &&
+        capture->next_window == event->window) {
+      capture->next_presented = true;
+      continue;
+    }
+    if (capture->queue == NULL || capture->window != event->window ||
+        capture->present_fd < 0) {
+      continue;
+    }
+
+    uint64_t presents = 1;
+    ssize_t written = write(capture->present_fd, &presents, sizeof presents);
+    if (written < 0) {
+      perror("write");
+    }
+  }
+}
+
 static int
-handle_x11_event(xcb_connection_t *x11)
+handle_x11_event(
+    xcb_connection_t *x11,
+    struct captures *captures,
+    uint8_t present_opcode)
 {
   CLEANUP(x11_event) xcb_generic_event_t *event = NULL;
   event = xcb_poll_for_event(x11);
   if (event == NULL) {
-    if (debug) {
-      fputs("xcb_poll_for_event: No events\n", stderr);
-    }
+    DEBUG_LOG("xcb_poll_for_event: No events\n");
     return 0;
   }
 
   uint8_t event_type = XCB_EVENT_RESPONSE_TYPE(event);
+
+  /* these come with every frame of the hack, too many to print */
+  const xcb_ge_generic_event_t *generic_event = (void *)event;
+  if (event_type == XCB_GE_GENERIC && present_opcode != 0 &&
+      generic_event->extension == present_opcode) {
+    if (generic_event->event_type == XCB_PRESENT_COMPLETE_NOTIFY) {
+      handle_present_complete(
+          captures,
+          (const xcb_present_complete_notify_event_t *)event);
+    }
+    return 1;
+  }
+
   fprintf(
       stderr,
       "X Event: %" PRIu8 " (%s)\n",
@@ -561,103 +771,6 @@ handle_x11_event(xcb_connection_t *x11)
   return 1;
 }
 
-static void
-cleanup_x11_get_image_reply(xcb_get_image_reply_t **get_image_reply)
-{
-  if (*get_image_reply != NULL) {
-    free(*get_image_reply);
-    *get_image_reply = NULL;
-  }
-}
-
-/* TODO-BUFFER */
-static int
-update_surface(
-    xcb_connection_t *x11,
-    struct xcb_get_image_cookie_t *get_image_cookie,
-    xcb_window_t window,
-    struct messages *messages,
-    struct wl_surface *surface,
-    struct wl_callback **frame_callback,
-    struct wl_buffer *(*buffers)[2],
-    uint8_t *buffers_mem,
-    size_t buffer_len,
-    int *arg_next_buffer)
-{
-  int error = 0;
-  int next_buffer = *arg_next_buffer;
-  struct wl_buffer *buffer = (*buffers)[next_buffer];
-  uint8_t *buffer_mem = &buffers_mem[buffer_len * next_buffer];
-
-  /* xcb does tricks to ensure the serial of a valid request is never 0 */
-  if (get_image_cookie->sequence != 0) {
-    /* ideally we would get the reply asynchronously in the x11 event handler so
-     * we never block here, but xcb's design seems to discourage this */
-    CLEANUP(x11_get_image_reply) xcb_get_image_reply_t *get_image_reply = NULL;
-    get_image_reply = xcb_get_image_reply(x11, *get_image_cookie, NULL);
-    if (get_image_reply == NULL) {
-      /* error is waiting in the queue */
-      return 0;
-    }
-
-    uint8_t *get_image_data = xcb_get_image_data(get_image_reply);
-    /* xcb_*_length returns int, assuming it's non-negative */
-    size_t get_image_data_length = xcb_get_image_data_length(get_image_reply);
-    if (get_image_data_length > buffer_len) {
-      get_image_data_length = buffer_len;
-    }
-
-    memcpy(buffer_mem, get_image_data, get_image_data_length);
-  }
-
-  /* need to attach the initial buffer to map the window, no matter what */
-  wl_surface_attach(surface, buffer, 0, 0);
-  wl_surface_damage_buffer(surface, 0, 0, INT32_MAX, INT32_MAX);
-
-  next_buffer++;
-  if (next_buffer > 1) {
-    next_buffer = 0;
-  }
-
-  /*
-   * request next image right after copying the current one. this way the output
-   * lags against the input by about 1 update (very noticeable in debug mode,
-   * with the frame-based update disabled) but we wait less, possibly leading to
-   * a smoother output frame rate.
-   */
-  *get_image_cookie = xcb_get_image_unchecked(
-      /*          c */ x11,
-      /*     format */ XCB_IMAGE_FORMAT_Z_PIXMAP,
-      /*   drawable */ window,
-      /*          x */ 0,
-      /*          y */ 0,
-      /*      width */ width,
-      /*     height */ height,
-      /* plane_mask */ UINT32_MAX);
-
-  /* request next frame. the reply to the above request should arrive by then */
-  *frame_callback = wl_surface_frame(surface);
-  if (*frame_callback == NULL) {
-    perror("wl_surface_frame");
-    return -1;
-  }
-
-  error = wl_callback_add_listener(
-      *frame_callback,
-      &frame_callback_listener,
-      messages);
-  if (error != 0) {
-    fputs("wl_callback_add_listener: listener already set\n", stderr);
-    return -1;
-  }
-
-  /* all done, cap the update with a commit */
-  wl_surface_commit(surface);
-
-  *arg_next_buffer = next_buffer;
-  return 0;
-}
-
 static void
 cleanup_wl_display(struct wl_display **wl)
 {
@@ -704,18 +817,7 @@ cleanup_wl_callback(struct wl_callback **callback)
 }
 
 static void
-cleanup_outputs(struct outputs *outputs)
-{
-  /* TODO-OUTPUT */
-  for (size_t i = 0; i < outputs->num && i < 3; i++) {
-    wl_output_destroy(outputs->outputs[i]);
-    outputs->outputs[i] = NULL;
-  }
-  outputs->num = 0;
-}
-
-static void
-cleanup_wl_shm(struct wl_shm **shm)
+cleanup_wl_shm(struct wl_shm **shm)
 {
   if (*shm != NULL) {
     wl_shm_destroy(*shm);
@@ -732,18 +834,12 @@ cleanup_wl_shm_pool(struct wl_shm_pool **shm_pool)
   }
 }
 
-/* TODO-BUFFER */
 static void
-cleanup_wl_buffer(struct wl_buffer *(*buffer)[2])
+cleanup_wl_shm_pool_wrapper(struct wl_shm_pool **shm_pool)
 {
-  if ((*buffer)[0] != NULL) {
-    wl_buffer_destroy((*buffer)[0]);
-    (*buffer)[0] = NULL;
-  }
-
-  if ((*buffer)[1] != NULL) {
-    wl_buffer_destroy((*buffer)[1]);
-    (*buffer)[1] = NULL;
+  if (*shm_pool != NULL) {
+    wl_proxy_wrapper_destroy(*shm_pool);
+    *shm_pool = NULL;
   }
 }
 
@@ -774,6 +870,24 @@ cleanup_xdg_toplevel(struct xdg_toplevel **toplevel)
   }
 }
 
+static void
+cleanup_wp_viewport(struct wp_viewport **viewport)
+{
+  if (*viewport != NULL) {
+    wp_viewport_destroy(*viewport);
+    *viewport = NULL;
+  }
+}
+
+static void
+cleanup_outputs(struct outputs *outputs)
+{
+  /* TODO-OUTPUT */
+  for (size_t i = 0; i < COUNTOF(outputs->outputs); i++) {
+    cleanup_output(&outputs->outputs[i]);
+  }
+}
+
 static void
 cleanup_ext_session_lock_manager(
     struct ext_session_lock_manager_v1 **session_lock_manager)
@@ -785,77 +899,1476 @@ cleanup_ext_session_lock_manager(
 }
 
 static void
-cleanup_x11_connection(xcb_connection_t **x11)
+cleanup_wp_viewporter(struct wp_viewporter **viewporter)
+{
+  if (*viewporter != NULL) {
+    wp_viewporter_destroy(*viewporter);
+    *viewporter = NULL;
+  }
+}
+
+static void
+cleanup_wp_single_pixel_buffer_manager(
+    struct wp_single_pixel_buffer_manager_v1 **single_pixel_buffer_manager)
+{
+  if (*single_pixel_buffer_manager != NULL) {
+    wp_single_pixel_buffer_manager_v1_destroy(*single_pixel_buffer_manager);
+    *single_pixel_buffer_manager = NULL;
+  }
+}
+
+static void
+cleanup_x11_connection(xcb_connection_t **x11)
+{
+  int error = 0;
+
+  if (*x11 != NULL) {
+    xcb_disconnect(*x11);
+    *x11 = NULL;
+  }
+}
+
+static void
+cleanup_fd(int *fd)
+{
+  int error = 0;
+
+  if (*fd >= 0) {
+    error = close(*fd);
+    if (error != 0) {
+      perror("close");
+    }
+    *fd = -1;
+  }
+}
+
+/* only the array, the strings are environ's or on the stack */
+static void
+cleanup_envp(char ***envp)
+{
+  free(*envp);
+  *envp = NULL;
+}
+
+static void
+cleanup_captures(struct captures *captures)
+{
+  /* TODO-OUTPUT */
+  for (size_t i = 0; i < COUNTOF(captures->captures); i++) {
+    cleanup_capture(&captures->captures[i]);
+  }
+}
+
+static void
+cleanup_copy_engine(bool *started)
+{
+  if (*started) {
+    copy_stop();
+    *started = false;
+  }
+}
+
+static void
+cleanup_auth(bool *started)
+{
+  if (*started) {
+    auth_stop();
+    *started = false;
+  }
+}
+
+static void
+cleanup_input(bool *started)
+{
+  if (*started) {
+    input_stop();
+    *started = false;
+  }
+}
+
+static void
+cleanup_trace(bool *opened)
+{
+  if (*opened) {
+    trace_close();
+    *opened = false;
+  }
+}
+
+static void
+cleanup_debug_log(bool *started)
+{
+  if (*started) {
+    debug_log_stop();
+    *started = false;
+  }
+}
+
+/*
+ * a capture as big as the output it's shown on first, at its scale. outputs
+ * bigger than frame_size_max, or whose buffers take more than the whole
+ * budget, or that don't say, get width by height frames instead, the
+ * compositor scales those.
+ */
+static void
+size_capture(
+    const struct shm_arena *shm_arena,
+    const struct output *output,
+    int32_t format,
+    struct capture *capture)
+{
+  const struct output_info *info = &output->info;
+  int32_t capture_width = 0;
+  int32_t capture_height = 0;
+  output_size(info, &capture_width, &capture_height);
+  int32_t scale = info->scale > 0 ? info->scale : 1;
+
+  bool fits = capture_width > 0 && capture_height > 0 &&
+              capture_width <= frame_size_max &&
+              capture_height <= frame_size_max;
+  if (fits) {
+    layout_init(
+        &capture->layout,
+        info->transform,
+        format,
+        capture_width,
+        capture_height);
+    fits = frame_len(shm_arena, &capture->layout) <=
+           shm_arena->frames_budget / buffers_max;
+  }
+  if (!fits) {
+    layout_init(&capture->layout, info->transform, format, width, height);
+    scale = 1;
+  }
+
+  /* the surface has to be a whole number of points */
+  if (capture->layout.capture_width % scale != 0 ||
+      capture->layout.capture_height % scale != 0) {
+    scale = 1;
+  }
+  capture->buffer_scale = scale;
+  capture->layout_output = output->name;
+  capture->layout_updates = info->updates;
+}
+
+static int
+mkdir_exist_ok(const char *path)
+{
+  int error = 0;
+
+  error = mkdir(path, S_IRWXU);
+  if (error != 0 && errno != EEXIST) {
+    perror("mkdir");
+    return -1;
+  }
+
+  return 0;
+}
+
+/* output names are arbitrary strings, keep them to a safe file name */
+static void
+safe_file_name(char *name, size_t name_len, const char *from)
+{
+  size_t i = 0;
+  for (; i < name_len - 1 && from[i] != '\0'; i++) {
+    char c = from[i];
+    bool safe = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                (c >= '0' && c <= '9') || c == '-' || c == '.';
+    name[i] = safe ? c : '_';
+  }
+  name[i] = '\0';
+}
+
+/*
+ * the cache outlives a lock, so it goes to disk rather than XDG_RUNTIME_DIR.
+ * it's kept per monitor and mode. identical monitors only differ in where
+ * they're plugged in, the connector since wl_output v4 or else where they are
+ * in the layout.
+ */
+static int
+frame_cache_path(
+    const struct output_info *info,
+    bool create_dir,
+    char (*path)[PATH_MAX])
+{
+  int error = 0;
+  int len = 0;
+
+  const char *cache_home = getenv(cache_env);
+  if (cache_home != NULL && cache_home[0] != '\0') {
+    len = snprintf(*path, COUNTOF(*path), "%s", cache_home);
+  } else {
+    const char *home = getenv("HOME");
+    if (home == NULL || home[0] == '\0') {
+      fputs("frame_cache_path: No cache directory\n", stderr);
+      return -1;
+    }
+    len = snprintf(*path, COUNTOF(*path), "%s/.cache", home);
+  }
+  if (len < 0 || (size_t)len >= COUNTOF(*path)) {
+    fputs("frame_cache_path: Path too long\n", stderr);
+    return -1;
+  }
+
+  if (create_dir) {
+    error = mkdir_exist_ok(*path);
+    if (error != 0) {
+      return -1;
+    }
+  }
+
+  len += snprintf(&(*path)[len], COUNTOF(*path) - len, "/%s", cache_dir);
+  if ((size_t)len >= COUNTOF(*path)) {
+    fputs("frame_cache_path: Path too long\n", stderr);
+    return -1;
+  }
+
+  if (create_dir) {
+    error = mkdir_exist_ok(*path);
+    if (error != 0) {
+      return -1;
+    }
+  }
+
+  char name[COUNTOF(info->name)] = { 0 };
+  safe_file_name(name, COUNTOF(name), info->name);
+  char position[32] = { 0 };
+  snprintf(
+      position,
+      COUNTOF(position),
+      "%" PRId32 "_%" PRId32,
+      info->x,
+      info->y);
+  char connector[COUNTOF(info->connector)] = { 0 };
+  safe_file_name(
+      connector,
+      COUNTOF(connector),
+      info->connector[0] != '\0' ? info->connector : position);
+
+  len += snprintf(
+      &(*path)[len],
+      COUNTOF(*path) - len,
+      "/%s-%s-%" PRId32 "x%" PRId32 ".frame",
+      name,
+      connector,
+      info->width,
+      info->height);
+  if ((size_t)len >= COUNTOF(*path)) {
+    fputs("frame_cache_path: Path too long\n", stderr);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* returns 1 if the frame was filled from the cache, 0 if there was nothing */
+static int
+load_frame_cache(
+    const struct output_info *info,
+    const struct layout *layout,
+    uint8_t *frame,
+    size_t frame_len)
+{
+  int error = 0;
+
+  char path[PATH_MAX] = { 0 };
+  error = frame_cache_path(info, false, &path);
+  if (error != 0) {
+    return -1;
+  }
+
+  CLEANUP(fd) int fd = -1;
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    if (errno != ENOENT) {
+      perror("open");
+      return -1;
+    }
+    return 0;
+  }
+
+  struct stat cache_stat = { 0 };
+  error = fstat(fd, &cache_stat);
+  if (error != 0) {
+    perror("fstat");
+    return -1;
+  }
+
+  size_t cache_len = sizeof(struct frame_cache_header) + frame_len;
+  if (cache_stat.st_size < 0 || (size_t)cache_stat.st_size != cache_len) {
+    fputs("load_frame_cache: Size mismatch\n", stderr);
+    return 0;
+  }
+
+  CLEANUP(shm_region)
+  struct shm_region cache_region = {
+    .addr = MAP_FAILED,
+    .len = 0,
+  };
+  cache_region.addr = mmap(
+      /*   addr */ NULL,
+      /* length */ cache_len,
+      /*   prot */ PROT_READ,
+      /*  flags */ MAP_PRIVATE,
+      /*     fd */ fd,
+      /* offset */ 0);
+  if (cache_region.addr == MAP_FAILED) {
+    perror("mmap");
+    return -1;
+  }
+  cache_region.len = cache_len;
+
+  const struct frame_cache_header *header = cache_region.addr;
+  if (memcmp(header->magic, frame_cache_magic, sizeof header->magic) != 0 ||
+      header->width != (uint32_t)layout->width ||
+      header->height != (uint32_t)layout->height ||
+      header->stride != layout->stride ||
+      header->format != shm_format(layout) ||
+      header->transform != (uint32_t)layout->transform) {
+    fputs("load_frame_cache: Format mismatch\n", stderr);
+    return 0;
+  }
+
+  memcpy(frame, &header[1], frame_len);
+  return 1;
+}
+
+/* nothing captured yet, start from what the last lock ended with. the render
+ * thread shows the first buffer until it has a frame of its own */
+static void
+load_first_frame(const struct output_info *info, struct capture *capture)
+{
+  if (info->width > 0) {
+    load_frame_cache(
+        info,
+        &capture->layout,
+        capture->buffers[0].mem,
+        capture->layout.size);
+  }
+}
+
+static int
+write_all(int fd, const void *data, size_t len)
+{
+  const uint8_t *data_bytes = data;
+
+  while (len > 0) {
+    ssize_t written = write(fd, data_bytes, len);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written < 0) {
+      perror("write");
+      return -1;
+    }
+    data_bytes += written;
+    len -= written;
+  }
+
+  return 0;
+}
+
+/* the rename of a file in it, made to last */
+static int
+sync_parent_dir(const char *path)
+{
+  int error = 0;
+
+  char dir_path[PATH_MAX] = { 0 };
+  const char *slash = strrchr(path, '/');
+  if (slash == NULL) {
+    return 0;
+  }
+  memcpy(dir_path, path, slash - path);
+
+  CLEANUP(fd)
+  int dir_fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0) {
+    perror("open");
+    return -1;
+  }
+
+  error = fsync(dir_fd);
+  if (error != 0) {
+    perror("fsync");
+    return -1;
+  }
+
+  return 0;
+}
+
+/* write to a temporary file and rename over, so a crash can't leave half a
+ * frame for the next lock to show. the file is synced before the rename, or
+ * the rename could reach the disk before the data does */
+static int
+save_frame_cache(
+    const struct output_info *info,
+    const struct layout *layout,
+    const uint8_t *frame,
+    size_t frame_len)
+{
+  int error = 0;
+
+  char path[PATH_MAX] = { 0 };
+  error = frame_cache_path(info, true, &path);
+  if (error != 0) {
+    return -1;
+  }
+
+  char temp_path[PATH_MAX] = { 0 };
+  int len = snprintf(
+      temp_path,
+      COUNTOF(temp_path),
+      "%s.%ld",
+      path,
+      (long)getpid());
+  if (len < 0 || (size_t)len >= COUNTOF(temp_path)) {
+    fputs("save_frame_cache: Path too long\n", stderr);
+    return -1;
+  }
+
+  CLEANUP(fd) int fd = -1;
+  fd = open(
+      temp_path,
+      O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+      S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    perror("open");
+    return -1;
+  }
+
+  struct frame_cache_header header = {
+    .width = layout->width,
+    .height = layout->height,
+    .stride = layout->stride,
+    .format = shm_format(layout),
+    .transform = layout->transform,
+  };
+  memcpy(header.magic, frame_cache_magic, sizeof header.magic);
+
+  error = write_all(fd, &header, sizeof header);
+  if (error == 0) {
+    error = write_all(fd, frame, frame_len);
+  }
+  if (error == 0) {
+    error = fsync(fd);
+    if (error != 0) {
+      perror("fsync");
+    }
+  }
+  if (error == 0) {
+    error = rename(temp_path, path);
+    if (error != 0) {
+      perror("rename");
+    }
+  }
+  if (error != 0) {
+    unlink(temp_path);
+    return -1;
+  }
+
+  return sync_parent_dir(path);
+}
+
+/*
+ * new objects are put on the queue of the object that created them, create the
+ * surface through wrappers so it's on the render thread's queue right away.
+ * moving it there afterwards would race with that thread reading events.
+ */
+static int
+create_output_surface(
+    struct wl_compositor *compositor,
+    struct xdg_wm_base *wm_base,
+    struct wl_event_queue *queue,
+    struct output *output)
+{
+  int error = 0;
+
+  struct wl_compositor *compositor_wrapper =
+      wl_proxy_create_wrapper(compositor);
+  if (compositor_wrapper == NULL) {
+    perror("wl_proxy_create_wrapper");
+    return -1;
+  }
+  wl_proxy_set_queue((struct wl_proxy *)compositor_wrapper, queue);
+  output->surface = wl_compositor_create_surface(compositor_wrapper);
+  wl_proxy_wrapper_destroy(compositor_wrapper);
+  if (output->surface == NULL) {
+    perror("wl_compositor_create_surface");
+    return -1;
+  }
+
+  struct xdg_wm_base *wm_base_wrapper = wl_proxy_create_wrapper(wm_base);
+  if (wm_base_wrapper == NULL) {
+    perror("wl_proxy_create_wrapper");
+    return -1;
+  }
+  wl_proxy_set_queue((struct wl_proxy *)wm_base_wrapper, queue);
+  output->xdg_surface =
+      xdg_wm_base_get_xdg_surface(wm_base_wrapper, output->surface);
+  wl_proxy_wrapper_destroy(wm_base_wrapper);
+  if (output->xdg_surface == NULL) {
+    perror("xdg_wm_base_get_xdg_surface");
+    return -1;
+  }
+
+  error = xdg_surface_add_listener(
+      output->xdg_surface,
+      &xdg_surface_listener,
+      output);
+  if (error != 0) {
+    fputs("xdg_surface_add_listener: listener already set\n", stderr);
+    return -1;
+  }
+
+  output->toplevel = xdg_surface_get_toplevel(output->xdg_surface);
+  if (output->toplevel == NULL) {
+    perror("xdg_surface_get_toplevel");
+    return -1;
+  }
+
+  xdg_toplevel_set_app_id(output->toplevel, app_id);
+  xdg_toplevel_set_fullscreen(output->toplevel, output->output);
+
+  /* commit the unattached surface to prompt the server to configure it */
+  wl_surface_commit(output->surface);
+
+  return 0;
+}
+
+/* black, as a single pixel buffer or a pixel of the pool. every surface
+ * shows the first of its wl_buffers */
+static int
+create_blank_buffer(
+    struct wp_single_pixel_buffer_manager_v1 *single_pixel_buffer_manager,
+    struct wl_shm_pool *shm_pool,
+    struct shm_arena *shm_arena,
+    struct capture *capture)
+{
+  int error = 0;
+  struct buffer *blank = &capture->blank;
+
+  if (single_pixel_buffer_manager != NULL) {
+    blank->buffers[0] =
+        wp_single_pixel_buffer_manager_v1_create_u32_rgba_buffer(
+            single_pixel_buffer_manager,
+            0,
+            0,
+            0,
+            UINT32_MAX);
+    if (blank->buffers[0] == NULL) {
+      perror("wp_single_pixel_buffer_manager_v1_create_u32_rgba_buffer");
+      return -1;
+    }
+    return 0;
+  }
+
+  if (shm_pool == NULL) {
+    return 0;
+  }
+
+  error = alloc_shm(shm_arena, shm_pool, sizeof(uint32_t), &blank->offset);
+  if (error != 0) {
+    return -1;
+  }
+  blank->mem = (uint8_t *)shm_arena->region.addr + blank->offset;
+  memset(blank->mem, 0, sizeof(uint32_t));
+
+  blank->buffers[0] = wl_shm_pool_create_buffer(
+      /* wl_shm_pool */ shm_pool,
+      /*      offset */ blank->offset,
+      /*       width */ 1,
+      /*      height */ 1,
+      /*      stride */ sizeof(uint32_t),
+      /*      format */ WL_SHM_FORMAT_XRGB8888);
+  if (blank->buffers[0] == NULL) {
+    perror("wl_shm_pool_create_buffer");
+    return -1;
+  }
+
+  return 0;
+}
+
+static int
+create_viewport(struct wp_viewporter *viewporter, struct output *output)
+{
+  output->viewport = wp_viewporter_get_viewport(viewporter, output->surface);
+  if (output->viewport == NULL) {
+    perror("wp_viewporter_get_viewport");
+    return -1;
+  }
+
+  return 0;
+}
+
+static void
+cleanup_x11_present_query_version_reply(
+    xcb_present_query_version_reply_t **query_version_reply)
+{
+  if (*query_version_reply != NULL) {
+    free(*query_version_reply);
+    *query_version_reply = NULL;
+  }
+}
+
+/*
+ * the major opcode of the Present extension, which tells us when a hack has
+ * drawn a frame (GL hacks present with every swap), or 0 if the server doesn't
+ * have it.
+ */
+static uint8_t
+find_present(xcb_connection_t *x11)
+{
+  const xcb_query_extension_reply_t *extension =
+      xcb_get_extension_data(x11, &xcb_present_id);
+  if (extension == NULL || !extension->present) {
+    fputs("xcb_get_extension_data: No Present extension\n", stderr);
+    return 0;
+  }
+
+  /* SelectInput is in 1.0 already, but the version has to be negotiated */
+  CLEANUP(x11_present_query_version_reply)
+  xcb_present_query_version_reply_t *query_version_reply = NULL;
+  query_version_reply = xcb_present_query_version_reply(
+      x11,
+      xcb_present_query_version(x11, 1, 0),
+      NULL);
+  if (query_version_reply == NULL) {
+    fputs("xcb_present_query_version_reply: Failed\n", stderr);
+    return 0;
+  }
+  fprintf(
+      stderr,
+      "xcb_present_query_version: %" PRIu32 ".%" PRIu32 "\n",
+      query_version_reply->major_version,
+      query_version_reply->minor_version);
+
+  return extension->major_opcode;
+}
+
+static void
+cleanup_x11_shm_query_version_reply(
+    xcb_shm_query_version_reply_t **query_version_reply)
+{
+  if (*query_version_reply != NULL) {
+    free(*query_version_reply);
+    *query_version_reply = NULL;
+  }
+}
+
+/*
+ * whether the server has MIT-SHM 1.2, which takes the memory to share as an
+ * fd. the strips of the captures are put straight into it then, see
+ * share_strips.
+ */
+static bool
+find_shm(xcb_connection_t *x11)
+{
+  const xcb_query_extension_reply_t *extension =
+      xcb_get_extension_data(x11, &xcb_shm_id);
+  if (extension == NULL || !extension->present) {
+    fputs("xcb_get_extension_data: No MIT-SHM extension\n", stderr);
+    return false;
+  }
+
+  CLEANUP(x11_shm_query_version_reply)
+  xcb_shm_query_version_reply_t *query_version_reply = NULL;
+  query_version_reply =
+      xcb_shm_query_version_reply(x11, xcb_shm_query_version(x11), NULL);
+  if (query_version_reply == NULL) {
+    fputs("xcb_shm_query_version_reply: Failed\n", stderr);
+    return false;
+  }
+  fprintf(
+      stderr,
+      "xcb_shm_query_version: %" PRIu16 ".%" PRIu16 "\n",
+      query_version_reply->major_version,
+      query_version_reply->minor_version);
+
+  return query_version_reply->major_version > 1 ||
+         (query_version_reply->major_version == 1 &&
+          query_version_reply->minor_version >= 2);
+}
+
+/*
+ * without MIT-SHM, xcb mallocs every GetImage reply, up to strip_size_max
+ * each, and they're freed again as soon as they're copied. left to itself
+ * glibc serves the first of them with fresh mmaps, and later gives the heap
+ * back to the kernel when enough of its top is free, so the next frame faults
+ * it all in again. keep the strips in the heap and the heap around, so the
+ * steady state reuses the same pages. fixing both also turns off glibc's
+ * dynamic adjustment of them.
+ */
+static void
+tune_malloc(void)
+{
+#ifdef M_MMAP_THRESHOLD
+  int done = mallopt(M_MMAP_THRESHOLD, strip_size_max * 2);
+  if (done != 0) {
+    /* every capture has its strips in flight, in the arena of its thread */
+    done = mallopt(M_TRIM_THRESHOLD, strip_size_max * strips_in_flight * 4);
+  }
+  if (done == 0) {
+    fputs("mallopt: Failed\n", stderr);
+  }
+#endif
+}
+
+static uint64_t
+monotonic_ns(void)
+{
+  struct timespec now = { 0 };
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* a window for a hack to draw into, never seen as such, only captured */
+static int
+create_hack_window(
+    xcb_connection_t *x11,
+    xcb_window_t root,
+    uint8_t present_opcode,
+    const struct layout *layout,
+    xcb_window_t *window)
+{
+  *window = xcb_generate_id(x11);
+  fprintf(stderr, "xcb_generate_id: %#" PRIx32 "\n", *window);
+  if (*window == (xcb_window_t)-1) {
+    *window = 0;
+    return -1;
+  }
+
+  /* these requests error asynchronously, and are handled in the event loop */
+  xcb_create_window(
+      /*            c */ x11,
+      /*        depth */ XCB_COPY_FROM_PARENT,
+      /*          wid */ *window,
+      /*       parent */ root,
+      /*            x */ 0,
+      /*            y */ 0,
+      /*        width */ layout->capture_width,
+      /*       height */ layout->capture_height,
+      /* border_width */ 0,
+      /*       _class */ XCB_WINDOW_CLASS_INPUT_OUTPUT,
+      /*       visual */ XCB_COPY_FROM_PARENT,
+      /*   value_mask */ 0,
+      /*   value_list */ NULL);
+
+  /* TODO: intern_atom for UTF8_STRING or COMPOUND_TEXT (requires an extra round
+   * trip) */
+  xcb_change_property(
+      /*        c */ x11,
+      /*     mode */ XCB_PROP_MODE_REPLACE,
+      /*   window */ *window,
+      /* property */ XCB_ATOM_WM_CLASS,
+      /*     type */ XCB_ATOM_STRING, /* NB: this means latin-1 */
+      /*   format */ 8,
+      /* data_len */ COUNTOF(instance_class), /* include terminating nul byte */
+      /*     data */ instance_class);
+
+  xcb_map_window(x11, *window);
+
+  /* every frame the hack presents is a frame worth capturing. the eid only
+   * names the selection, which goes away with the window */
+  if (present_opcode != 0) {
+    xcb_present_select_input(
+        /*          c */ x11,
+        /*        eid */ xcb_generate_id(x11),
+        /*     window */ *window,
+        /* event_mask */ XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY);
+  }
+
+  return 0;
+}
+
+static int
+spawn_hack(const char *screensaver_path, xcb_window_t window, pid_t *pid)
+{
+  int error = 0;
+
+  /* the name and "=", * 2 for nybbles (halves of bytes), + 3 for "0x" and
+   * NUL terminator */
+  char window_env[sizeof hack_window_env + sizeof window * 2 + 3] = { 0 };
+  snprintf(
+      window_env,
+      COUNTOF(window_env),
+      "%s=%#" PRIx32,
+      hack_window_env,
+      window);
+
+  /* a copy of environ with the window in place of ours, if we have one.
+   * setenv isn't safe while other threads run */
+  size_t environ_num = 0;
+  while (environ[environ_num] != NULL) {
+    environ_num++;
+  }
+  CLEANUP(envp) char **envp = calloc(environ_num + 2, sizeof *envp);
+  if (envp == NULL) {
+    perror("calloc");
+    return -1;
+  }
+  size_t envp_num = 0;
+  size_t name_len = COUNTOF(hack_window_env) - 1;
+  for (size_t i = 0; i < environ_num; i++) {
+    if (strncmp(environ[i], hack_window_env, name_len) != 0 ||
+        environ[i][name_len] != '=') {
+      envp[envp_num++] = environ[i];
+    }
+  }
+  envp[envp_num] = window_env;
+
+  /*
+   * wl and x11 sockets are cloexec, no need to close explicitly.
+   *
+   * argv is specified to not be modified by posix_spawn (described in the
+   * manual for the exec family of functions, explained under Rationale) so the
+   * const-discarding cast is safe in theory.
+   */
+  const char *const screensaver_argv[] = { screensaver_path, "--root", NULL };
+
+  /* we block the signals signal_fd takes, the hack shouldn't inherit that */
+  posix_spawnattr_t attr;
+  error = posix_spawnattr_init(&attr);
+  if (error != 0) {
+    errno = error;
+    perror("posix_spawnattr_init");
+    return -1;
+  }
+  sigset_t no_signals;
+  sigemptyset(&no_signals);
+  posix_spawnattr_setsigmask(&attr, &no_signals);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+  error = posix_spawn(
+      /*          pid */ pid,
+      /*         path */ screensaver_path,
+      /* file_actions */ NULL,
+      /*        attrp */ &attr,
+      /*         argv */ (char *const *)screensaver_argv,
+      /*         envp */ envp);
+  posix_spawnattr_destroy(&attr);
+  if (error != 0) {
+    errno = error;
+    perror("posix_spawn");
+    *pid = 0;
+    return -1;
+  }
+  fprintf(stderr, "screensaver_pid: %ld\n", (long)*pid);
+
+  return 0;
+}
+
+/* wakes the event loop as soon as the hack exits. without pidfds (before
+ * linux 5.3) the watchdog notices on its next tick instead */
+static int
+open_pidfd(pid_t pid)
+{
+  int pidfd = -1;
+#ifdef SYS_pidfd_open
+  pidfd = syscall(SYS_pidfd_open, pid, 0);
+  if (pidfd < 0 && debug) {
+    perror("pidfd_open");
+  }
+#else
+  (void)pid;
+#endif
+  return pidfd;
+}
+
+/* the hack of a capture has a fresh start, as far as its watchers know */
+static void
+reset_screensaver(struct capture *capture)
+{
+  capture->pidfd = open_pidfd(capture->screensaver_pid);
+  capture->spawned_ns = monotonic_ns();
+  capture->hack_cpu = 0;
+  capture->progress_ns = capture->spawned_ns;
+  capture->hack_niced = false;
+  __atomic_add_fetch(&capture->hack_generation, 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&capture->hack_state, hack_running, __ATOMIC_RELEASE);
+}
+
+/* starts the hack of a capture, again if it has to, into the same window */
+static int
+spawn_screensaver(const char *screensaver_path, struct capture *capture)
+{
+  int error = 0;
+
+  error = spawn_hack(
+      screensaver_path,
+      capture->window,
+      &capture->screensaver_pid);
+  if (error != 0) {
+    return -1;
+  }
+
+  reset_screensaver(capture);
+  return 0;
+}
+
+static int
+start_capture(
+    xcb_connection_t *x11,
+    xcb_window_t root,
+    uint8_t present_opcode,
+    const char *screensaver_path,
+    struct capture *capture)
+{
+  int error = 0;
+
+  capture->present_fd = -1;
+  capture->pidfd = -1;
+  capture->cycled_ns = monotonic_ns();
+
+  if (present_opcode != 0) {
+    capture->present_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (capture->present_fd < 0) {
+      perror("eventfd");
+      return -1;
+    }
+  }
+
+  error = create_hack_window(
+      x11,
+      root,
+      present_opcode,
+      &capture->layout,
+      &capture->window);
+  if (error != 0) {
+    return -1;
+  }
+
+  return spawn_screensaver(screensaver_path, capture);
+}
+
+static void
+cleanup_render_context(struct render_context *context)
+{
+  if (context->stop_fd < 0) {
+    return;
+  }
+
+  /* TODO-OUTPUT */
+  for (size_t i = 0; i < COUNTOF(context->captures->captures); i++) {
+    stop_render_thread(&context->captures->captures[i]);
+  }
+
+  cleanup_fd(&context->stop_fd);
+}
+
+/*
+ * a capture that has buffers, for an output the budget had no room left for.
+ * there always is one, as the budget fits at least one capture.
+ */
+static struct capture *
+share_capture(struct captures *captures)
+{
+  /* TODO-OUTPUT */
+  for (size_t i = 0; i < COUNTOF(captures->captures); i++) {
+    struct capture *capture = &captures->captures[i];
+    if (capture->queue != NULL && capture->buffers_num > 0) {
+      return capture;
+    }
+  }
+  return NULL;
+}
+
+/* the render thread of the capture must be stopped */
+static void
+attach_output(struct capture *capture, struct output *output)
+{
+  for (size_t i = 0; i < COUNTOF(capture->outputs); i++) {
+    if (capture->outputs[i] == NULL) {
+      capture->outputs[i] = output;
+      break;
+    }
+  }
+  output->capture = capture;
+}
+
+/* the user and system time of a process so far, in clock ticks. 0 if it
+ * can't be read */
+static uint64_t
+hack_cpu_ticks(pid_t pid)
+{
+  char path[32] = { 0 };
+  snprintf(path, sizeof path, "/proc/%ld/stat", (long)pid);
+  FILE *stat = fopen(path, "r");
+  if (stat == NULL) {
+    return 0;
+  }
+  char line[1024] = { 0 };
+  char *got = fgets(line, sizeof line, stat);
+  fclose(stat);
+  if (got == NULL) {
+    return 0;
+  }
+
+  /* the name in parentheses can hold anything, the fields start after it */
+  const char *fields = strrchr(line, ')');
+  if (fields == NULL) {
+    return 0;
+  }
+  unsigned long utime = 0;
+  unsigned long stime = 0;
+  int matched = sscanf(
+      fields + 1,
+      " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+      &utime,
+      &stime);
+  if (matched != 2) {
+    return 0;
+  }
+  return (uint64_t)utime + stime;
+}
+
+static uint64_t
+screensaver_backoff_ns(const struct capture *capture)
+{
+  uint64_t backoff_s = (uint64_t)hack_backoff_min_s
+                       << capture->restarts_in_a_row;
+  if (backoff_s > hack_backoff_max_s) {
+    backoff_s = hack_backoff_max_s;
+  }
+  return backoff_s * 1000000000;
+}
+
+/*
+ * the event loop's side of the hack of a capture, when its pidfd or the
+ * watchdog timer wakes it. the render thread stops capturing while the hack
+ * is down, and shows the fallback once it failed.
+ */
+static void
+watch_screensaver(
+    const struct hacks *hacks,
+    size_t capture_n,
+    struct capture *capture)
+{
+  int error = 0;
+  uint64_t now = monotonic_ns();
+
+  if (__atomic_load_n(&capture->hack_retire, __ATOMIC_ACQUIRE)) {
+    cleanup_screensaver(&capture->screensaver_pid);
+    cleanup_fd(&capture->pidfd);
+    return;
+  }
+
+  int hack_state = __atomic_load_n(&capture->hack_state, __ATOMIC_RELAXED);
+  if (hack_state == hack_failed) {
+    return;
+  }
+
+  if (capture->screensaver_pid > 0 &&
+      reap_screensaver(&capture->screensaver_pid)) {
+    cleanup_fd(&capture->pidfd);
+    /* a hack that hung early isn't healthy, however long it took to notice */
+    if (capture->progress_ns - capture->spawned_ns >
+        (uint64_t)hack_healthy_s * 1000000000) {
+      capture->restarts_in_a_row = 0;
+    }
+
+    if (capture->restarts_in_a_row >= hack_restarts_max) {
+      fprintf(stderr, "watch_screensaver: Capture %zu failed\n", capture_n);
+      trace_instant("hack failed", capture->trace_track, 0);
+      __atomic_store_n(&capture->hack_state, hack_failed, __ATOMIC_RELEASE);
+      return;
+    }
+
+    capture->restart_ns = now + screensaver_backoff_ns(capture);
+    __atomic_store_n(&capture->hack_state, hack_restarting, __ATOMIC_RELEASE);
+    return;
+  }
+
+  /*
+   * a hung hack leaves the window as it was. so does one that draws a still
+   * picture, and nothing is fetched while its outputs are off or covered, but
+   * those still use the cpu.
+   */
+  if (capture->screensaver_pid > 0) {
+    uint64_t cpu = hack_cpu_ticks(capture->screensaver_pid);
+    if (cpu != capture->hack_cpu) {
+      capture->hack_cpu = cpu;
+      capture->progress_ns = now;
+    }
+    uint64_t active_ns =
+        __atomic_load_n(&capture->active_ns, __ATOMIC_RELAXED);
+    if (active_ns > capture->progress_ns) {
+      capture->progress_ns = active_ns;
+    }
+    if (capture->thread_started &&
+        now - capture->progress_ns > (uint64_t)hack_stall_s * 1000000000) {
+      capture->stalls += 1;
+      fprintf(stderr, "watch_screensaver: Capture %zu stalled\n", capture_n);
+      trace_instant("hack stall", capture->trace_track, capture->stalls);
+      /* reaped and restarted once the pidfd or the next tick says it's gone */
+      error = kill(capture->screensaver_pid, SIGKILL);
+      if (error != 0) {
+        perror("kill");
+      }
+    }
+    return;
+  }
+
+  if (hack_state == hack_restarting && now >= capture->restart_ns) {
+    capture->restarts += 1;
+    capture->restarts_in_a_row += 1;
+    fprintf(stderr, "watch_screensaver: Restarting capture %zu\n", capture_n);
+    trace_instant("hack restart", capture->trace_track, capture->restarts);
+    error = spawn_screensaver(hacks->paths[capture->hack_n], capture);
+    if (error != 0) {
+      capture->restart_ns = now + screensaver_backoff_ns(capture);
+    }
+  }
+}
+
+/*
+ * leaves the hack less of the cpu while its capture is struggling, on the
+ * watchdog tick. putting it back needs CAP_SYS_NICE (or RLIMIT_NICE), without
+ * it the hack stays niced until it's restarted or cycled.
+ */
+static void
+throttle_screensaver(size_t capture_n, struct capture *capture)
+{
+  int error = 0;
+
+  int level = __atomic_load_n(&capture->quality_level, __ATOMIC_RELAXED);
+  bool niced = level >= quality_hack_niced;
+  if (capture->screensaver_pid <= 0 || niced == capture->hack_niced) {
+    return;
+  }
+
+  error = setpriority(
+      PRIO_PROCESS,
+      capture->screensaver_pid,
+      niced ? hack_nice : 0);
+  if (error != 0) {
+    if (errno != EACCES) {
+      perror("setpriority");
+    }
+    return;
+  }
+  fprintf(
+      stderr,
+      "throttle_screensaver: Capture %zu hack %s\n",
+      capture_n,
+      niced ? "niced" : "back to normal");
+  capture->hack_niced = niced;
+}
+
+/* the next hack takes over the capture, and the last one goes */
+static void
+swap_screensaver(xcb_connection_t *x11, struct capture *capture)
 {
-  int error = 0;
-
-  if (*x11 != NULL) {
-    xcb_disconnect(*x11);
-    *x11 = NULL;
+  bool thread_started = capture->thread_started;
+  stop_render_thread(capture);
+  discard_strips(x11, capture);
+
+  cleanup_screensaver(&capture->screensaver_pid);
+  cleanup_fd(&capture->pidfd);
+  xcb_destroy_window(x11, capture->window);
+
+  capture->window = capture->next_window;
+  capture->screensaver_pid = capture->next_pid;
+  capture->hack_n = capture->next_hack_n;
+  capture->next_window = 0;
+  capture->next_pid = 0;
+  capture->next_presented = false;
+  capture->cycled_ns = monotonic_ns();
+  capture->restarts_in_a_row = 0;
+  reset_screensaver(capture);
+
+  /* the buffers keep the last frame of the old hack until the new one's
+   * first frame replaces it */
+  if (thread_started) {
+    start_render_thread(capture);
   }
 }
 
+/*
+ * moves a capture on to the next of the hacks when it's due, called on the
+ * watchdog tick. only the two hacks run at once, and only for about
+ * cycle_lead_s.
+ */
 static void
-cleanup_screensaver(pid_t *screensaver_pid)
+cycle_screensaver(
+    xcb_connection_t *x11,
+    xcb_window_t root,
+    uint8_t present_opcode,
+    const struct hacks *hacks,
+    size_t capture_n,
+    struct capture *capture)
 {
   int error = 0;
 
-  if (*screensaver_pid <= 0) {
+  if (hacks->num < 2 || hacks->cycle_ns == 0 ||
+      __atomic_load_n(&capture->hack_retire, __ATOMIC_ACQUIRE)) {
     return;
   }
 
-  error = kill(*screensaver_pid, SIGTERM);
-  /* zombie processes count as existing, no need to exempt ESRCH */
-  if (error != 0) {
-    perror("kill");
+  uint64_t now = monotonic_ns();
+  uint64_t due = capture->cycled_ns + hacks->cycle_ns;
+
+  if (capture->next_window == 0) {
+    if (now + (uint64_t)cycle_lead_s * 1000000000 < due) {
+      return;
+    }
+
+    capture->next_hack_n = (capture->next_hack_n + 1) % hacks->num;
+    if (capture->next_hack_n == capture->hack_n) {
+      capture->next_hack_n = (capture->next_hack_n + 1) % hacks->num;
+    }
+    fprintf(
+        stderr,
+        "cycle_screensaver: Capture %zu starting %s\n",
+        capture_n,
+        hacks->paths[capture->next_hack_n]);
+
+    error = create_hack_window(
+        x11,
+        root,
+        present_opcode,
+        &capture->layout,
+        &capture->next_window);
+    if (error == 0) {
+      error = spawn_hack(
+          hacks->paths[capture->next_hack_n],
+          capture->next_window,
+          &capture->next_pid);
+    }
+    if (error != 0 && capture->next_window != 0) {
+      xcb_destroy_window(x11, capture->next_window);
+      capture->next_window = 0;
+    }
+    if (error != 0) {
+      /* try the one after it, next cycle */
+      capture->cycled_ns = now;
+      return;
+    }
+
+    capture->next_spawned_ns = now;
+    capture->next_presented = false;
     return;
   }
 
-  siginfo_t screensaver_info = { 0 };
-  error = waitid(P_PID, *screensaver_pid, &screensaver_info, WEXITED);
-  if (error != 0) {
-    perror("waitid");
+  if (reap_screensaver(&capture->next_pid)) {
+    fprintf(stderr, "cycle_screensaver: Capture %zu skipping it\n", capture_n);
+    xcb_destroy_window(x11, capture->next_window);
+    capture->next_window = 0;
+    capture->cycled_ns = now;
     return;
   }
 
-  psiginfo(&screensaver_info, NULL);
+  bool ready = capture->next_presented ||
+               now - capture->next_spawned_ns >=
+                   (uint64_t)cycle_settle_s * 1000000000;
+  if (now < due || !ready) {
+    return;
+  }
 
-  if (screensaver_info.si_code == CLD_EXITED) {
-    fprintf(stderr, "Child exited normally: %d\n", screensaver_info.si_status);
-  } else {
-    psignal(screensaver_info.si_status, "Child exited by an uncaught signal");
+  fprintf(stderr, "cycle_screensaver: Capture %zu switching\n", capture_n);
+  trace_instant("hack cycle", capture->trace_track, capture->next_hack_n);
+  swap_screensaver(x11, capture);
+}
+
+/*
+ * the output a capture is sized for changed its mode, transform or scale. the
+ * windows of its hacks are resized, and new buffers replace the old ones,
+ * which are retired until the compositor releases them. a replay is of the
+ * old layout, so a retired hack is brought back to record a new one. if the
+ * budget has no room for the new buffers, the capture stays as it was. the
+ * render thread has to be stopped, and nothing retired left.
+ */
+static int
+relayout_capture(
+    xcb_connection_t *x11,
+    struct wl_shm_pool *shm_pool,
+    struct shm_arena *shm_arena,
+    const struct output *output,
+    struct capture *capture)
+{
+  struct layout layout = capture->layout;
+  int32_t buffer_scale = capture->buffer_scale;
+  size_capture(shm_arena, output, layout.format, capture);
+  if (capture->layout.capture_width == layout.capture_width &&
+      capture->layout.capture_height == layout.capture_height &&
+      capture->layout.transform == layout.transform &&
+      capture->buffer_scale == buffer_scale) {
+    return 0;
+  }
+
+  fprintf(
+      stderr,
+      "relayout_capture: %s is %" PRId32 "x%" PRId32 " now\n",
+      output->info.name,
+      capture->layout.capture_width,
+      capture->layout.capture_height);
+
+  size_t len = frame_len(shm_arena, &capture->layout);
+  size_t buffers_num = reserve_frames(shm_arena, len);
+  if (buffers_num == 0) {
+    fputs("relayout_capture: No room, keeping the old size\n", stderr);
+    capture->layout = layout;
+    capture->buffer_scale = buffer_scale;
+    return 0;
+  }
+
+  discard_strips(x11, capture);
+  capture->retired_size = layout.size;
+  capture->retired_frame_len = capture->frame_len;
+  for (size_t i = 0; i < COUNTOF(capture->buffers); i++) {
+    struct buffer *retired = &capture->retired[i];
+    *retired = capture->buffers[i];
+    capture->buffers[i] = (struct buffer){ 0 };
+    if (retired->buffers[0] != NULL) {
+      /* the releases go to where it is now */
+      for (size_t j = 0; j < COUNTOF(retired->buffers); j++) {
+        wl_buffer_set_user_data(retired->buffers[j], retired);
+      }
+      capture->retired_num++;
+    }
+  }
+  free_retired_buffers(shm_arena, capture);
+  capture->frame_len = len;
+  capture->buffers_num = buffers_num;
+  capture->next_buffer = 0;
+  capture->shown = NULL;
+  capture->strip_height = 0;
+  capture->captured = false;
+  capture->fallback_shown = false;
+
+  for (size_t i = 0; i < COUNTOF(capture->outputs); i++) {
+    struct output *shown_on = capture->outputs[i];
+    if (shown_on != NULL) {
+      shown_on->mapped = false;
+      shown_on->committed_seq = 0;
+    }
+  }
+
+  uint32_t window_size[] = {
+    capture->layout.capture_width,
+    capture->layout.capture_height,
+  };
+  uint16_t window_mask = XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT;
+  xcb_configure_window(x11, capture->window, window_mask, window_size);
+  if (capture->next_window != 0) {
+    xcb_configure_window(x11, capture->next_window, window_mask, window_size);
   }
 
-  *screensaver_pid = 0;
+  /* watch_screensaver restarts it if it was stopped already */
+  if (capture->replay.playing) {
+    __atomic_store_n(&capture->hack_retire, false, __ATOMIC_RELEASE);
+  }
+  if (capture->replay.playing && capture->screensaver_pid == 0) {
+    capture->restart_ns = monotonic_ns();
+    __atomic_store_n(&capture->hack_state, hack_restarting, __ATOMIC_RELEASE);
+  }
+  uint64_t replay_ns = capture->replay.duration_ns;
+  replay_free(&capture->replay);
+  capture->replay.duration_ns = replay_ns;
+
+  int error = create_buffers(shm_pool, shm_arena, capture);
+  if (error != 0) {
+    return -1;
+  }
+  load_first_frame(&output->info, capture);
+
+  return 0;
 }
 
-static void
-cleanup_shm_fd(int *shm_fd)
+/*
+ * past the blanking timeout there's nothing left worth animating. the hack is
+ * stopped, the outputs show the blank buffer and stop asking for frames, and
+ * the frame buffers are given back as the compositor releases them. the
+ * render thread only maps the blank buffer onto outputs that show up later.
+ */
+static int
+blank_capture(
+    xcb_connection_t *x11,
+    struct wp_viewporter *viewporter,
+    struct wp_single_pixel_buffer_manager_v1 *single_pixel_buffer_manager,
+    struct wl_shm_pool *shm_pool,
+    struct shm_arena *shm_arena,
+    struct capture *capture)
 {
   int error = 0;
 
-  if (*shm_fd >= 0) {
-    error = close(*shm_fd);
+  stop_render_thread(capture);
+  discard_strips(x11, capture);
+  unshare_strips(x11, capture);
+  __atomic_store_n(&capture->hack_retire, true, __ATOMIC_RELEASE);
+  cleanup_screensaver(&capture->screensaver_pid);
+  cleanup_fd(&capture->pidfd);
+  cleanup_screensaver(&capture->next_pid);
+  if (capture->next_window != 0) {
+    xcb_destroy_window(x11, capture->next_window);
+    capture->next_window = 0;
+  }
+  replay_free(&capture->replay);
+
+  error = create_blank_buffer(
+      single_pixel_buffer_manager,
+      shm_pool,
+      shm_arena,
+      capture);
+  if (error != 0 || capture->blank.buffers[0] == NULL) {
+    return -1;
+  }
+  capture->blanked = true;
+
+  for (size_t i = 0; i < COUNTOF(capture->outputs); i++) {
+    struct output *output = capture->outputs[i];
+    if (output == NULL) {
+      continue;
+    }
+
+    /* the last frame still makes a better start next time than black */
+    if (capture->captured && output->info.width > 0) {
+      save_frame_cache(
+          &output->info,
+          &capture->layout,
+          capture->shown->mem,
+          capture->layout.size);
+    }
+
+    cleanup_wl_callback(&output->frame_callback);
+    error = create_viewport(viewporter, output);
     if (error != 0) {
-      perror("close");
+      return -1;
+    }
+    if (output->configured) {
+      present_blank(output);
     }
-    *shm_fd = -1;
   }
+  capture->captured = false;
+  capture->shown = NULL;
+
+  /* the rest go once the blank buffer replaced them, see the event loop */
+  free_released_buffers(shm_arena, capture);
+
+  return start_render_thread(capture);
 }
 
+/* remove_output, once the last frame of its capture is kept for when it's
+ * plugged back in */
 static void
-cleanup_shm_region(struct shm_region *shm_region)
+unplug_output(
+    xcb_connection_t *x11,
+    struct shm_arena *shm_arena,
+    struct output *output)
 {
-  int error = 0;
-
-  if (shm_region->addr != MAP_FAILED) {
-    error = munmap(shm_region->addr, shm_region->len);
-    if (error != 0) {
-      perror("munmap");
+  struct capture *capture = output->capture;
+  if (capture != NULL) {
+    stop_render_thread(capture);
+    if (capture->captured && output->info.width > 0) {
+      save_frame_cache(
+          &output->info,
+          &capture->layout,
+          capture->shown->mem,
+          capture->layout.size);
     }
-    shm_region->addr = MAP_FAILED;
-    shm_region->len = 0;
   }
+
+  remove_output(x11, shm_arena, output);
 }
 
 /*
@@ -874,17 +2387,138 @@ main(int argc, char **argv)
 {
   int error = 0;
 
+  /* keeps to the debug log, which doesn't hold up frames. WAYLAND_DEBUG is
+   * left to the user, libwayland writes it out as it goes */
   char *is_debug = getenv(debug_env);
   if (is_debug != NULL) {
     debug = true;
-    setenv("WAYLAND_DEBUG", "1", 0);
   }
 
-  if (argc != 2) {
-    fprintf(stderr, "Usage: %s <path>\n", argv[0]);
+  /* one hack for all outputs, e.g. on video walls */
+  bool mirror = getenv(mirror_env) != NULL;
+
+  /* record this many seconds of each hack, then loop them to save power */
+  uint64_t replay_ns = 0;
+  char *replay_seconds = getenv(replay_env);
+  if (replay_seconds != NULL) {
+    char *end = NULL;
+    long seconds = strtol(replay_seconds, &end, 10);
+    if (end == replay_seconds || *end != '\0' || seconds <= 0) {
+      fprintf(stderr, "%s: Expected a number of seconds\n", replay_env);
+      return EXIT_FAILURE;
+    }
+    replay_ns = (uint64_t)seconds * 1000000000;
+  }
+
+  /* after this many seconds, stop the hacks and blank the outputs */
+  uint64_t blank_ns = 0;
+  char *blank_seconds = getenv(blank_env);
+  if (blank_seconds != NULL) {
+    char *end = NULL;
+    long seconds = strtol(blank_seconds, &end, 10);
+    if (end == blank_seconds || *end != '\0' || seconds <= 0) {
+      fprintf(stderr, "%s: Expected a number of seconds\n", blank_env);
+      return EXIT_FAILURE;
+    }
+    blank_ns = (uint64_t)seconds * 1000000000;
+  }
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <path>...\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  struct hacks hacks = {
+    .paths = &argv[1],
+    .num = argc - 1,
+    .cycle_ns = (uint64_t)cycle_default_s * 1000000000,
+  };
+
+  /* how long each hack runs, with more than one of them */
+  char *cycle_seconds = getenv(cycle_env);
+  if (cycle_seconds != NULL) {
+    char *end = NULL;
+    long seconds = strtol(cycle_seconds, &end, 10);
+    if (end == cycle_seconds || *end != '\0' || seconds <= 0) {
+      fprintf(stderr, "%s: Expected a number of seconds\n", cycle_env);
+      return EXIT_FAILURE;
+    }
+    hacks.cycle_ns = (uint64_t)seconds * 1000000000;
+  }
+
+  /* how much of the pool the frame buffers may take, in mebibytes */
+  size_t budget_mib = budget_default_mib;
+  char *budget = getenv(budget_env);
+  if (budget != NULL) {
+    char *end = NULL;
+    long mib = strtol(budget, &end, 10);
+    if (end == budget || *end != '\0' || mib <= 0 ||
+        mib > budget_default_mib) {
+      fprintf(
+          stderr,
+          "%s: Expected a number of mebibytes up to %d\n",
+          budget_env,
+          budget_default_mib);
+      return EXIT_FAILURE;
+    }
+    budget_mib = (size_t)mib;
+  }
+
+  /* half the bytes per frame, for compositors at the end of a slow link. the
+   * buffers stay xrgb if the compositor doesn't take rgb565 */
+  int32_t pixel_format = pixel_xrgb8888;
+  char *rgb565 = getenv(rgb565_env);
+  if (rgb565 != NULL) {
+    pixel_format =
+        strcmp(rgb565, "dither") == 0 ? pixel_rgb565_dithered : pixel_rgb565;
+  }
+
+  /*
+   * SIGTERM and SIGINT end the event loop like an unlock does, so everything
+   * is cleaned up and the trace written out on the way. blocked before any
+   * thread starts, so none of them takes one from signal_fd
+   */
+  sigset_t quit_signals;
+  sigemptyset(&quit_signals);
+  sigaddset(&quit_signals, SIGTERM);
+  sigaddset(&quit_signals, SIGINT);
+  error = sigprocmask(SIG_BLOCK, &quit_signals, NULL);
+  if (error != 0) {
+    perror("sigprocmask");
+    return EXIT_FAILURE;
+  }
+  CLEANUP(fd) int signal_fd = -1;
+  signal_fd = signalfd(-1, &quit_signals, SFD_CLOEXEC | SFD_NONBLOCK);
+  if (signal_fd < 0) {
+    perror("signalfd");
     return EXIT_FAILURE;
   }
-  const char *screensaver_path = argv[1];
+
+  /* written out by another thread, so it doesn't hold up the frames */
+  CLEANUP(debug_log) bool debug_log_started = false;
+  if (debug) {
+    error = debug_log_start();
+    if (error != 0) {
+      return EXIT_FAILURE;
+    }
+    debug_log_started = true;
+  }
+
+  /* the frames of each capture pick what they need from it */
+  CLEANUP(copy_engine) bool copy_started = false;
+  copy_start();
+  copy_started = true;
+
+  /* a timeline of the event loop, written out when it ends, however it ends.
+   * closed after everything below, the threads recording into it included */
+  CLEANUP(trace) bool trace_opened = false;
+  char *trace_path = getenv(trace_env);
+  if (trace_path != NULL) {
+    error = trace_open(trace_path);
+    if (error != 0) {
+      return EXIT_FAILURE;
+    }
+    trace_opened = true;
+  }
 
   /* === SET UP WAYLAND === */
 
@@ -910,19 +2544,15 @@ main(int argc, char **argv)
   }
 
   CLEANUP(wl_compositor) struct wl_compositor *compositor = NULL;
-  CLEANUP(wl_surface) struct wl_surface *surface = NULL;
-  CLEANUP(wl_callback) struct wl_callback *frame_callback = NULL;
-  CLEANUP(outputs) struct outputs outputs = { 0 };
   CLEANUP(wl_shm) struct wl_shm *shm = NULL;
   CLEANUP(wl_shm_pool) struct wl_shm_pool *shm_pool = NULL;
-  CLEANUP(wl_buffer) struct wl_buffer *buffers[2] = { NULL }; /* TODO-BUFFER */
   CLEANUP(xdg_wm_base) struct xdg_wm_base *wm_base = NULL;
-  CLEANUP(xdg_surface) struct xdg_surface *xdg_surface = NULL;
-  CLEANUP(xdg_toplevel) struct xdg_toplevel *toplevel = NULL;
   CLEANUP(ext_session_lock_manager)
   struct ext_session_lock_manager_v1 *session_lock_manager = NULL;
+  CLEANUP(wp_viewporter) struct wp_viewporter *viewporter = NULL;
+  CLEANUP(wp_single_pixel_buffer_manager)
+  struct wp_single_pixel_buffer_manager_v1 *single_pixel_buffer_manager = NULL;
   struct messages messages = { 0 };
-  int next_buffer = 0;
 
   error = flush_wl(wl);
   if (error != 0) {
@@ -946,129 +2576,97 @@ main(int argc, char **argv)
     return EXIT_FAILURE;
   }
 
-  xcb_window_t window = xcb_generate_id(x11);
-  fprintf(stderr, "xcb_generate_id: %#" PRIx32 "\n", window);
-  if (window == (xcb_window_t)-1) {
-    return EXIT_FAILURE;
-  }
-
-  /* these requests error asynchronously, and are handled in the event loop */
-  xcb_create_window(
-      /*            c */ x11,
-      /*        depth */ XCB_COPY_FROM_PARENT,
-      /*          wid */ window,
-      /*       parent */ screen_preferred->root,
-      /*            x */ 0,
-      /*            y */ 0,
-      /*        width */ width,
-      /*       height */ height,
-      /* border_width */ 0,
-      /*       _class */ XCB_WINDOW_CLASS_INPUT_OUTPUT,
-      /*       visual */ XCB_COPY_FROM_PARENT,
-      /*   value_mask */ 0,
-      /*   value_list */ NULL);
-
-  /* TODO: intern_atom for UTF8_STRING or COMPOUND_TEXT (requires an extra round
-   * trip) */
-  xcb_change_property(
-      /*        c */ x11,
-      /*     mode */ XCB_PROP_MODE_REPLACE,
-      /*   window */ window,
-      /* property */ XCB_ATOM_WM_CLASS,
-      /*     type */ XCB_ATOM_STRING, /* NB: this means latin-1 */
-      /*   format */ 8,
-      /* data_len */ COUNTOF(instance_class), /* include terminating nul byte */
-      /*     data */ instance_class);
-
-  xcb_map_window(x11, window);
-
-  xcb_get_image_cookie_t get_image_cookie = { 0 };
-
-  error = xcb_flush(x11);
-  fprintf(stderr, "xcb_flush: %d\n", error);
-  if (error != 1) {
-    return EXIT_FAILURE;
+  uint8_t present_opcode = find_present(x11);
+  bool x11_shm = find_shm(x11);
+  /* before the first GetImage, shared strips don't need it */
+  if (!x11_shm) {
+    tune_malloc();
   }
 
-  /* === LAUNCH SCREENSAVER === */
+  /* windows and screensavers are started for each output as they show up */
+  CLEANUP(captures) struct captures captures = { 0 };
+  /* destroyed before the captures, whose queues they're on */
+  CLEANUP(outputs) struct outputs outputs = { 0 };
 
-  /* * 2 for nybbles (halves of bytes), + 3 for "0x" and NUL terminator */
-  char window_id_string[sizeof window * 2 + 3] = { 0 };
-  snprintf(window_id_string, COUNTOF(window_id_string), "%#" PRIx32, window);
+  /* === SET UP SHARED MEMORY === */
 
-  /* lazy, ideally i'd make a copy of environ and work on that */
-  error = setenv("XSCREENSAVER_WINDOW", window_id_string, 1);
+  CLEANUP(shm_arena)
+  struct shm_arena shm_arena = {
+    .fd = -1,
+    .region = {
+      .addr = MAP_FAILED,
+      .len = 0,
+    },
+    .debug = debug,
+  };
+  error = create_shm(&shm_arena);
   if (error != 0) {
-    perror("setenv");
     return EXIT_FAILURE;
   }
-
-  /*
-   * wl and x11 sockets are cloexec, no need to close explicitly.
-   *
-   * argv is specified to not be modified by posix_spawn (described in the
-   * manual for the exec family of functions, explained under Rationale) so the
-   * const-discarding cast is safe in theory.
-   */
-  CLEANUP(screensaver) pid_t screensaver_pid = 0;
-  const char *const screensaver_argv[] = { screensaver_path, "--root", NULL };
-  error = posix_spawn(
-      /*          pid */ &screensaver_pid,
-      /*         path */ screensaver_path,
-      /* file_actions */ NULL,
-      /*        attrp */ NULL,
-      /*         argv */ (char *const *)screensaver_argv,
-      /*         envp */ environ);
-  if (error != 0) {
-    perror("posix_spawn");
+  /* knowing the granule, a capture needs room for all of its buffers. those
+   * too big for the budget are captured at width by height */
+  shm_arena.frames_budget = budget_mib << 20;
+  struct layout layout_fallback = { 0 };
+  layout_init(&layout_fallback, 0, pixel_xrgb8888, width, height);
+  size_t capture_len = buffers_max * frame_len(&shm_arena, &layout_fallback);
+  if (shm_arena.frames_budget < capture_len) {
+    fprintf(
+        stderr,
+        "%s: A capture takes %zu KiB\n",
+        budget_env,
+        capture_len >> 10);
     return EXIT_FAILURE;
   }
-  fprintf(stderr, "screensaver_pid: %ld\n", (long)screensaver_pid);
 
-  /* === SET UP SHARED MEMORY === */
+  /* === SET UP RENDER THREADS === */
 
-  CLEANUP(shm_fd) int shm_fd = -1;
-  shm_fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
-  if (shm_fd < 0) {
-    perror("shm_open");
+  /* started for each capture once it has buffers, stopped first */
+  CLEANUP(render_context)
+  struct render_context render_context = {
+    .wl = wl,
+    .x11 = x11,
+    .captures = &captures,
+    .stop_fd = -1,
+    .shm = x11_shm,
+    .debug = debug,
+  };
+  render_context.stop_fd = eventfd(0, EFD_CLOEXEC);
+  if (render_context.stop_fd < 0) {
+    perror("eventfd");
     return EXIT_FAILURE;
   }
 
-  error = shm_unlink(shm_name);
+  /* PAM takes its time, off the event loop, which only waits for results */
+  CLEANUP(auth) bool auth_started = false;
+  error = auth_start();
   if (error != 0) {
-    perror("shm_unlink");
-    /*
-     * not fatal, but may cause problems with O_CREAT | O_EXCL in shm_open next
-     * time we run. NOTE: "fixing" it by removing O_EXCL opens up a race
-     * condition if multiple instances of this program are started
-     * simultaneously.
-     */
+    return EXIT_FAILURE;
   }
+  auth_started = true;
 
-  /* TODO-SHM */
-  error = ftruncate(shm_fd, shm_pool_size);
-  if (error != 0) {
-    perror("ftruncate");
+  /* wakes the event loop to check on the hacks, see watch_screensaver */
+  CLEANUP(fd) int watchdog_fd = -1;
+  watchdog_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (watchdog_fd < 0) {
+    perror("timerfd_create");
     return EXIT_FAILURE;
   }
-
-  CLEANUP(shm_region)
-  struct shm_region shm_region = {
-    .addr = MAP_FAILED,
-    .len = 0,
+  struct itimerspec watchdog_interval = {
+    .it_interval = { .tv_sec = watchdog_interval_s },
+    .it_value = { .tv_sec = watchdog_interval_s },
   };
-  shm_region.addr = mmap(
-      /*   addr */ NULL,
-      /* length */ shm_pool_size,
-      /*   prot */ PROT_READ | PROT_WRITE,
-      /*  flags */ MAP_SHARED,
-      /*     fd */ shm_fd,
-      /* offset */ 0);
-  if (shm_region.addr == MAP_FAILED) {
-    perror("mmap");
+  error = timerfd_settime(watchdog_fd, 0, &watchdog_interval, NULL);
+  if (error != 0) {
+    perror("timerfd_settime");
     return EXIT_FAILURE;
   }
-  shm_region.len = shm_pool_size;
+
+  /* see blank_capture */
+  uint64_t blank_start_ns = monotonic_ns();
+  bool blanked = false;
+
+  /* started once the seat shows up, stopped with the render threads */
+  CLEANUP(input) bool input_started = false;
 
   /* === EVENT LOOP === */
 
@@ -1077,19 +2675,30 @@ main(int argc, char **argv)
    * looping over two event domains we can't use blocking calls anyway), use
    * poll instead. make sure to handle all pending events before polling the
    * connection, otherwise we might leave events stuck in a queue for a while.
+   *
+   * this loop only handles the registry, pings and x11 events. the outputs are
+   * updated by the render threads, on their own queues.
    */
   bool got_x11_error = false;
   int poll_ready = 1;
-  struct pollfd connection_poll[2] = {
+  /* the pidfds of the hacks follow, -1 while a capture has none */
+  struct pollfd connection_poll[6 + COUNTOF(captures.captures)] = {
     { .fd = wl_display_get_fd(wl), .events = POLLIN },
     { .fd = xcb_get_file_descriptor(x11), .events = POLLIN },
+    { .fd = render_context.stop_fd, .events = POLLIN },
+    { .fd = auth_fd(), .events = POLLIN },
+    { .fd = signal_fd, .events = POLLIN },
+    { .fd = watchdog_fd, .events = POLLIN },
   };
+  uint64_t phase_start = 0;
   while (poll_ready > 0) {
     /* === RECEIVE X11 EVENTS === */
 
     /* xcb_poll_for_event processes one event at a time, handle it first so we
      * can use continue to loop it quickly */
-    error = handle_x11_event(x11);
+    phase_start = trace_now();
+    error = handle_x11_event(x11, &captures, present_opcode);
+    trace_span("x11 event", 0, phase_start, 0);
     if (error < 0) {
       /* keep reading error events */
       got_x11_error = true;
@@ -1111,57 +2720,62 @@ main(int argc, char **argv)
     /* === RECEIVE WAYLAND EVENTS === */
 
     /* xcb_poll_for_event also checks the connection for new events, but
-     * wl_display_dispatch_pending doesn't, so we need to read for it first */
-    error = read_wl_events(wl);
-    if (error != 0) {
-      break;
-    }
+     * wl_display_dispatch_pending doesn't, those were read after polling */
+    phase_start = trace_now();
     /* however, it dispatches all pending events in one go */
     error = wl_display_dispatch_pending(wl);
     if (error < 0) {
       perror("wl_display_dispatch_pending");
       break;
     }
-    if (debug) {
-      fprintf(stderr, "wl_display_dispatch_pending: %d\n", error);
-    }
+    DEBUG_LOG("wl_display_dispatch_pending: %" PRId64 "\n", error);
+    trace_span("wayland events", 0, phase_start, error);
 
     /* === RESPOND TO WAYLAND EVENTS === */
 
+    phase_start = trace_now();
     error = 0;
 
     if (names.compositor != 0 && compositor == NULL) {
-      error =
-          bind_compositor(registry, names.compositor, &compositor, &surface);
+      error = bind_compositor(registry, names.compositor, &compositor);
     }
     if (error != 0) {
       break;
     }
 
-    if (names.outputs_num > outputs.num) {
-      error =
-          bind_outputs(registry, names.outputs_num, names.outputs, &outputs);
+    /* TODO-OUTPUT */
+    for (size_t i = 0; i < COUNTOF(outputs.outputs) && error == 0; i++) {
+      struct output *output = &outputs.outputs[i];
+      if (output->output != NULL && output->name != names.outputs[i]) {
+        unplug_output(x11, &shm_arena, output);
+      }
+      if (output->output == NULL && names.outputs[i] != 0) {
+        error = bind_output(
+            registry,
+            names.outputs[i],
+            names.output_versions[i],
+            output);
+      }
     }
     if (error != 0) {
       break;
     }
 
     if (names.shm != 0 && shm == NULL) {
-      error = bind_shm(registry, names.shm, shm_fd, &shm, &shm_pool, &buffers);
+      error = bind_shm(
+          registry,
+          names.shm,
+          &shm_arena,
+          &messages,
+          &shm,
+          &shm_pool);
     }
     if (error != 0) {
       break;
     }
 
-    if (names.wm_base != 0 && surface != NULL && wm_base == NULL) {
-      error = bind_wm_base(
-          registry,
-          names.wm_base,
-          &messages,
-          surface,
-          &wm_base,
-          &xdg_surface,
-          &toplevel);
+    if (names.wm_base != 0 && wm_base == NULL) {
+      error = bind_wm_base(registry, names.wm_base, &messages, &wm_base);
     }
     if (error != 0) {
       break;
@@ -1177,70 +2791,207 @@ main(int argc, char **argv)
       break;
     }
 
-    if (wm_base != NULL && messages.ping != 0) {
-      xdg_wm_base_pong(wm_base, messages.ping);
-      messages.ping = 0;
+    /* the keyboard gets a thread of its own, away from the frames */
+    if (names.seat != 0 && !input_started) {
+      error = input_start(wl, registry, names.seat, render_context.stop_fd);
+      input_started = error == 0;
+    }
+    if (error != 0) {
+      break;
     }
 
-    /*
-     * TODO-BUFFER
-     * TODO: use configure to kickstart the frame callback cycle and prepare
-     * upcoming buffers, but make update_surface the exclusive purview of the
-     * frame response
-     */
-    if (xdg_surface != NULL && messages.configure != 0 && surface != NULL &&
-        buffers[0] != NULL && buffers[1] != NULL) {
-      xdg_surface_ack_configure(xdg_surface, messages.configure);
-
-      cleanup_wl_callback(&frame_callback);
-      error = update_surface(
-          x11,
-          &get_image_cookie,
-          window,
-          &messages,
-          surface,
-          &frame_callback,
-          &buffers,
-          (uint8_t *)shm_region.addr,
-          buffer_size,
-          &next_buffer);
+    if (names.viewporter != 0 && viewporter == NULL) {
+      error = bind_viewporter(registry, names.viewporter, &viewporter);
+    }
+    if (error != 0) {
+      break;
+    }
 
-      messages.configure = 0;
+    if (names.single_pixel_buffer_manager != 0 &&
+        single_pixel_buffer_manager == NULL) {
+      error = bind_single_pixel_buffer_manager(
+          registry,
+          names.single_pixel_buffer_manager,
+          &single_pixel_buffer_manager);
     }
     if (error != 0) {
       break;
     }
 
-    if (!debug && messages.frame_time != 0 && surface != NULL &&
-        buffers[0] != NULL && buffers[1] != NULL) {
-      cleanup_wl_callback(&frame_callback);
-      error = update_surface(
-          x11,
-          &get_image_cookie,
-          window,
-          &messages,
-          surface,
-          &frame_callback,
-          &buffers,
-          (uint8_t *)shm_region.addr,
-          buffer_size,
-          &next_buffer);
+    if (wm_base != NULL && messages.ping != 0) {
+      xdg_wm_base_pong(wm_base, messages.ping);
+      messages.ping = 0;
+    }
 
-      messages.frame_time = 0;
+    /* TODO-OUTPUT */
+    for (size_t i = 0; i < COUNTOF(outputs.outputs) && error == 0; i++) {
+      struct output *output = &outputs.outputs[i];
+      if (output->output == NULL) {
+        continue;
+      }
+      /* a capture is sized for the first output to show it, so that has to
+       * say how big it is first */
+      if (output->capture == NULL && !output->info.done) {
+        continue;
+      }
+
+      /* in mirror mode every output shows the first capture */
+      size_t capture_n = mirror ? 0 : i;
+      struct capture *capture = &captures.captures[capture_n];
+      if (output->capture != NULL) {
+        capture = output->capture;
+      } else if (capture->queue == NULL && !blanked) {
+        size_capture(&shm_arena, output, pixel_xrgb8888, capture);
+        capture->frame_len = frame_len(&shm_arena, &capture->layout);
+        capture->buffers_num = reserve_frames(&shm_arena, capture->frame_len);
+      }
+      if (capture->queue == NULL && !blanked && capture->buffers_num == 0) {
+        /* no room for another, one with buffers has to do */
+        capture = share_capture(&captures);
+        if (capture == NULL) {
+          fputs("reserve_frames: No capture to share\n", stderr);
+          error = -1;
+          break;
+        }
+        fprintf(
+            stderr,
+            "reserve_frames: %s shows the capture of another output\n",
+            output->info.name);
+      }
+      if (capture->queue == NULL) {
+        capture->trace_track = 1 + capture_n;
+        capture->context = &render_context;
+        capture->replay.duration_ns = replay_ns;
+        capture->queue = wl_display_create_queue(wl);
+        if (capture->queue == NULL) {
+          perror("wl_display_create_queue");
+          error = -1;
+          break;
+        }
+        if (blanked) {
+          /* nothing to animate anymore, no hack for it */
+          capture->present_fd = -1;
+          capture->pidfd = -1;
+          capture->hack_retire = true;
+          capture->blanked = true;
+        } else {
+          /* a different hack on each output, like xscreensaver does */
+          capture->hack_n = capture_n % hacks.num;
+          capture->next_hack_n = capture->hack_n;
+          error = start_capture(
+              x11,
+              screen_preferred->root,
+              present_opcode,
+              hacks.paths[capture->hack_n],
+              capture);
+        }
+      }
+      if (error != 0) {
+        break;
+      }
+
+      if (compositor != NULL && wm_base != NULL && output->surface == NULL) {
+        output->trace_track = 1 + i;
+        error = create_output_surface(
+            compositor,
+            wm_base,
+            capture->queue,
+            output);
+        if (error != 0) {
+          break;
+        }
+        /* hand it over, started again below */
+        stop_render_thread(capture);
+        attach_output(capture, output);
+        if (capture->blanked) {
+          error = create_viewport(viewporter, output);
+        }
+        if (error != 0) {
+          break;
+        }
+      }
+
+      /* laid out for the output it was sized for. in mirror mode, the
+       * others may have to scale and transform them */
+      if (shm_pool != NULL && !capture->blanked &&
+          capture->buffers[0].buffers[0] == NULL) {
+        int32_t format = pixel_format;
+        if (format != pixel_xrgb8888 && !messages.shm_rgb565) {
+          fputs("create_buffers: No rgb565 from the compositor\n", stderr);
+          format = pixel_xrgb8888;
+        }
+        layout_init(
+            &capture->layout,
+            capture->layout.transform,
+            format,
+            capture->layout.capture_width,
+            capture->layout.capture_height);
+        error = create_buffers(shm_pool, &shm_arena, capture);
+        if (error == 0) {
+          load_first_frame(&output->info, capture);
+        }
+      }
+      if (error != 0) {
+        break;
+      }
+
+      /* restarted below, once the last relayout is all done */
+      if (!capture->blanked && capture->buffers[0].buffers[0] != NULL &&
+          output->name == capture->layout_output &&
+          output->info.updates != capture->layout_updates &&
+          capture->retired_num == 0) {
+        stop_render_thread(capture);
+        error = relayout_capture(x11, shm_pool, &shm_arena, output, capture);
+      }
+      if (capture->blanked && capture->blank.buffers[0] == NULL) {
+        error = create_blank_buffer(
+            single_pixel_buffer_manager,
+            shm_pool,
+            &shm_arena,
+            capture);
+      }
+      if (error != 0) {
+        break;
+      }
+
+      /* restarted below */
+      if (capture->blanked &&
+          has_released_buffers(capture->buffers, COUNTOF(capture->buffers))) {
+        stop_render_thread(capture);
+        free_released_buffers(&shm_arena, capture);
+      }
+      if (capture->retired_num > 0 &&
+          has_released_buffers(capture->retired, COUNTOF(capture->retired))) {
+        stop_render_thread(capture);
+        free_retired_buffers(&shm_arena, capture);
+      }
+
+      /* restarted below with a new snapshot of what changed */
+      if (output->capture != NULL &&
+          output->render_info.updates != output->info.updates) {
+        stop_render_thread(capture);
+      }
+
+      bool has_buffers = capture->buffers[0].buffers[0] != NULL ||
+                         capture->blank.buffers[0] != NULL;
+      if (has_buffers && !capture->thread_started) {
+        error = start_render_thread(capture);
+      }
     }
     if (error != 0) {
       break;
     }
+    trace_span("respond", 0, phase_start, 0);
 
     /* === FLUSH RESPONSES === */
 
     /* ignore flush errors for now, we check connection errors further down */
+    phase_start = trace_now();
     error = flush_wl(wl);
 
     error = xcb_flush(x11);
-    if (debug) {
-      fprintf(stderr, "xcb_flush: %d\n", error);
-    }
+    DEBUG_LOG("xcb_flush: %" PRId64 "\n", error);
+    trace_span("flush", 0, phase_start, 0);
 
     /* === HANDLE CONNECTION ERRORS === */
 
@@ -1267,16 +3018,174 @@ main(int argc, char **argv)
 
     /* === WAIT FOR EVENTS === */
 
+    /* events came in since we dispatched, go back for them */
+    error = wl_display_prepare_read(wl);
+    if (error != 0) {
+      continue;
+    }
+
+    /* TODO-OUTPUT */
+    for (size_t i = 0; i < COUNTOF(captures.captures); i++) {
+      connection_poll[6 + i] = (struct pollfd){
+        .fd = captures.captures[i].queue != NULL ? captures.captures[i].pidfd
+                                                 : -1,
+        .events = POLLIN,
+      };
+    }
+
+    phase_start = trace_now();
     poll_ready = poll(connection_poll, COUNTOF(connection_poll), -1);
+    trace_span("wait", 0, phase_start, poll_ready);
     if (poll_ready < 0) {
+      wl_display_cancel_read(wl);
       perror("poll");
       break;
     }
-    if (debug) {
-      fprintf(stderr, "poll: %d\n", poll_ready);
+    DEBUG_LOG("poll: %" PRId64 "\n", poll_ready);
+
+    error = read_wl_events(wl, connection_poll[0].revents);
+    if (error != 0) {
+      break;
+    }
+
+    if (connection_poll[2].revents != 0) {
+      fputs("poll: A render or input thread stopped\n", stderr);
+      error = -1;
+      break;
+    }
+
+    int auth_succeeded = -1;
+    if (connection_poll[3].revents != 0) {
+      auth_succeeded = auth_result();
+    }
+    if (auth_succeeded == 0) {
+      fputs("auth: Failed\n", stderr);
+    }
+    /* TODO: unlock the session, once it's locked */
+    if (auth_succeeded == 1) {
+      fputs("auth: Unlocked\n", stderr);
+      break;
+    }
+
+    if (connection_poll[4].revents != 0) {
+      struct signalfd_siginfo quit = { 0 };
+      ssize_t got = read(signal_fd, &quit, sizeof quit);
+      if (got == sizeof quit) {
+        fprintf(stderr, "poll: %s, quitting\n", strsignal(quit.ssi_signo));
+        break;
+      }
+      if (got < 0 && errno != EAGAIN) {
+        perror("read");
+      }
+    }
+
+    bool watchdog = false;
+    for (size_t i = 5; i < COUNTOF(connection_poll); i++) {
+      watchdog = watchdog || connection_poll[i].revents != 0;
+    }
+    if (connection_poll[5].revents != 0) {
+      uint64_t ticks = 0;
+      ssize_t got = read(watchdog_fd, &ticks, sizeof ticks);
+      if (got < 0 && errno != EAGAIN) {
+        perror("read");
+      }
+    }
+    /* TODO-OUTPUT */
+    for (size_t i = 0; i < COUNTOF(captures.captures) && watchdog; i++) {
+      if (captures.captures[i].queue == NULL) {
+        continue;
+      }
+      watch_screensaver(&hacks, i, &captures.captures[i]);
+      throttle_screensaver(i, &captures.captures[i]);
+      cycle_screensaver(
+          x11,
+          screen_preferred->root,
+          present_opcode,
+          &hacks,
+          i,
+          &captures.captures[i]);
+    }
+
+    bool blank = watchdog && blank_ns != 0 && !blanked &&
+                 monotonic_ns() - blank_start_ns >= blank_ns;
+    if (blank && viewporter == NULL) {
+      fputs("blank_capture: No wp_viewporter, staying animated\n", stderr);
+      blank_ns = 0;
+      blank = false;
+    }
+    if (blank) {
+      fputs("blank_capture: Blanking\n", stderr);
+      blanked = true;
+    }
+    /* TODO-OUTPUT */
+    for (size_t i = 0; i < COUNTOF(captures.captures) && blank; i++) {
+      if (captures.captures[i].queue == NULL) {
+        continue;
+      }
+      error = blank_capture(
+          x11,
+          viewporter,
+          single_pixel_buffer_manager,
+          shm_pool,
+          &shm_arena,
+          &captures.captures[i]);
+      if (error != 0) {
+        break;
+      }
+    }
+    if (error != 0) {
+      break;
     }
   } /* while (poll_ready > 0) */
 
+  /* done with the outputs, the frame cache below reads the captures */
+  cleanup_render_context(&render_context);
+
+  /* broken hacks are expensive, make them stand out */
+  /* TODO-OUTPUT */
+  for (size_t i = 0; i < COUNTOF(captures.captures); i++) {
+    const struct capture *capture = &captures.captures[i];
+    if (capture->stalls > 0 || capture->restarts > 0) {
+      fprintf(
+          stderr,
+          "watch_screensaver: Capture %zu stalled %" PRIu32
+          " times, restarted %" PRIu32 " times\n",
+          i,
+          capture->stalls,
+          capture->restarts);
+    }
+    const struct quality *quality = &capture->quality;
+    if (quality->late_total > 0 || quality->steps_down > 0) {
+      fprintf(
+          stderr,
+          "adapt_quality: Capture %zu had %" PRIu64 " of %" PRIu64
+          " frames late, stepped down %" PRIu32 " times, up %" PRIu32
+          " times\n",
+          i,
+          quality->late_total,
+          quality->frames_total,
+          quality->steps_down,
+          quality->steps_up);
+    }
+  }
+  /* before the trace it records into is closed */
+  cleanup_input(&input_started);
+
+  /* TODO-OUTPUT */
+  for (size_t i = 0; i < COUNTOF(outputs.outputs); i++) {
+    struct output *output = &outputs.outputs[i];
+    struct capture *capture = output->capture;
+    if (capture != NULL && capture->captured && output->info.width > 0) {
+      save_frame_cache(
+          &output->info,
+          &capture->layout,
+          capture->shown->mem,
+          capture->layout.size);
+    }
+  }
+
+  cleanup_trace(&trace_opened);
+
   if (error != 0 || poll_ready < 0) {
     return EXIT_FAILURE;
   }
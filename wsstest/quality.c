@@ -0,0 +1,140 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "quality.h"
+
+static const char *const level_names[] = {
+  [quality_full] = "full",
+  [quality_half_rate] = "half rate",
+  [quality_hack_niced] = "half rate, hack niced",
+  [quality_quarter_rate] = "quarter rate, hack niced",
+};
+
+static uint32_t
+rate_divisor(int level)
+{
+  if (level >= quality_quarter_rate) {
+    return 4;
+  }
+  if (level >= quality_half_rate) {
+    return 2;
+  }
+  return 1;
+}
+
+bool
+quality_skip(struct quality *quality)
+{
+  quality->callbacks += 1;
+  quality->skipping = quality->callbacks % rate_divisor(quality->level) != 0;
+  return quality->skipping;
+}
+
+void
+quality_sample(
+    struct quality *quality,
+    uint32_t interval_ms,
+    uint64_t period_ns,
+    uint64_t latency_ns)
+{
+  /* a second without frames is the compositor not drawing us, not lateness */
+  if (interval_ms == 0 || interval_ms > quality_window_ms) {
+    return;
+  }
+
+  quality->window_frames += 1;
+  if (!quality->skipping) {
+    quality->window_captured += 1;
+    quality->window_latency_ns += latency_ns;
+  }
+  /* half a refresh of slack, the timestamps are only in milliseconds */
+  if ((uint64_t)interval_ms * 1000000 * 2 > period_ns * 3) {
+    quality->window_late += 1;
+  }
+}
+
+static void
+start_window(struct quality *quality, uint64_t now_ns, uint64_t cpu_ns)
+{
+  quality->window_start_ns = now_ns;
+  quality->window_cpu_ns = cpu_ns;
+  quality->window_latency_ns = 0;
+  quality->window_frames = 0;
+  quality->window_captured = 0;
+  quality->window_late = 0;
+}
+
+int
+quality_update(
+    struct quality *quality,
+    uint64_t now_ns,
+    uint64_t cpu_ns,
+    uint64_t period_ns)
+{
+  if (quality->window_start_ns == 0) {
+    start_window(quality, now_ns, cpu_ns);
+    return 0;
+  }
+
+  uint64_t window_ns = now_ns - quality->window_start_ns;
+  if (window_ns < (uint64_t)quality_window_ms * 1000000) {
+    return 0;
+  }
+
+  struct quality_window *last = &quality->last;
+  last->frames = quality->window_frames;
+  last->late = quality->window_late;
+  last->latency_ns = 0;
+  if (quality->window_captured > 0) {
+    last->latency_ns = quality->window_latency_ns / quality->window_captured;
+  }
+  last->cpu_permille = (cpu_ns - quality->window_cpu_ns) * 1000 / window_ns;
+  quality->frames_total += last->frames;
+  quality->late_total += last->late;
+  start_window(quality, now_ns, cpu_ns);
+
+  if (last->frames < quality_window_frames_min) {
+    quality->calm = 0;
+    return 0;
+  }
+
+  /* more than one in eight late is visible stutter */
+  if (last->late * 8 > last->frames) {
+    quality->calm = 0;
+    if (quality->level == quality_lowest) {
+      return 0;
+    }
+    quality->level += 1;
+    quality->steps_down += 1;
+    return -1;
+  }
+
+  /* room for capturing twice as often, give or take */
+  bool headroom = last->late == 0 && last->latency_ns * 2 < period_ns &&
+                  last->cpu_permille < 500;
+  if (!headroom) {
+    quality->calm = 0;
+    return 0;
+  }
+
+  quality->calm += 1;
+  if (quality->calm < quality_calm_windows || quality->level == quality_full) {
+    return 0;
+  }
+  quality->calm = 0;
+  quality->level -= 1;
+  quality->steps_up += 1;
+  return 1;
+}
+
+const char *
+quality_name(int level)
+{
+  return level_names[level];
+}
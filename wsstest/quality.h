@@ -0,0 +1,113 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef WSSTEST_QUALITY_H
+#define WSSTEST_QUALITY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * how much of a capture we can afford. with several outputs and a heavy hack
+ * the machine may not keep up with every frame callback, and rather than
+ * stutter on every output at once, each capture steps down on its own: first
+ * capturing every other frame, then leaving the hack less cpu, then every
+ * fourth frame. it steps back up once there's room again.
+ *
+ * the render thread feeds it a sample per frame callback, and every
+ * quality_window_ms it decides on the window. this only does the deciding,
+ * acting on it is up to the caller.
+ */
+
+enum quality_level {
+  quality_full = 0,
+  /* capture on every other frame callback */
+  quality_half_rate,
+  /* and the hack runs at a lower priority than us */
+  quality_hack_niced,
+  /* capture on every fourth */
+  quality_quarter_rate,
+  quality_lowest = quality_quarter_rate,
+};
+
+enum {
+  quality_window_ms = 1000,
+  /* fewer frames than this in a window, and the output is likely idle (or
+   * hidden) rather than slow */
+  quality_window_frames_min = 8,
+  /* windows in a row with room to spare before stepping back up */
+  quality_calm_windows = 5,
+};
+
+/* what a decision was based on */
+struct quality_window
+{
+  uint32_t frames;
+  /* frame callbacks that came a refresh (or more) late */
+  uint32_t late;
+  /* mean time spent capturing and presenting a frame, of those captured */
+  uint64_t latency_ns;
+  /* of the render thread, in thousandths of the window */
+  uint32_t cpu_permille;
+};
+
+struct quality
+{
+  /* enum quality_level, published for the event loop by the caller */
+  int level;
+  uint32_t callbacks;
+  /* the last frame callback was presented without capturing */
+  bool skipping;
+
+  uint64_t window_start_ns;
+  uint64_t window_cpu_ns;
+  uint64_t window_latency_ns;
+  uint32_t window_frames;
+  uint32_t window_captured;
+  uint32_t window_late;
+  uint32_t calm;
+  /* the last one decided on */
+  struct quality_window last;
+
+  /* for the numbers at the end */
+  uint64_t frames_total;
+  uint64_t late_total;
+  uint32_t steps_down;
+  uint32_t steps_up;
+};
+
+/* counts a frame callback, true if it should be presented without capturing
+ * a new frame */
+bool
+quality_skip(struct quality *quality);
+
+/*
+ * a frame callback interval_ms after the last one, on an output refreshing
+ * every period_ns, and how long the capture (unless skipped) and present took
+ */
+void
+quality_sample(
+    struct quality *quality,
+    uint32_t interval_ms,
+    uint64_t period_ns,
+    uint64_t latency_ns);
+
+/*
+ * ends the window once it's long enough, with cpu_ns the cpu time of the
+ * calling thread so far. returns -1 if the level stepped down, 1 if up and 0
+ * otherwise.
+ */
+int
+quality_update(
+    struct quality *quality,
+    uint64_t now_ns,
+    uint64_t cpu_ns,
+    uint64_t period_ns);
+
+const char *
+quality_name(int level);
+
+#endif /* WSSTEST_QUALITY_H */
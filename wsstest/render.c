@@ -0,0 +1,1126 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define _POSIX_C_SOURCE 200809L
+/* RUSAGE_THREAD and memfd_create */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <wayland-client-core.h>
+#include <wayland-client-protocol.h>
+#include <wayland-client-protocols/viewporter.h>
+#include <wayland-client-protocols/xdg-shell.h>
+#include <xcb/shm.h>
+#include <xcb/xcb.h>
+
+#include "debug-log.h"
+#include "frame.h"
+#include "quality.h"
+#include "render.h"
+#include "replay.h"
+#include "trace.h"
+
+#define CLEANUP(how) __attribute__((cleanup(cleanup_##how)))
+#define COUNTOF(array) (sizeof(array) / sizeof(array)[0])
+
+/* when the output doesn't say how often it refreshes, a fair guess */
+enum {
+  refresh_default_mhz = 60000,
+};
+
+/* how often a render thread reports its page faults, in debug mode */
+enum {
+  fault_stats_frames = 256,
+};
+
+static uint64_t
+monotonic_ns(void)
+{
+  struct timespec now = { 0 };
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* of GetImage or ShmGetImage */
+static void
+cleanup_x11_reply(void **reply)
+{
+  if (*reply != NULL) {
+    free(*reply);
+    *reply = NULL;
+  }
+}
+
+static void
+cleanup_wl_callback(struct wl_callback **callback)
+{
+  if (*callback != NULL) {
+    wl_callback_destroy(*callback);
+    *callback = NULL;
+  }
+}
+
+static void
+cleanup_fd(int *fd)
+{
+  int error = 0;
+
+  if (*fd >= 0) {
+    error = close(*fd);
+    if (error != 0) {
+      perror("close");
+    }
+    *fd = -1;
+  }
+}
+
+int
+flush_wl(struct wl_display *wl)
+{
+  int error = 0;
+  struct pollfd flush_poll[1] = {
+    { .fd = wl_display_get_fd(wl), .events = POLLOUT },
+  };
+
+  /* TODO: handle POLLOUT in the event loop (so it's less blocking) and augment
+   * it with error checking on revents (see _xcb_conn_wait) */
+  do {
+    error = poll(flush_poll, COUNTOF(flush_poll), -1);
+    if (error <= 0) {
+      perror("poll");
+      break;
+    }
+    /* doesn't block, instead errors with EAGAIN */
+    /* TODO: how does it behave after a partial flush? is it possible? */
+    error = wl_display_flush(wl);
+    if (error < 0 && errno != EAGAIN && errno != EPIPE) {
+      perror("wl_display_flush");
+      break;
+    }
+  } while (error < 0 && errno == EAGAIN);
+
+  /* if the connection was closed, continue and try to read the error later */
+  if (error < 0 && errno != EPIPE) {
+    return -1;
+  }
+  DEBUG_LOG("wl_display_flush: %" PRId64 "\n", error);
+
+  return 0;
+}
+
+int
+read_wl_events(struct wl_display *wl, short revents)
+{
+  int error = 0;
+
+  if ((revents & POLLIN) == 0) {
+    wl_display_cancel_read(wl);
+    return 0;
+  }
+
+  error = wl_display_read_events(wl);
+  if (error != 0) {
+    perror("wl_display_read_events");
+    return -1;
+  }
+
+  return 0;
+}
+
+static void
+handle_frame_callback_done(
+    void *data,
+    struct wl_callback *wl_callback,
+    uint32_t callback_data)
+{
+  struct output *output = data;
+  (void)wl_callback;
+
+  if (output == NULL) {
+    fputs("handle_wl_callback_done: Missing output\n", stderr);
+    return;
+  }
+
+  trace_async(
+      "frame callback",
+      output->trace_track,
+      output->frame_requested,
+      0);
+  output->frame_time = callback_data;
+  output->frame_waiting = false;
+}
+
+static const struct wl_callback_listener frame_callback_listener = {
+  .done = handle_frame_callback_done,
+};
+
+static void
+handle_wl_buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+  struct buffer *buffer = data;
+
+  if (buffer == NULL) {
+    fputs("handle_wl_buffer_release: Missing buffer\n", stderr);
+    return;
+  }
+
+  for (size_t i = 0; i < COUNTOF(buffer->buffers); i++) {
+    if (buffer->buffers[i] == wl_buffer && buffer->held[i]) {
+      buffer->held[i] = false;
+      /* once blanked, the event loop waits for this to free it */
+      __atomic_sub_fetch(&buffer->busy, 1, __ATOMIC_RELEASE);
+    }
+  }
+}
+
+const struct wl_buffer_listener buffer_listener = {
+  .release = handle_wl_buffer_release,
+};
+
+void
+output_size(
+    const struct output_info *info,
+    int32_t *output_width,
+    int32_t *output_height)
+{
+  /* the odd ones are a quarter turn */
+  bool turned = info->transform % 2 != 0;
+  *output_width = turned ? info->height : info->width;
+  *output_height = turned ? info->width : info->height;
+}
+
+/*
+ * replies are limited only by memory, but keep strips no bigger than what the
+ * server accepts as a request, as a sensible bound for both sides.
+ */
+static int32_t
+find_strip_height(xcb_connection_t *x11, const struct layout *layout)
+{
+  size_t strip_size = strip_size_max;
+  /* in units of 4 bytes */
+  size_t request_size = (size_t)xcb_get_maximum_request_length(x11) * 4;
+  if (request_size < strip_size) {
+    strip_size = request_size;
+  }
+
+  int32_t strip_height =
+      strip_size / layout->capture_stride / tile_size * tile_size;
+  if (strip_height < tile_size) {
+    strip_height = tile_size;
+  }
+  if (strip_height > layout->capture_height) {
+    strip_height = layout->capture_height;
+  }
+
+  return strip_height;
+}
+
+void
+unshare_strips(xcb_connection_t *x11, struct capture *capture)
+{
+  int error = 0;
+
+  if (capture->strips_seg != 0 && x11 != NULL) {
+    xcb_shm_detach(x11, capture->strips_seg);
+  }
+  capture->strips_seg = 0;
+
+  if (capture->strips_mem != NULL) {
+    error = munmap(capture->strips_mem, capture->strips_len);
+    if (error != 0) {
+      perror("munmap");
+    }
+    capture->strips_mem = NULL;
+    capture->strips_len = 0;
+  }
+}
+
+/*
+ * with MIT-SHM, memory the x server puts the strips in flight into, so xcb
+ * doesn't malloc a reply the size of each of them. made again if the strips
+ * outgrow it after a relayout. this waits for the server once.
+ */
+static int
+share_strips(xcb_connection_t *x11, struct capture *capture)
+{
+  int error = 0;
+
+  size_t len = strips_in_flight * (size_t)capture->strip_height *
+               capture->layout.capture_stride;
+  if (capture->strips_mem != NULL && capture->strips_len >= len) {
+    return 0;
+  }
+  unshare_strips(x11, capture);
+
+  int fd = memfd_create("wsstest-strips", MFD_CLOEXEC);
+  if (fd < 0) {
+    perror("memfd_create");
+    return -1;
+  }
+  error = ftruncate(fd, len);
+  if (error != 0) {
+    perror("ftruncate");
+    close(fd);
+    return -1;
+  }
+  void *mem = mmap(
+      /*   addr */ NULL,
+      /* length */ len,
+      /*   prot */ PROT_READ,
+      /*  flags */ MAP_SHARED,
+      /*     fd */ fd,
+      /* offset */ 0);
+  if (mem == MAP_FAILED) {
+    perror("mmap");
+    close(fd);
+    return -1;
+  }
+
+  xcb_shm_seg_t seg = xcb_generate_id(x11);
+  if (seg == (xcb_shm_seg_t)-1) {
+    fputs("xcb_generate_id: Failed\n", stderr);
+    close(fd);
+    munmap(mem, len);
+    return -1;
+  }
+  /* xcb closes the fd once it's sent */
+  xcb_generic_error_t *attach_error = xcb_request_check(
+      x11,
+      xcb_shm_attach_fd_checked(x11, seg, fd, false));
+  if (attach_error != NULL) {
+    /* like a server on another machine, which can't map it */
+    fprintf(
+        stderr,
+        "xcb_shm_attach_fd: Error %" PRIu8 "\n",
+        attach_error->error_code);
+    free(attach_error);
+    munmap(mem, len);
+    return -1;
+  }
+
+  capture->strips_seg = seg;
+  capture->strips_mem = mem;
+  capture->strips_len = len;
+  return 0;
+}
+
+static void
+request_strip(xcb_connection_t *x11, struct capture *capture, size_t strip)
+{
+  int32_t capture_height = capture->layout.capture_height;
+  int32_t strip_y = capture->strip_height * strip;
+  int32_t strip_rows = capture_height - strip_y < capture->strip_height
+                           ? capture_height - strip_y
+                           : capture->strip_height;
+
+  capture->strip_requested[strip] = trace_now();
+  if (capture->strips_mem != NULL) {
+    size_t strip_len =
+        (size_t)capture->strip_height * capture->layout.capture_stride;
+    xcb_shm_get_image_cookie_t shm_get_image_cookie =
+        xcb_shm_get_image_unchecked(
+            /*          c */ x11,
+            /*   drawable */ capture->window,
+            /*          x */ 0,
+            /*          y */ strip_y,
+            /*      width */ capture->layout.capture_width,
+            /*     height */ strip_rows,
+            /* plane_mask */ UINT32_MAX,
+            /*     format */ XCB_IMAGE_FORMAT_Z_PIXMAP,
+            /*     shmseg */ capture->strips_seg,
+            /*     offset */ strip % strips_in_flight * strip_len);
+    capture->strip_cookies[strip].sequence = shm_get_image_cookie.sequence;
+    return;
+  }
+  capture->strip_cookies[strip] = xcb_get_image_unchecked(
+      /*          c */ x11,
+      /*     format */ XCB_IMAGE_FORMAT_Z_PIXMAP,
+      /*   drawable */ capture->window,
+      /*          x */ 0,
+      /*          y */ strip_y,
+      /*      width */ capture->layout.capture_width,
+      /*     height */ strip_rows,
+      /* plane_mask */ UINT32_MAX);
+}
+
+void
+discard_strips(xcb_connection_t *x11, struct capture *capture)
+{
+  for (size_t i = 0; i < COUNTOF(capture->strip_cookies); i++) {
+    if (capture->strip_cookies[i].sequence != 0) {
+      xcb_discard_reply(x11, capture->strip_cookies[i].sequence);
+      capture->strip_cookies[i].sequence = 0;
+    }
+  }
+}
+
+/*
+ * in debug mode, the page faults of the render thread per captured frame. once
+ * warmed up there should be none: the strips land in memory shared with the x
+ * server, or without MIT-SHM in replies malloc reuses the heap for, see
+ * tune_malloc.
+ */
+static void
+count_faults(struct capture *capture)
+{
+  capture->frames += 1;
+  if (!capture->context->debug ||
+      capture->frames % fault_stats_frames != 0) {
+    return;
+  }
+
+  struct rusage usage = { 0 };
+  int error = getrusage(RUSAGE_THREAD, &usage);
+  if (error != 0) {
+    perror("getrusage");
+    return;
+  }
+
+  uint64_t faults = usage.ru_minflt + usage.ru_majflt;
+  DEBUG_LOG(
+      "count_faults: %" PRId64 " page faults in %" PRId64 " frames\n",
+      (int64_t)(faults - capture->faults),
+      fault_stats_frames);
+  capture->faults = faults;
+}
+
+/*
+ * the reply to a strip, for the caller to free, or NULL if it's an error,
+ * which is waiting in the queue. its pixels are in data, in the reply or the
+ * shared memory, len bytes of them.
+ */
+static void *
+wait_strip(
+    xcb_connection_t *x11,
+    struct capture *capture,
+    size_t strip,
+    const uint8_t **data,
+    size_t *len)
+{
+  unsigned int sequence = capture->strip_cookies[strip].sequence;
+  capture->strip_cookies[strip].sequence = 0;
+
+  if (capture->strips_mem != NULL) {
+    xcb_shm_get_image_reply_t *shm_get_image_reply = xcb_shm_get_image_reply(
+        x11,
+        (xcb_shm_get_image_cookie_t){ sequence },
+        NULL);
+    if (shm_get_image_reply == NULL) {
+      return NULL;
+    }
+    size_t strip_len =
+        (size_t)capture->strip_height * capture->layout.capture_stride;
+    *data = capture->strips_mem + strip % strips_in_flight * strip_len;
+    *len = shm_get_image_reply->size;
+    return shm_get_image_reply;
+  }
+
+  xcb_get_image_reply_t *get_image_reply =
+      xcb_get_image_reply(x11, (xcb_get_image_cookie_t){ sequence }, NULL);
+  if (get_image_reply == NULL) {
+    return NULL;
+  }
+  *data = xcb_get_image_data(get_image_reply);
+  /* xcb_*_length returns int, assuming it's non-negative */
+  *len = xcb_get_image_data_length(get_image_reply);
+  return get_image_reply;
+}
+
+/* the first strips of the next frame, the rest follow as replies arrive */
+static void
+request_frame(xcb_connection_t *x11, struct capture *capture)
+{
+  size_t strips_num =
+      (capture->layout.capture_height + capture->strip_height - 1) /
+      capture->strip_height;
+  for (size_t strip = 0; strip < strips_num && strip < strips_in_flight;
+       strip++) {
+    request_strip(x11, capture, strip);
+  }
+  capture->presented = false;
+}
+
+/* the compositor may still be reading all of the buffers, skip this one then */
+static struct buffer *
+take_buffer(struct capture *capture)
+{
+  for (size_t i = 0; i < capture->buffers_num; i++) {
+    size_t buffer_n = (capture->next_buffer + i) % capture->buffers_num;
+    struct buffer *buffer = &capture->buffers[buffer_n];
+    if (buffer->busy == 0) {
+      return buffer;
+    }
+  }
+
+  DEBUG_LOG("capture_frame: No free buffer\n");
+  return NULL;
+}
+
+static void
+show_buffer(struct capture *capture, struct buffer *buffer, struct frame *frame)
+{
+  if (!frame->full_damage && frame->damage_rects_num == 0) {
+    return;
+  }
+
+  frame->buffer = buffer;
+  capture->shown = buffer;
+  buffer->seq = ++capture->frame_seq;
+  size_t buffer_n = (size_t)(buffer - capture->buffers);
+  capture->next_buffer = (buffer_n + 1) % capture->buffers_num;
+}
+
+/* the hack is beyond help, show black rather than its last frame forever */
+static void
+show_fallback(struct capture *capture, struct frame *frame)
+{
+  struct buffer *buffer = take_buffer(capture);
+  if (buffer == NULL) {
+    return;
+  }
+
+  memset(buffer->mem, 0, capture->layout.size);
+  buffer->damage.valid = false;
+  frame->full_damage = true;
+  show_buffer(capture, buffer, frame);
+  capture->fallback_shown = true;
+}
+
+/* once enough is recorded, stop the hack, capture_frame plays it from then */
+static void
+record_frame(struct capture *capture, const struct buffer *buffer)
+{
+  int recorded = replay_record(&capture->replay, &capture->layout, buffer);
+  if (recorded < 0) {
+    /* keep the hack running live instead */
+    fputs("record_frame: Giving up on replay\n", stderr);
+    replay_free(&capture->replay);
+    return;
+  }
+  if (recorded == 0) {
+    return;
+  }
+
+  /* the event loop stops the hack, it's the one looking after it */
+  __atomic_store_n(&capture->hack_retire, true, __ATOMIC_RELEASE);
+  capture->replay.playing = true;
+}
+
+/*
+ * copy the strips of the last frame requested into a free buffer as they
+ * arrive, and request the next frame. the first call only shows the initial
+ * buffer, with whatever the event loop put in it.
+ */
+static int
+capture_frame(
+    xcb_connection_t *x11,
+    struct capture *capture,
+    struct frame *frame)
+{
+  *frame = (struct frame){
+    .damage_bounds = { INT32_MAX, INT32_MAX, 0, 0 },
+  };
+
+  if (capture->shown == NULL) {
+    capture->shown = &capture->buffers[0];
+    capture->shown->seq = ++capture->frame_seq;
+    capture->next_buffer = 1 % capture->buffers_num;
+  }
+
+  if (capture->replay.playing) {
+    struct buffer *buffer = take_buffer(capture);
+    if (buffer != NULL) {
+      replay_play(
+          &capture->replay,
+          &capture->layout,
+          buffer,
+          capture->shown,
+          frame);
+      show_buffer(capture, buffer, frame);
+    }
+    return 0;
+  }
+
+  /* only now, a replay doesn't need the x server */
+  if (capture->strip_height == 0) {
+    capture->strip_height = find_strip_height(x11, &capture->layout);
+    if (capture->context->shm && !capture->strips_unshared &&
+        share_strips(x11, capture) != 0) {
+      fputs("share_strips: Falling back to GetImage\n", stderr);
+      capture->strips_unshared = true;
+    }
+  }
+
+  int hack_state = __atomic_load_n(&capture->hack_state, __ATOMIC_ACQUIRE);
+  if (hack_state == hack_failed) {
+    discard_strips(x11, capture);
+    if (!capture->fallback_shown) {
+      show_fallback(capture, frame);
+    }
+    return 0;
+  }
+
+  uint32_t hack_generation =
+      __atomic_load_n(&capture->hack_generation, __ATOMIC_ACQUIRE);
+  if (hack_generation != capture->hack_generation_seen) {
+    /* a new hack, which may not present its frames like the last one did */
+    capture->hack_generation_seen = hack_generation;
+    capture->present_driven = false;
+  }
+
+  int32_t capture_height = capture->layout.capture_height;
+  size_t capture_stride = capture->layout.capture_stride;
+  size_t strips_num =
+      (capture_height + capture->strip_height - 1) / capture->strip_height;
+
+  /* xcb does tricks to ensure the serial of a valid request is never 0 */
+  if (capture->strip_cookies[0].sequence != 0) {
+    struct buffer *buffer = take_buffer(capture);
+
+    bool complete = true;
+    for (size_t strip = 0; strip < strips_num; strip++) {
+      /* keep the pipeline full while we wait for this one */
+      size_t ahead = strip + strips_in_flight - 1;
+      if (ahead < strips_num && capture->strip_cookies[ahead].sequence == 0) {
+        request_strip(x11, capture, ahead);
+      }
+
+      /* ideally we would get the reply asynchronously in the x11 event handler
+       * so we never block here, but xcb's design seems to discourage this.
+       * xcb always mallocs replies, with shared strips they're small */
+      const uint8_t *strip_data = NULL;
+      size_t strip_data_length = 0;
+      CLEANUP(x11_reply)
+      void *reply =
+          wait_strip(x11, capture, strip, &strip_data, &strip_data_length);
+      trace_async(
+          "GetImage",
+          capture->trace_track,
+          capture->strip_requested[strip],
+          strip);
+      if (reply == NULL) {
+        /* error is waiting in the queue */
+        discard_strips(x11, capture);
+        return 0;
+      }
+
+      if (buffer == NULL) {
+        continue;
+      }
+
+      int32_t strip_y = capture->strip_height * strip;
+      int32_t strip_rows = capture_height - strip_y < capture->strip_height
+                               ? capture_height - strip_y
+                               : capture->strip_height;
+
+      if (strip_data_length < capture_stride * (size_t)strip_rows) {
+        /* anything we didn't capture in full is damaged as a whole */
+        complete = false;
+        strip_rows = strip_data_length / capture_stride;
+      }
+
+      update_strip(
+          &capture->layout,
+          strip_data,
+          strip_y,
+          strip_rows,
+          buffer,
+          capture->shown,
+          frame);
+    }
+
+    if (buffer != NULL) {
+      finish_damage(frame);
+      buffer->damage.valid = complete;
+      frame->full_damage = !complete;
+      capture->captured = true;
+    }
+    show_buffer(capture, buffer, frame);
+    if (frame->buffer != NULL) {
+      __atomic_store_n(&capture->active_ns, monotonic_ns(), __ATOMIC_RELAXED);
+    }
+    count_faults(capture);
+
+    if (buffer != NULL && complete && capture->replay.duration_ns != 0) {
+      record_frame(capture, buffer);
+    }
+    /* the hack is gone, don't ask for more */
+    if (capture->replay.playing) {
+      return 0;
+    }
+  }
+
+  /*
+   * request next image right after copying the current one. this way the output
+   * lags against the input by about 1 update but we wait less, possibly leading
+   * to a smoother output frame rate.
+   *
+   * once the hack is known to present its frames, only request one it has
+   * presented since. until it does, the request waits for handle_present and
+   * unchanged frames aren't transferred at all. nothing is requested while the
+   * hack is down.
+   */
+  if (hack_state == hack_running &&
+      (!capture->present_driven || capture->presented)) {
+    request_frame(x11, capture);
+  }
+
+  return 0;
+}
+
+/* the hack presented a new frame, fetch it now unless one is already coming */
+static int
+handle_present(struct capture *capture)
+{
+  uint64_t presents = 0;
+  ssize_t got = read(capture->present_fd, &presents, sizeof presents);
+  if (got < 0) {
+    if (errno == EAGAIN) {
+      return 0;
+    }
+    perror("read");
+    return -1;
+  }
+  DEBUG_LOG("handle_present: %" PRId64 " frames\n", (int64_t)presents);
+
+  capture->present_driven = true;
+  capture->presented = true;
+  __atomic_store_n(&capture->active_ns, monotonic_ns(), __ATOMIC_RELAXED);
+  if (capture->shown != NULL && !capture->replay.playing &&
+      capture->strip_cookies[0].sequence == 0) {
+    request_frame(capture->context->x11, capture);
+  }
+
+  return 0;
+}
+
+/* the wl_buffer of buffer for the surface in slot, held until the compositor
+ * releases it */
+static void
+attach_buffer(struct output *output, size_t slot, struct buffer *buffer)
+{
+  wl_surface_attach(output->surface, buffer->buffers[slot], 0, 0);
+  if (!buffer->held[slot]) {
+    buffer->held[slot] = true;
+    __atomic_add_fetch(&buffer->busy, 1, __ATOMIC_RELAXED);
+  }
+  output->committed_seq = buffer->seq;
+}
+
+/*
+ * the damage of frame is against base_seq, the frame shown before it. an
+ * output that didn't commit that one is shown the latest frame in full: in
+ * mirror mode it was still waiting for its frame callback, and missed the
+ * frames since.
+ */
+static int
+present_frame(
+    struct output *output,
+    size_t slot,
+    const struct frame *frame,
+    uint64_t base_seq)
+{
+  int error = 0;
+  struct buffer *shown = output->capture->shown;
+
+  /*
+   * need to attach the initial buffer to map the window, no matter what. after
+   * that, an unchanged frame isn't attached or damaged at all, the commit below
+   * only carries the frame callback to keep us paced.
+   */
+  if (!output->mapped) {
+    wl_surface_set_buffer_transform(
+        output->surface,
+        output->capture->layout.transform);
+    wl_surface_set_buffer_scale(output->surface, output->capture->buffer_scale);
+    attach_buffer(output, slot, shown);
+    wl_surface_damage_buffer(output->surface, 0, 0, INT32_MAX, INT32_MAX);
+    output->mapped = true;
+  } else if (frame->buffer != NULL && output->committed_seq == base_seq) {
+    attach_buffer(output, slot, frame->buffer);
+    if (frame->full_damage) {
+      wl_surface_damage_buffer(output->surface, 0, 0, INT32_MAX, INT32_MAX);
+    }
+    for (size_t i = 0; i < frame->damage_rects_num; i++) {
+      struct damage_rect rect =
+          layout_rect(&output->capture->layout, frame->damage_rects[i]);
+      wl_surface_damage_buffer(
+          output->surface,
+          rect.x,
+          rect.y,
+          rect.width,
+          rect.height);
+    }
+  } else if (output->committed_seq != shown->seq) {
+    attach_buffer(output, slot, shown);
+    wl_surface_damage_buffer(output->surface, 0, 0, INT32_MAX, INT32_MAX);
+  }
+
+  /* request next frame. the reply to the GetImage should arrive by then */
+  cleanup_wl_callback(&output->frame_callback);
+  output->frame_requested = trace_now();
+  output->frame_callback = wl_surface_frame(output->surface);
+  if (output->frame_callback == NULL) {
+    perror("wl_surface_frame");
+    return -1;
+  }
+
+  error = wl_callback_add_listener(
+      output->frame_callback,
+      &frame_callback_listener,
+      output);
+  if (error != 0) {
+    fputs("wl_callback_add_listener: listener already set\n", stderr);
+    return -1;
+  }
+
+  /* all done, cap the update with a commit */
+  wl_surface_commit(output->surface);
+  output->frame_waiting = true;
+
+  return 0;
+}
+
+void
+present_blank(struct output *output)
+{
+  const struct output_info *info = &output->render_info;
+  int32_t scale = info->scale > 0 ? info->scale : 1;
+  int32_t blank_width = 0;
+  int32_t blank_height = 0;
+  output_size(info, &blank_width, &blank_height);
+  blank_width /= scale;
+  blank_height /= scale;
+  if (blank_width <= 0 || blank_height <= 0) {
+    blank_width = width;
+    blank_height = height;
+  }
+
+  wl_surface_set_buffer_scale(output->surface, 1);
+  /* the same wl_buffer on every surface, its release isn't waited for */
+  wl_surface_attach(output->surface, output->capture->blank.buffers[0], 0, 0);
+  wp_viewport_set_destination(output->viewport, blank_width, blank_height);
+  wl_surface_damage_buffer(output->surface, 0, 0, INT32_MAX, INT32_MAX);
+  wl_surface_commit(output->surface);
+  output->blanked = true;
+}
+
+static uint64_t
+refresh_period_ns(const struct output_info *info)
+{
+  int32_t refresh = info->refresh > 0 ? info->refresh : refresh_default_mhz;
+  return (uint64_t)1000000000000 / refresh;
+}
+
+/*
+ * feeds the quality controller the frame callback that was just handled. its
+ * decisions are logged, and each window ends up in the trace.
+ */
+static void
+adapt_quality(
+    struct capture *capture,
+    uint32_t interval_ms,
+    uint64_t period_ns,
+    uint64_t latency_ns)
+{
+  struct quality *quality = &capture->quality;
+  quality_sample(quality, interval_ms, period_ns, latency_ns);
+
+  struct timespec cpu = { 0 };
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+  uint64_t cpu_ns = (uint64_t)cpu.tv_sec * 1000000000 + cpu.tv_nsec;
+  uint64_t window_start_ns = quality->window_start_ns;
+  int step = quality_update(quality, monotonic_ns(), cpu_ns, period_ns);
+  if (quality->window_start_ns == window_start_ns) {
+    return;
+  }
+
+  const struct quality_window *last = &quality->last;
+  trace_instant("late frames", capture->trace_track, last->late);
+  trace_instant("cpu permille", capture->trace_track, last->cpu_permille);
+  if (step == 0) {
+    return;
+  }
+
+  /* the trace track of a capture is 1 + its slot */
+  fprintf(
+      stderr,
+      "adapt_quality: Capture %" PRIu32 " %s to %s, %" PRIu32 " of %" PRIu32
+      " frames late, %" PRIu64 " us per capture, %" PRIu32 "%% cpu\n",
+      capture->trace_track - 1,
+      step < 0 ? "down" : "up",
+      quality_name(quality->level),
+      last->late,
+      last->frames,
+      last->latency_ns / 1000,
+      last->cpu_permille / 10);
+  trace_instant("quality", capture->trace_track, quality->level);
+  __atomic_store_n(&capture->quality_level, quality->level, __ATOMIC_RELAXED);
+}
+
+/*
+ * TODO-BUFFER
+ * TODO: use configure to kickstart the frame callback cycle and prepare
+ * upcoming buffers, but make update_surface the exclusive purview of the
+ * frame response
+ */
+static int
+update_outputs(struct capture *capture)
+{
+  int error = 0;
+  bool update = false;
+  /* between frame callbacks of the first output that had one */
+  uint32_t interval_ms = 0;
+  uint64_t period_ns = 0;
+  /* outputs to commit to, each only once its own frame callback came */
+  size_t ready_num = 0;
+
+  for (size_t i = 0; i < COUNTOF(capture->outputs); i++) {
+    struct output *output = capture->outputs[i];
+    if (output == NULL) {
+      continue;
+    }
+    if (output->configure != 0) {
+      xdg_surface_ack_configure(output->xdg_surface, output->configure);
+      output->configure = 0;
+      output->configured = true;
+      update = true;
+    }
+
+    /* nothing shown yet, as after a relayout, so don't wait for a callback */
+    if (output->configured && !output->mapped && !output->frame_waiting) {
+      update = true;
+    }
+
+    if (output->frame_time != 0) {
+      if (interval_ms == 0 && output->frame_time_last != 0) {
+        interval_ms = output->frame_time - output->frame_time_last;
+        period_ns = refresh_period_ns(&output->render_info);
+      }
+      output->frame_time_last = output->frame_time;
+      output->frame_time = 0;
+      update = true;
+    }
+
+    /* only outputs that were configured after blanking are left */
+    if (capture->blanked && output->configured && !output->blanked) {
+      present_blank(output);
+    }
+
+    if (output->configured && !output->frame_waiting) {
+      ready_num++;
+    }
+  }
+
+  if (capture->blanked) {
+    return 0;
+  }
+
+  if (!update || ready_num == 0) {
+    return 0;
+  }
+
+  /*
+   * in mirror mode, capture once and show the same buffer on every output
+   * that's ready for it, the others catch up on their own frame callback so
+   * each is paced by its own refresh. a capture that stepped down only
+   * captures on some frame callbacks, and on the others commits just to keep
+   * the callbacks coming.
+   */
+  uint64_t base_seq = capture->shown != NULL ? capture->shown->seq : 0;
+  struct frame frame = { 0 };
+  uint64_t latency_start = monotonic_ns();
+  bool skip = interval_ms != 0 && capture->shown != NULL &&
+              quality_skip(&capture->quality);
+  uint64_t start = trace_now();
+  if (!skip) {
+    error = capture_frame(capture->context->x11, capture, &frame);
+    trace_span("capture_frame", capture->trace_track, start, 0);
+  }
+  if (error != 0) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < COUNTOF(capture->outputs); i++) {
+    struct output *output = capture->outputs[i];
+    if (output == NULL || !output->configured || output->frame_waiting) {
+      continue;
+    }
+
+    start = trace_now();
+    error = present_frame(output, i, &frame, base_seq);
+    trace_span("present_frame", output->trace_track, start, 0);
+    if (error != 0) {
+      return -1;
+    }
+  }
+
+  if (interval_ms != 0) {
+    adapt_quality(
+        capture,
+        interval_ms,
+        period_ns,
+        monotonic_ns() - latency_start);
+  }
+
+  return 0;
+}
+
+/* the event loop of a render thread, for the queue of its capture */
+static int
+render_outputs(struct capture *capture)
+{
+  int error = 0;
+  const struct render_context *context = capture->context;
+  /* poll ignores present_fd if it's -1 */
+  struct pollfd render_poll[4] = {
+    { .fd = wl_display_get_fd(context->wl), .events = POLLIN },
+    { .fd = context->stop_fd, .events = POLLIN },
+    { .fd = capture->stop_fd, .events = POLLIN },
+    { .fd = capture->present_fd, .events = POLLIN },
+  };
+
+  while (true) {
+    error = wl_display_dispatch_queue_pending(context->wl, capture->queue);
+    if (error < 0) {
+      perror("wl_display_dispatch_queue_pending");
+      return -1;
+    }
+
+    error = update_outputs(capture);
+    if (error != 0) {
+      return -1;
+    }
+
+    /* new events may have been queued meanwhile, handle those first */
+    error = wl_display_prepare_read_queue(context->wl, capture->queue);
+    if (error != 0) {
+      continue;
+    }
+
+    /* the GetImage requests for the next frame, and the commits. ignore
+     * errors, the event loop notices when a connection is gone */
+    if (context->x11 != NULL) {
+      xcb_flush(context->x11);
+    }
+    flush_wl(context->wl);
+
+    uint64_t wait_start = trace_now();
+    error = poll(render_poll, COUNTOF(render_poll), -1);
+    trace_span("wait", capture->trace_track, wait_start, error);
+    if (error < 0) {
+      wl_display_cancel_read(context->wl);
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("poll");
+      return -1;
+    }
+
+    if (render_poll[1].revents != 0 || render_poll[2].revents != 0) {
+      wl_display_cancel_read(context->wl);
+      return 0;
+    }
+
+    error = read_wl_events(context->wl, render_poll[0].revents);
+    if (error != 0) {
+      return -1;
+    }
+
+    if (render_poll[3].revents != 0) {
+      error = handle_present(capture);
+      if (error != 0) {
+        return -1;
+      }
+    }
+  }
+}
+
+static int
+signal_stop(int stop_fd)
+{
+  uint64_t stop = 1;
+
+  /* never read, so it stays readable for every thread polling it */
+  ssize_t written = write(stop_fd, &stop, sizeof stop);
+  if (written < 0) {
+    perror("write");
+    return -1;
+  }
+
+  return 0;
+}
+
+static void *
+render_thread(void *data)
+{
+  struct capture *capture = data;
+
+  int error = render_outputs(capture);
+  if (error != 0) {
+    /* take everything down with us */
+    signal_stop(capture->context->stop_fd);
+  }
+
+  return NULL;
+}
+
+int
+start_render_thread(struct capture *capture)
+{
+  int error = 0;
+
+  /* the event loop goes on changing info, the thread only sees this copy */
+  for (size_t i = 0; i < COUNTOF(capture->outputs); i++) {
+    struct output *output = capture->outputs[i];
+    if (output != NULL) {
+      output->render_info = output->info;
+    }
+  }
+
+  capture->stop_fd = eventfd(0, EFD_CLOEXEC);
+  if (capture->stop_fd < 0) {
+    perror("eventfd");
+    return -1;
+  }
+
+  error = pthread_create(&capture->thread, NULL, render_thread, capture);
+  if (error != 0) {
+    errno = error;
+    perror("pthread_create");
+    cleanup_fd(&capture->stop_fd);
+    return -1;
+  }
+  capture->thread_started = true;
+
+  return 0;
+}
+
+void
+stop_render_thread(struct capture *capture)
+{
+  if (!capture->thread_started) {
+    return;
+  }
+
+  signal_stop(capture->stop_fd);
+  pthread_join(capture->thread, NULL);
+  cleanup_fd(&capture->stop_fd);
+  capture->thread_started = false;
+}
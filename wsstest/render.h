@@ -0,0 +1,294 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef WSSTEST_RENDER_H
+#define WSSTEST_RENDER_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <wayland-client-core.h>
+#include <wayland-client-protocol.h>
+#include <xcb/shm.h>
+#include <xcb/xcb.h>
+
+#include "frame.h"
+#include "quality.h"
+#include "replay.h"
+
+/*
+ * the render threads, one per capture. each copies the frames of its hack into
+ * the buffers of the capture and presents them on its outputs, paced by their
+ * frame callbacks. the event loop sets up the captures and outputs, and stops
+ * a thread before it changes anything the thread reads.
+ */
+
+/* the frame buffers of a capture, one to show while the next is drawn. see
+ * reserve_frames in capture.h */
+enum {
+  buffers_max = 2,
+};
+
+/*
+ * frames are captured in strips of whole tile rows, at most strip_size_max
+ * bytes each, with up to strips_in_flight GetImage requests outstanding. this
+ * keeps each reply small and lets us copy a strip while the next ones arrive.
+ */
+enum {
+  strip_size_max = 1 << 20,
+  strips_in_flight = 4,
+  strips_max = frame_tiles_max,
+};
+
+enum hack_state {
+  hack_running = 0,
+  /* exited, waiting out the backoff */
+  hack_restarting,
+  /* restarted too often, a black frame is shown instead */
+  hack_failed,
+};
+
+struct output_info
+{
+  /* make and model */
+  char name[64];
+  /* like "DP-1", empty before wl_output v4 */
+  char connector[32];
+  /* in the compositor's space, tells identical monitors apart without v4 */
+  int32_t x;
+  int32_t y;
+  int32_t width;
+  int32_t height;
+  /* in mHz, 0 if unknown */
+  int32_t refresh;
+  /* enum wl_output_transform, the buffers of its capture are laid out for it */
+  int32_t transform;
+  int32_t scale;
+  /* all of the above has been sent at least once */
+  bool done;
+  /* times it was sent, to tell a snapshot from the current info */
+  uint32_t updates;
+};
+
+struct render_context;
+
+/*
+ * a hack drawing into an x11 window, and the buffers we copy it into. each
+ * capture has a thread presenting it on its outputs, with their surfaces,
+ * frame callbacks and buffers on its own queue, so a slow copy for one output
+ * doesn't hold up the others.
+ */
+struct capture
+{
+  xcb_window_t window;
+  pid_t screensaver_pid;
+  int32_t strip_height;
+  /* of GetImage, or of ShmGetImage once the strips are shared */
+  xcb_get_image_cookie_t strip_cookies[strips_max];
+  uint64_t strip_requested[strips_max];
+  /* with MIT-SHM, where the x server puts the strips in flight, a slot of
+   * strip_height rows each. see share_strips */
+  xcb_shm_seg_t strips_seg;
+  uint8_t *strips_mem;
+  size_t strips_len;
+  /* sharing failed, the strips come in replies */
+  bool strips_unshared;
+  uint32_t trace_track;
+  /* sized for the first output to show it, see size_capture. the format is
+   * settled once the buffers are made */
+  struct layout layout;
+  /* of the surfaces, that output's scale if the frames divide by it */
+  int32_t buffer_scale;
+  /* the registry name of that output, and its info updates when it was */
+  uint32_t layout_output;
+  uint32_t layout_updates;
+  struct buffer buffers[buffers_max]; /* TODO-BUFFER */
+  /* of buffers, all of them until a blanked capture gives them back */
+  size_t buffers_num;
+  /* what the budget holds for each of them, see frame_len */
+  size_t frame_len;
+  /* of an earlier layout, freed as the compositor releases them. they keep
+   * their part of the budget until then */
+  struct buffer retired[buffers_max];
+  size_t retired_num;
+  size_t retired_size;
+  size_t retired_frame_len;
+  size_t next_buffer;
+  /* NULL until the first frame is presented */
+  struct buffer *shown;
+  /* the render thread's own. frames put in buffers so far, the latest is
+   * shown */
+  uint64_t frame_seq;
+  bool captured;
+  /* in replay mode, the hack is stopped once this has recorded enough */
+  struct replay replay;
+  struct wl_event_queue *queue;
+  const struct render_context *context;
+  /* only changed while the thread is stopped. a slot of the wl_buffers of
+   * each buffer goes with each. TODO-OUTPUT */
+  struct output *outputs[buffer_surfaces_max];
+  pthread_t thread;
+  bool thread_started;
+  /* stops just this thread, while it's started */
+  int stop_fd;
+  /* counts the frames the hack presented, -1 without the Present extension */
+  int present_fd;
+  /* the hack presents its frames, so only those are captured */
+  bool present_driven;
+  /* a frame was presented since the last one was requested */
+  bool presented;
+  /* looked after by the event loop, see watch_screensaver */
+  int pidfd;
+  uint64_t spawned_ns;
+  uint64_t restart_ns;
+  uint32_t restarts_in_a_row;
+  uint32_t restarts;
+  uint32_t stalls;
+  /* the cpu time of the hack in clock ticks, and when it last went up or the
+   * window changed, see hack_cpu_ticks */
+  uint64_t hack_cpu;
+  uint64_t progress_ns;
+  /* atomic, written by the event loop. enum hack_state */
+  int hack_state;
+  uint32_t hack_generation;
+  /* atomic, written by the render thread. the window last changed */
+  uint64_t active_ns;
+  /* atomic, written by the render thread. replay has all it needs */
+  bool hack_retire;
+  /* atomic, written by the render thread. enum quality_level */
+  int quality_level;
+  /* the event loop's, the hack runs at hack_nice */
+  bool hack_niced;
+  /* the event loop's. which of the hacks runs, and the one started ahead of
+   * cycling to it, see cycle_screensaver */
+  size_t hack_n;
+  uint64_t cycled_ns;
+  size_t next_hack_n;
+  xcb_window_t next_window;
+  pid_t next_pid;
+  uint64_t next_spawned_ns;
+  bool next_presented;
+  /* the render thread's own */
+  uint32_t hack_generation_seen;
+  bool fallback_shown;
+  uint64_t frames;
+  uint64_t faults;
+  struct quality quality;
+  /* once blanked, the outputs show this and the buffers above are gone */
+  bool blanked;
+  struct buffer blank;
+};
+
+/* started while queue is set */
+struct captures
+{
+  struct capture captures[3]; /* TODO-OUTPUT */
+};
+
+/*
+ * a fullscreen surface on each output. in mirror mode they all show the same
+ * capture, otherwise each has its own.
+ */
+struct output
+{
+  struct wl_output *output;
+  /* in the registry */
+  uint32_t name;
+  /* written by the event loop whenever the compositor sends it */
+  struct output_info info;
+  /* of info, taken while the render thread was stopped, for it to read */
+  struct output_info render_info;
+  struct wl_surface *surface;
+  struct xdg_surface *xdg_surface;
+  struct xdg_toplevel *toplevel;
+  struct wl_callback *frame_callback;
+  /* committed, and its frame callback hasn't come yet */
+  bool frame_waiting;
+  uint64_t frame_requested;
+  uint32_t trace_track;
+  uint32_t frame_time;
+  uint32_t frame_time_last;
+  uint32_t configure;
+  /* acked a configure, so we're allowed to attach buffers */
+  bool configured;
+  /* has a buffer attached */
+  bool mapped;
+  /* the seq of the frame of the capture last committed, the one this
+   * output still shows. damage is only sent against that one */
+  uint64_t committed_seq;
+  /* stretches the blank buffer over the surface, once the capture is blanked */
+  struct wp_viewport *viewport;
+  bool blanked;
+  /* set once the surface exists, the render thread of the capture owns the
+   * output from then on */
+  struct capture *capture;
+};
+
+/* what the render threads share with the event loop */
+struct render_context
+{
+  struct wl_display *wl;
+  /* NULL for captures that only replay, like the benchmarks' */
+  xcb_connection_t *x11;
+  struct captures *captures;
+  /* written to stop the render threads, or by one that failed */
+  int stop_fd;
+  /* the x server has MIT-SHM 1.2, so the strips can be shared */
+  bool shm;
+  /* page faults are counted, see count_faults */
+  bool debug;
+};
+
+/* releases buffers of the capture, the data of each of their wl_buffers is
+ * the struct buffer */
+extern const struct wl_buffer_listener buffer_listener;
+
+int
+flush_wl(struct wl_display *wl);
+
+/*
+ * finish a read announced with wl_display_prepare_read(_queue) before polling.
+ * the render threads read the same connection, so we have to cancel if there
+ * was nothing, a read that blocks would block them too.
+ */
+int
+read_wl_events(struct wl_display *wl, short revents);
+
+/* the current mode of an output the way the user sees it, turned by its
+ * transform. 0 by 0 until it's known */
+void
+output_size(
+    const struct output_info *info,
+    int32_t *output_width,
+    int32_t *output_height);
+
+/* for when we stop reading a frame halfway through */
+void
+discard_strips(xcb_connection_t *x11, struct capture *capture);
+
+/* the memory the strips were shared in, if they were. x11 may be NULL if it's
+ * only unmapped, the server forgets it with the connection */
+void
+unshare_strips(xcb_connection_t *x11, struct capture *capture);
+
+/* the blank buffer over the whole surface, without a frame callback since
+ * nothing will change. the viewport scales it, not the buffer scale */
+void
+present_blank(struct output *output);
+
+/* presents the capture on its outputs until stopped. the outputs get a
+ * snapshot of their info to read meanwhile */
+int
+start_render_thread(struct capture *capture);
+
+/* the event loop starts it again, once it's done changing the outputs */
+void
+stop_render_thread(struct capture *capture);
+
+#endif /* WSSTEST_RENDER_H */
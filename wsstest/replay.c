@@ -0,0 +1,215 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "replay.h"
+
+enum {
+  /* tiles stored, past this we play back what we have */
+  replay_tiles_max = 256 << 20,
+};
+
+static uint64_t
+monotonic_ns(void)
+{
+  struct timespec now = { 0 };
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* where a tile is in the buffers, tiles are stored the way they're laid out */
+static struct damage_rect
+tile_rect(const struct layout *layout, int32_t tile_x, int32_t tile_y)
+{
+  struct damage_rect tile = {
+    .x = tile_x * tile_size,
+    .y = tile_y * tile_size,
+    .width = tile_size,
+    .height = tile_size,
+  };
+  return layout_rect(layout, tile);
+}
+
+/* make room for len more bytes of tiles, doubling as we go */
+static int
+reserve_tiles(struct replay *replay, size_t len)
+{
+  if (replay->tiles_len + len <= replay->tiles_max) {
+    return 0;
+  }
+
+  size_t tiles_max = replay->tiles_max > 0 ? replay->tiles_max : buffer_size;
+  while (tiles_max < replay->tiles_len + len) {
+    tiles_max *= 2;
+  }
+
+  uint8_t *tiles = realloc(replay->tiles, tiles_max);
+  if (tiles == NULL) {
+    perror("realloc");
+    return -1;
+  }
+  replay->tiles = tiles;
+  replay->tiles_max = tiles_max;
+
+  return 0;
+}
+
+static int
+reserve_frame(struct replay *replay, size_t frame_tiles)
+{
+  if (replay->frames_num < replay->frames_max) {
+    return 0;
+  }
+
+  size_t frames_max = replay->frames_max > 0 ? replay->frames_max * 2 : 64;
+  uint64_t *tile_hashes = realloc(
+      replay->tile_hashes,
+      frames_max * frame_tiles * sizeof *tile_hashes);
+  if (tile_hashes == NULL) {
+    perror("realloc");
+    return -1;
+  }
+  replay->tile_hashes = tile_hashes;
+
+  size_t *tile_offsets = realloc(
+      replay->tile_offsets,
+      frames_max * frame_tiles * sizeof *tile_offsets);
+  if (tile_offsets == NULL) {
+    perror("realloc");
+    return -1;
+  }
+  replay->tile_offsets = tile_offsets;
+  replay->frames_max = frames_max;
+
+  return 0;
+}
+
+int
+replay_record(
+    struct replay *replay,
+    const struct layout *layout,
+    const struct buffer *buffer)
+{
+  int error = 0;
+
+  size_t frame_tiles = (size_t)layout->tiles_x * layout->tiles_y;
+  error = reserve_frame(replay, frame_tiles);
+  if (error != 0) {
+    return -1;
+  }
+
+  size_t frame = frame_tiles * replay->frames_num;
+  for (int32_t tile_y = 0; tile_y < layout->tiles_y; tile_y++) {
+    for (int32_t tile_x = 0; tile_x < layout->tiles_x; tile_x++) {
+      size_t tile_n = frame + (size_t)layout->tiles_x * tile_y + tile_x;
+      uint64_t hash = buffer->damage.tile_hashes[tile_y][tile_x];
+      replay->tile_hashes[tile_n] = hash;
+
+      /* the same tile of the frame before */
+      size_t last = tile_n - frame_tiles;
+      if (replay->frames_num > 0 && replay->tile_hashes[last] == hash) {
+        replay->tile_offsets[tile_n] = replay->tile_offsets[last];
+        continue;
+      }
+
+      struct damage_rect rect = tile_rect(layout, tile_x, tile_y);
+      size_t row_len = layout->pixel_size * rect.width;
+      error = reserve_tiles(replay, row_len * rect.height);
+      if (error != 0) {
+        return -1;
+      }
+
+      const uint8_t *src =
+          &buffer->mem[layout->stride * rect.y + layout->pixel_size * rect.x];
+      replay->tile_offsets[tile_n] = replay->tiles_len;
+      for (int32_t row = 0; row < rect.height; row++) {
+        memcpy(
+            &replay->tiles[replay->tiles_len],
+            &src[layout->stride * row],
+            row_len);
+        replay->tiles_len += row_len;
+      }
+    }
+  }
+
+  if (replay->frames_num == 0) {
+    replay->start_ns = monotonic_ns();
+  }
+  replay->frames_num++;
+
+  bool long_enough = monotonic_ns() - replay->start_ns >= replay->duration_ns;
+  bool big_enough = replay->tiles_len >= replay_tiles_max;
+  if (!long_enough && !big_enough) {
+    return 0;
+  }
+
+  fprintf(
+      stderr,
+      "replay_record: %zu frames in %zu bytes%s\n",
+      replay->frames_num,
+      replay->tiles_len,
+      big_enough ? ", stopped early" : "");
+  return 1;
+}
+
+void
+replay_play(
+    struct replay *replay,
+    const struct layout *layout,
+    struct buffer *dest,
+    const struct buffer *shown,
+    struct frame *frame)
+{
+  size_t frame_tiles = (size_t)layout->tiles_x * layout->tiles_y;
+  size_t next = frame_tiles * replay->next_frame;
+  replay->next_frame = (replay->next_frame + 1) % replay->frames_num;
+
+  for (int32_t tile_y = 0; tile_y < layout->tiles_y; tile_y++) {
+    bool changed[frame_tiles_max] = { false };
+
+    for (int32_t tile_x = 0; tile_x < layout->tiles_x; tile_x++) {
+      size_t tile_n = next + (size_t)layout->tiles_x * tile_y + tile_x;
+      uint64_t hash = replay->tile_hashes[tile_n];
+      changed[tile_x] = !shown->damage.valid ||
+                        shown->damage.tile_hashes[tile_y][tile_x] != hash;
+      if (dest->damage.valid &&
+          dest->damage.tile_hashes[tile_y][tile_x] == hash) {
+        continue;
+      }
+
+      struct damage_rect rect = tile_rect(layout, tile_x, tile_y);
+      size_t row_len = layout->pixel_size * rect.width;
+      const uint8_t *src = &replay->tiles[replay->tile_offsets[tile_n]];
+      uint8_t *tile =
+          &dest->mem[layout->stride * rect.y + layout->pixel_size * rect.x];
+      for (int32_t row = 0; row < rect.height; row++) {
+        memcpy(&tile[layout->stride * row], &src[row_len * row], row_len);
+      }
+      dest->damage.tile_hashes[tile_y][tile_x] = hash;
+    }
+
+    add_damage_row(layout, frame, tile_y, changed);
+  }
+
+  finish_damage(frame);
+  dest->damage.valid = true;
+}
+
+void
+replay_free(struct replay *replay)
+{
+  free(replay->tile_hashes);
+  free(replay->tile_offsets);
+  free(replay->tiles);
+  *replay = (struct replay){ 0 };
+}
@@ -0,0 +1,67 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef WSSTEST_REPLAY_H
+#define WSSTEST_REPLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frame.h"
+
+/*
+ * a few seconds of a hack, recorded so it can be looped without running it.
+ * only the tiles that changed since the frame before are stored, the others
+ * point back at where they were stored last. playing a frame copies the tiles
+ * that differ from what the buffer holds, which is all the decoding there is.
+ * tiles are stored as laid out in the buffers, rotated if those are. a new
+ * layout needs a new recording.
+ */
+
+struct replay
+{
+  /* 0 if we're not recording */
+  uint64_t duration_ns;
+  uint64_t start_ns;
+  bool playing;
+  size_t next_frame;
+
+  /* of each frame, tiles_y by tiles_x of the layout it was recorded in */
+  uint64_t *tile_hashes;
+  /* into tiles */
+  size_t *tile_offsets;
+  size_t frames_num;
+  size_t frames_max;
+  /* tiles packed one after another, rows of tile width */
+  uint8_t *tiles;
+  size_t tiles_len;
+  size_t tiles_max;
+};
+
+/*
+ * add a completely captured buffer to the recording. returns 1 once the
+ * recording is long enough (or big enough) to play back, -1 on errors.
+ */
+int
+replay_record(
+    struct replay *replay,
+    const struct layout *layout,
+    const struct buffer *buffer);
+
+/* like update_strip for a whole frame, from the next recorded one */
+void
+replay_play(
+    struct replay *replay,
+    const struct layout *layout,
+    struct buffer *dest,
+    const struct buffer *shown,
+    struct frame *frame);
+
+void
+replay_free(struct replay *replay);
+
+#endif /* WSSTEST_REPLAY_H */
@@ -0,0 +1,392 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/* a few minutes of a busy event loop */
+enum {
+  trace_events_max = 1 << 16,
+};
+
+enum trace_kind {
+  trace_kind_span,
+  trace_kind_instant,
+  trace_kind_async,
+};
+
+struct trace_event
+{
+  const char *name;
+  uint64_t start;
+  uint64_t end;
+  /* of async spans, the number of the event */
+  uint64_t id;
+  uint32_t track;
+  uint32_t arg;
+  enum trace_kind kind;
+};
+
+/* written out if we crash, for whatever the trace shows leading up to it */
+static const int trace_crash_signals[] = {
+  SIGABRT,
+  SIGBUS,
+  SIGFPE,
+  SIGILL,
+  SIGSEGV,
+};
+
+static struct
+{
+  /* opened up front, the crash handler can only write to it */
+  int fd;
+  uint64_t epoch;
+  struct trace_event *events;
+  /* events ever recorded, threads claim their slot by bumping it */
+  size_t count;
+  uint32_t tracks;
+} trace = {
+  .fd = -1,
+};
+
+static void
+trace_write(void);
+
+/*
+ * trace_write only formats into its own buffer and writes it to the fd, which
+ * is async-signal-safe. the threads may still be recording, but we're going
+ * down either way. the default action follows once we return.
+ */
+static void
+trace_crash(int signal_number)
+{
+  (void)signal_number;
+  trace_write();
+}
+
+static uint64_t
+monotonic_ns(void)
+{
+  struct timespec now = { 0 };
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+int
+trace_open(const char *path)
+{
+  /* open now so a bad path fails before the lock rather than after */
+  trace.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (trace.fd < 0) {
+    perror("open");
+    return -1;
+  }
+
+  trace.events = calloc(trace_events_max, sizeof *trace.events);
+  if (trace.events == NULL) {
+    perror("calloc");
+    close(trace.fd);
+    trace.fd = -1;
+    return -1;
+  }
+
+  /* keep 0 free to mean "not traced" */
+  trace.epoch = monotonic_ns() - 1;
+
+  struct sigaction crash = {
+    .sa_handler = trace_crash,
+    .sa_flags = SA_RESETHAND | SA_NODEFER,
+  };
+  sigemptyset(&crash.sa_mask);
+  for (size_t i = 0; i < sizeof trace_crash_signals / sizeof(int); i++) {
+    sigaction(trace_crash_signals[i], &crash, NULL);
+  }
+
+  return 0;
+}
+
+uint64_t
+trace_now(void)
+{
+  if (trace.events == NULL) {
+    return 0;
+  }
+
+  return monotonic_ns() - trace.epoch;
+}
+
+static void
+trace_record(
+    const char *name,
+    uint32_t track,
+    uint64_t start,
+    uint64_t end,
+    uint32_t arg,
+    enum trace_kind kind)
+{
+  size_t n = __atomic_fetch_add(&trace.count, 1, __ATOMIC_RELAXED);
+  trace.events[n % trace_events_max] = (struct trace_event){
+    .name = name,
+    .start = start,
+    .end = end,
+    .id = n,
+    .track = track,
+    .arg = arg,
+    .kind = kind,
+  };
+
+  uint32_t tracks = __atomic_load_n(&trace.tracks, __ATOMIC_RELAXED);
+  while (track < trace_track_input && track + 1 > tracks &&
+         !__atomic_compare_exchange_n(
+             &trace.tracks,
+             &tracks,
+             track + 1,
+             false,
+             __ATOMIC_RELAXED,
+             __ATOMIC_RELAXED)) {
+  }
+}
+
+void
+trace_span(const char *name, uint32_t track, uint64_t start, uint32_t arg)
+{
+  if (trace.events == NULL || start == 0) {
+    return;
+  }
+
+  trace_record(name, track, start, trace_now(), arg, trace_kind_span);
+}
+
+void
+trace_async(const char *name, uint32_t track, uint64_t start, uint32_t arg)
+{
+  if (trace.events == NULL || start == 0) {
+    return;
+  }
+
+  trace_record(name, track, start, trace_now(), arg, trace_kind_async);
+}
+
+void
+trace_instant(const char *name, uint32_t track, uint32_t arg)
+{
+  if (trace.events == NULL) {
+    return;
+  }
+
+  uint64_t now = trace_now();
+  trace_record(name, track, now, now, arg, trace_kind_instant);
+}
+
+/*
+ * what trace_write has formatted and not written yet. it runs in trace_crash
+ * too, where stdio isn't safe, so it formats by hand and calls write(2)
+ */
+struct trace_out
+{
+  char text[4096];
+  size_t len;
+};
+
+static void
+out_flush(struct trace_out *out)
+{
+  size_t written = 0;
+  while (written < out->len) {
+    ssize_t got = write(trace.fd, &out->text[written], out->len - written);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      break;
+    }
+    written += (size_t)got;
+  }
+  out->len = 0;
+}
+
+static void
+out_str(struct trace_out *out, const char *str)
+{
+  for (; *str != '\0'; str++) {
+    if (out->len == sizeof out->text) {
+      out_flush(out);
+    }
+    out->text[out->len++] = *str;
+  }
+}
+
+static void
+out_uint(struct trace_out *out, uint64_t n)
+{
+  char digits[24] = { 0 };
+  size_t i = sizeof digits - 1;
+  do {
+    digits[--i] = (char)('0' + n % 10);
+    n /= 10;
+  } while (n > 0);
+  out_str(out, &digits[i]);
+}
+
+/* nanoseconds as microseconds, like %.3f would */
+static void
+out_us(struct trace_out *out, uint64_t ns)
+{
+  char fraction[4] = {
+    (char)('0' + ns / 100 % 10),
+    (char)('0' + ns / 10 % 10),
+    (char)('0' + ns % 10),
+    '\0',
+  };
+  out_uint(out, ns / 1000);
+  out_str(out, ".");
+  out_str(out, fraction);
+}
+
+/* the fields every event starts with, up to the timestamp */
+static void
+out_event(
+    struct trace_out *out,
+    const struct trace_event *event,
+    const char *phase,
+    uint64_t pid,
+    uint64_t ts)
+{
+  out_str(out, "{\"name\":\"");
+  out_str(out, event->name);
+  out_str(out, "\",");
+  if (event->kind == trace_kind_async) {
+    out_str(out, "\"cat\":\"async\",\"id\":");
+    out_uint(out, event->id);
+    out_str(out, ",");
+  }
+  out_str(out, "\"ph\":\"");
+  out_str(out, phase);
+  out_str(out, "\",\"pid\":");
+  out_uint(out, pid);
+  out_str(out, ",\"tid\":");
+  out_uint(out, event->track);
+  out_str(out, ",\"ts\":");
+  out_us(out, ts);
+}
+
+static void
+write_event(
+    struct trace_out *out,
+    const struct trace_event *event,
+    uint64_t pid)
+{
+  switch (event->kind) {
+  case trace_kind_span:
+    out_event(out, event, "X", pid, event->start);
+    out_str(out, ",\"dur\":");
+    out_us(out, event->end - event->start);
+    break;
+  case trace_kind_instant:
+    out_event(out, event, "i", pid, event->start);
+    out_str(out, ",\"s\":\"t\"");
+    break;
+  case trace_kind_async:
+    /* a begin and an end, matched up by their id */
+    out_event(out, event, "b", pid, event->start);
+    out_str(out, ",\"args\":{\"n\":");
+    out_uint(out, event->arg);
+    out_str(out, "}},\n");
+    out_event(out, event, "e", pid, event->end);
+    out_str(out, "}");
+    return;
+  } /* switch (event->kind) */
+
+  out_str(out, ",\"args\":{\"n\":");
+  out_uint(out, event->arg);
+  out_str(out, "}}");
+}
+
+static void
+write_track_name(
+    struct trace_out *out,
+    uint64_t pid,
+    uint64_t track,
+    const char *name,
+    bool numbered)
+{
+  out_str(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":");
+  out_uint(out, pid);
+  out_str(out, ",\"tid\":");
+  out_uint(out, track);
+  out_str(out, ",\"args\":{\"name\":\"");
+  out_str(out, name);
+  if (numbered) {
+    out_uint(out, track - 1);
+  }
+  out_str(out, "\"}},\n");
+}
+
+/* all of the ring, for trace_close and trace_crash */
+static void
+trace_write(void)
+{
+  struct trace_out out = { 0 };
+  uint64_t pid = (uint64_t)getpid();
+  out_str(&out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+  for (uint32_t track = 0; track < trace.tracks; track++) {
+    if (track == 0) {
+      write_track_name(&out, pid, track, "event loop", false);
+    } else {
+      write_track_name(&out, pid, track, "output ", true);
+    }
+  }
+  write_track_name(&out, pid, trace_track_input, "input", false);
+
+  /* oldest first, which is right after the newest once we wrapped */
+  bool wrapped = trace.count > trace_events_max;
+  size_t count = wrapped ? trace_events_max : trace.count;
+  size_t first = wrapped ? trace.count % trace_events_max : 0;
+  for (size_t i = 0; i < count; i++) {
+    write_event(&out, &trace.events[(first + i) % trace_events_max], pid);
+    out_str(&out, i + 1 < count ? ",\n" : "\n");
+  }
+
+  out_str(&out, "]}\n");
+  out_flush(&out);
+}
+
+int
+trace_close(void)
+{
+  int error = 0;
+
+  if (trace.fd < 0) {
+    return 0;
+  }
+
+  for (size_t i = 0; i < sizeof trace_crash_signals / sizeof(int); i++) {
+    signal(trace_crash_signals[i], SIG_DFL);
+  }
+
+  trace_write();
+  error = close(trace.fd);
+  trace.fd = -1;
+  free(trace.events);
+  trace.events = NULL;
+  if (error != 0) {
+    perror("close");
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * SPDX-FileCopyrightText: 2025 AstroSnail <astrosnail@protonmail.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef WSSTEST_TRACE_H
+#define WSSTEST_TRACE_H
+
+#include <stdint.h>
+
+/*
+ * opt-in timeline of the event loop. events go to a ring buffer in memory and
+ * are written out by trace_close in the chrome trace event format, which
+ * perfetto and chrome://tracing can open, or as we go down if we crash. spans
+ * are only recorded once they end, so a ring that wrapped around never has a
+ * begin without its end.
+ *
+ * names must be string literals, only the pointer is kept. each track is shown
+ * as a thread: 0 is the event loop, 1 + n is output n, and trace_track_input
+ * is the input thread. spans may be recorded from any thread between
+ * trace_open and trace_close.
+ */
+
+enum {
+  trace_track_input = 0xffff,
+};
+
+int
+trace_open(const char *path);
+
+/* timestamp to pass to trace_span later, 0 while tracing is off */
+uint64_t
+trace_now(void);
+
+void
+trace_span(const char *name, uint32_t track, uint64_t start, uint32_t arg);
+
+/* a span that overlaps the others on its track without nesting in them, like
+ * a request waiting for its reply. shown apart from them */
+void
+trace_async(const char *name, uint32_t track, uint64_t start, uint32_t arg);
+
+void
+trace_instant(const char *name, uint32_t track, uint32_t arg);
+
+int
+trace_close(void);
+
+#endif /* WSSTEST_TRACE_H */